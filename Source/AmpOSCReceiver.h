@@ -19,8 +19,12 @@ public:
         }
         
         modelAddressPattern = "/parameter/NeuralPi/Model";
+        model2AddressPattern = "/parameter/NeuralPi/Model2";
         irAddressPattern = "/parameter/NeuralPi/Ir";
         irWetLevelAddressPattern = "/parameter/NeuralPi/IrWetLevel";
+        irMinPhaseAddressPattern = "/parameter/NeuralPi/IrMinPhase";
+        irEnergyAddressPattern = "/parameter/NeuralPi/IrEnergy";
+        irLengthAddressPattern = "/parameter/NeuralPi/IrLength";
 
         gainAddressPattern = "/parameter/NeuralPi/Gain";
         masterAddressPattern = "/parameter/NeuralPi/Master";
@@ -28,6 +32,16 @@ public:
         midAddressPattern = "/parameter/NeuralPi/Mid";
         trebleAddressPattern = "/parameter/NeuralPi/Treble";
         presenceAddressPattern = "/parameter/NeuralPi/Presence";
+        precisionAddressPattern = "/parameter/NeuralPi/Precision";
+        activationsAddressPattern = "/parameter/NeuralPi/Activations";
+        nativeRateAddressPattern = "/parameter/NeuralPi/NativeRate";
+        pipelineAddressPattern = "/parameter/NeuralPi/Pipeline";
+        dualAmpAddressPattern = "/parameter/NeuralPi/DualAmp";
+        ampBlendAddressPattern = "/parameter/NeuralPi/AmpBlend";
+        stereoAddressPattern = "/parameter/NeuralPi/Stereo";
+        morphAddressPattern = "/parameter/NeuralPi/Morph";
+        idleSkipAddressPattern = "/parameter/NeuralPi/IdleSkip";
+        compressionAddressPattern = "/parameter/NeuralPi/Compression";
 
         delayAddressPattern = "/parameter/NeuralPi/Delay";
         delayWetLevelAddressPattern = "/parameter/NeuralPi/DelayWetLevel";
@@ -59,8 +73,12 @@ public:
         recordAddressPattern = "/parameter/NeuralPi/Record";
 
         addListener(this, modelAddressPattern);
+        addListener(this, model2AddressPattern);
         addListener(this, irAddressPattern);
         addListener(this, irWetLevelAddressPattern);
+        addListener(this, irMinPhaseAddressPattern);
+        addListener(this, irEnergyAddressPattern);
+        addListener(this, irLengthAddressPattern);
 
         addListener(this, gainAddressPattern);
         addListener(this, masterAddressPattern);
@@ -68,6 +86,16 @@ public:
         addListener(this, midAddressPattern);
         addListener(this, trebleAddressPattern);
         addListener(this, presenceAddressPattern);
+        addListener(this, precisionAddressPattern);
+        addListener(this, activationsAddressPattern);
+        addListener(this, nativeRateAddressPattern);
+        addListener(this, pipelineAddressPattern);
+        addListener(this, dualAmpAddressPattern);
+        addListener(this, ampBlendAddressPattern);
+        addListener(this, stereoAddressPattern);
+        addListener(this, morphAddressPattern);
+        addListener(this, idleSkipAddressPattern);
+        addListener(this, compressionAddressPattern);
 
         addListener(this, delayAddressPattern);
         addListener(this, delayWetLevelAddressPattern);
@@ -105,6 +133,8 @@ public:
         {
             if (message.getAddressPattern().matches(modelAddressPattern))
                 modelCallback(message[0].getString());
+            if (message.getAddressPattern().matches(model2AddressPattern))
+                model2Callback(message[0].getString());
             if (message.getAddressPattern().matches(irAddressPattern))
                 irCallback(message[0].getString());
         }
@@ -113,6 +143,12 @@ public:
         {
             if (message.getAddressPattern().matches(irWetLevelAddressPattern))
                 irWetLevelCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(irMinPhaseAddressPattern))
+                irMinPhaseCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(irEnergyAddressPattern))
+                irEnergyCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(irLengthAddressPattern))
+                irLengthCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
 
             if (message.getAddressPattern().matches(gainAddressPattern))
                 gainCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
@@ -126,6 +162,26 @@ public:
                 trebleCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
             if (message.getAddressPattern().matches(presenceAddressPattern))
                 presenceCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(precisionAddressPattern))
+                precisionCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(activationsAddressPattern))
+                activationsCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(nativeRateAddressPattern))
+                nativeRateCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(pipelineAddressPattern))
+                pipelineCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(dualAmpAddressPattern))
+                dualAmpCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(ampBlendAddressPattern))
+                ampBlendCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(stereoAddressPattern))
+                stereoCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(morphAddressPattern))
+                morphCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(idleSkipAddressPattern))
+                idleSkipCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
+            if (message.getAddressPattern().matches(compressionAddressPattern))
+                compressionCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
                 
             if (message.getAddressPattern().matches(delayAddressPattern))
                 delayCallback(jlimit(0.0f, 1.0f, message[0].getFloat32()));
@@ -185,6 +241,12 @@ public:
         {
             if (message.getAddressPattern().matches(irWetLevelAddressPattern))
                 irWetLevelCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(irMinPhaseAddressPattern))
+                irMinPhaseCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(irEnergyAddressPattern))
+                irEnergyCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(irLengthAddressPattern))
+                irLengthCallback(jlimit(0, 1, message[0].getInt32()));
 
             if (message.getAddressPattern().matches(gainAddressPattern))
                 gainCallback(jlimit(0, 1, message[0].getInt32()));
@@ -198,6 +260,26 @@ public:
                 trebleCallback(jlimit(0, 1, message[0].getInt32()));
             if (message.getAddressPattern().matches(presenceAddressPattern))
                 presenceCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(precisionAddressPattern))
+                precisionCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(activationsAddressPattern))
+                activationsCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(nativeRateAddressPattern))
+                nativeRateCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(pipelineAddressPattern))
+                pipelineCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(dualAmpAddressPattern))
+                dualAmpCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(ampBlendAddressPattern))
+                ampBlendCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(stereoAddressPattern))
+                stereoCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(morphAddressPattern))
+                morphCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(idleSkipAddressPattern))
+                idleSkipCallback(jlimit(0, 1, message[0].getInt32()));
+            if (message.getAddressPattern().matches(compressionAddressPattern))
+                compressionCallback(jlimit(0, 1, message[0].getInt32()));
                 
             if (message.getAddressPattern().matches(delayAddressPattern))
                 delayCallback(jlimit(0, 1, message[0].getInt32()));
@@ -256,8 +338,12 @@ public:
 
 public:
     std::function<void(juce::String)> modelCallback;
+    std::function<void(juce::String)> model2Callback;
     std::function<void(juce::String)> irCallback;
     std::function<void(float)> irWetLevelCallback;
+    std::function<void(float)> irMinPhaseCallback;
+    std::function<void(float)> irEnergyCallback;
+    std::function<void(float)> irLengthCallback;
 
     std::function<void(float)> gainCallback;
     std::function<void(float)> masterCallback;
@@ -265,6 +351,16 @@ public:
     std::function<void(float)> midCallback;
     std::function<void(float)> trebleCallback;
     std::function<void(float)> presenceCallback;
+    std::function<void(float)> precisionCallback;
+    std::function<void(float)> activationsCallback;
+    std::function<void(float)> nativeRateCallback;
+    std::function<void(float)> pipelineCallback;
+    std::function<void(float)> dualAmpCallback;
+    std::function<void(float)> ampBlendCallback;
+    std::function<void(float)> stereoCallback;
+    std::function<void(float)> morphCallback;
+    std::function<void(float)> idleSkipCallback;
+    std::function<void(float)> compressionCallback;
 
     std::function<void(float)> delayCallback;
     std::function<void(float)> delayWetLevelCallback;
@@ -297,8 +393,12 @@ public:
 
 private:
     String modelAddressPattern;
+    String model2AddressPattern;
     String irAddressPattern;
     String irWetLevelAddressPattern;
+    String irMinPhaseAddressPattern;
+    String irEnergyAddressPattern;
+    String irLengthAddressPattern;
 
     String gainAddressPattern;
     String masterAddressPattern;
@@ -306,6 +406,16 @@ private:
     String midAddressPattern;
     String trebleAddressPattern;
     String presenceAddressPattern;
+    String precisionAddressPattern;
+    String activationsAddressPattern;
+    String nativeRateAddressPattern;
+    String pipelineAddressPattern;
+    String dualAmpAddressPattern;
+    String ampBlendAddressPattern;
+    String stereoAddressPattern;
+    String morphAddressPattern;
+    String idleSkipAddressPattern;
+    String compressionAddressPattern;
 
     String delayAddressPattern;
     String delayWetLevelAddressPattern;
@@ -0,0 +1,235 @@
+/*
+  ==============================================================================
+
+   This file is part of the JUCE library.
+   Copyright (c) 2022 - Raw Material Software Limited
+
+   JUCE is an open source library subject to commercial or open-source
+   licensing.
+
+   By using JUCE, you agree to the terms of both the JUCE 7 End-User License
+   Agreement and JUCE Privacy Policy.
+
+   End User License Agreement: www.juce.com/juce-7-licence
+   Privacy Policy: www.juce.com/juce-privacy-policy
+
+   Or: You may also use this code under the terms of the GPL v3 (see
+   www.gnu.org/licenses).
+
+   JUCE IS PROVIDED "AS IS" WITHOUT ANY WARRANTY, AND ALL WARRANTIES, WHETHER
+   EXPRESSED OR IMPLIED, INCLUDING MERCHANTABILITY AND FITNESS FOR PURPOSE, ARE
+   DISCLAIMED.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// Wait-free building blocks for loading DSP state (CabSim engines, neural
+// models) on a background thread and swapping it in on the audio thread.
+
+template <typename Element>
+class Queue
+{
+public:
+    explicit Queue (int size)
+        : fifo (size), storage (static_cast<size_t> (size)) {}
+
+    bool push (Element& element) noexcept
+    {
+        if (fifo.getFreeSpace() == 0)
+            return false;
+
+        const auto writer = fifo.write (1);
+
+        if (writer.blockSize1 != 0)
+            storage[static_cast<size_t> (writer.startIndex1)] = std::move (element);
+        else if (writer.blockSize2 != 0)
+            storage[static_cast<size_t> (writer.startIndex2)] = std::move (element);
+
+        return true;
+    }
+
+    template <typename Fn>
+    void pop (Fn&& fn) { popN (1, std::forward<Fn> (fn)); }
+
+    template <typename Fn>
+    void popAll (Fn&& fn) { popN (fifo.getNumReady(), std::forward<Fn> (fn)); }
+
+    bool hasPendingMessages() const noexcept { return fifo.getNumReady() > 0; }
+
+private:
+    template <typename Fn>
+    void popN (int n, Fn&& fn)
+    {
+        fifo.read (n).forEach ([&] (int index)
+                               {
+                                   fn (storage[static_cast<size_t> (index)]);
+                               });
+    }
+
+    AbstractFifo fifo;
+    std::vector<Element> storage;
+};
+
+class BackgroundMessageQueue : private Thread
+{
+public:
+    explicit BackgroundMessageQueue (int entries, const String& threadName = "CabSim background loader")
+        : Thread (threadName), queue (entries)
+    {}
+
+    using IncomingCommand = juce::dsp::FixedSizeFunction<400, void()>;
+
+    // Push functions here, and they'll be called later on a background thread.
+    // This function is wait-free.
+    // This function is only safe to call from a single thread at a time.
+    bool push (IncomingCommand& command) { return queue.push (command); }
+
+    void popAll()
+    {
+        const ScopedLock lock (popMutex);
+        queue.popAll ([] (IncomingCommand& command) { command(); command = nullptr; });
+    }
+
+    using Thread::startThread;
+    using Thread::stopThread;
+
+private:
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            const auto tryPop = [&]
+            {
+                const ScopedLock lock (popMutex);
+
+                if (! queue.hasPendingMessages())
+                    return false;
+
+                queue.pop ([] (IncomingCommand& command) { command(); command = nullptr;});
+                return true;
+            };
+
+            if (! tryPop())
+                sleep (10);
+        }
+    }
+
+    CriticalSection popMutex;
+    Queue<IncomingCommand> queue;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BackgroundMessageQueue)
+};
+
+//==============================================================================
+// Hands a heap object over to the audio thread. `get` never blocks: it returns
+// nullptr if there is nothing new, or if `set` is running at the same time.
+template <typename Element>
+class TryLockedPtr
+{
+public:
+    void set (std::unique_ptr<Element> p)
+    {
+        const SpinLock::ScopedLockType lock (mutex);
+        ptr = std::move (p);
+    }
+
+    std::unique_ptr<Element> get()
+    {
+        const SpinLock::ScopedTryLockType lock (mutex);
+        return lock.isLocked() ? std::move (ptr) : nullptr;
+    }
+
+    // True if the last object that was set hasn't been taken yet
+    bool isPending()
+    {
+        const SpinLock::ScopedLockType lock (mutex);
+        return ptr != nullptr;
+    }
+
+private:
+    std::unique_ptr<Element> ptr;
+    SpinLock mutex;
+};
+
+//==============================================================================
+// Crossfades from the output of a previous processor to the current one over 50ms.
+class CrossoverMixer
+{
+public:
+    void reset()
+    {
+        smoother.setCurrentAndTargetValue (1.0f);
+    }
+
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        smoother.reset (spec.sampleRate, 0.05);
+        smootherBuffer.setSize (1, static_cast<int> (spec.maximumBlockSize));
+        mixBuffer.setSize (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
+        reset();
+    }
+
+    template <typename ProcessCurrent, typename ProcessPrevious, typename NotifyDone>
+    void processSamples (const juce::dsp::AudioBlock<const float>& input,
+                         juce::dsp::AudioBlock<float>& output,
+                         ProcessCurrent&& current,
+                         ProcessPrevious&& previous,
+                         NotifyDone&& notifyDone)
+    {
+        if (smoother.isSmoothing())
+        {
+            const auto numSamples = static_cast<int> (input.getNumSamples());
+
+            for (auto sample = 0; sample != numSamples; ++sample)
+                smootherBuffer.setSample (0, sample, smoother.getNextValue());
+
+            juce::dsp::AudioBlock<float> mixBlock (mixBuffer);
+            mixBlock.clear();
+            previous (input, mixBlock);
+
+            for (size_t channel = 0; channel != output.getNumChannels(); ++channel)
+            {
+                FloatVectorOperations::multiply (mixBlock.getChannelPointer (channel),
+                                                 smootherBuffer.getReadPointer (0),
+                                                 numSamples);
+            }
+
+            FloatVectorOperations::multiply (smootherBuffer.getWritePointer (0), -1.0f, numSamples);
+            FloatVectorOperations::add (smootherBuffer.getWritePointer (0), 1.0f, numSamples);
+
+            current (input, output);
+
+            for (size_t channel = 0; channel != output.getNumChannels(); ++channel)
+            {
+                FloatVectorOperations::multiply (output.getChannelPointer (channel),
+                                                 smootherBuffer.getReadPointer (0),
+                                                 numSamples);
+                FloatVectorOperations::add (output.getChannelPointer (channel),
+                                            mixBlock.getChannelPointer (channel),
+                                            numSamples);
+            }
+
+            if (! smoother.isSmoothing())
+                notifyDone();
+        }
+        else
+        {
+            current (input, output);
+        }
+    }
+
+    void beginTransition()
+    {
+        smoother.setCurrentAndTargetValue (1.0f);
+        smoother.setTargetValue (0.0f);
+    }
+
+private:
+    LinearSmoothedValue<float> smoother;
+    AudioBuffer<float> smootherBuffer;
+    AudioBuffer<float> mixBuffer;
+};
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <RTNeural/RTNeural.h>
+
+#include "Activations.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+/**
+    BlockLSTM for num_streams independent signals (the channels of a stereo
+    input, or several guitars) advanced in lock-step through the same
+    weights. Every stream has its own hidden and cell state; they share the
+    weights and the conditioning parameters.
+
+    With one stream the recurrent product U*h is a matrix-vector product, and
+    every weight that is loaded is used for a single multiply-add. Here the
+    hidden states of all streams form a [hidden_size][num_streams] matrix, so
+    the step is a small matrix-matrix product: each register of U is loaded
+    once and used for num_streams multiply-adds, into num_streams independent
+    accumulators that stay in registers for the whole column. The weight
+    traffic, which is what limits the single stream kernel, is shared by all
+    the streams.
+
+    Each stream's output matches BlockLSTM's to float precision. The sums are
+    split across different registers, so it isn't guaranteed to be bit for
+    bit the same.
+
+    The setters take the same layout as BlockLSTM.
+*/
+template <int input_size, int hidden_size, int num_streams, typename Activation = Activations::Exact>
+class BatchedLSTM
+{
+    using v_type = xsimd::simd_type<float>;
+    static constexpr int v_size = (int) v_type::size;
+    static constexpr int v_hidden = (hidden_size + v_size - 1) / v_size;
+
+    // Gate order is the same as PyTorch and RTNeural: input, forget, cell, output
+    static constexpr int numGates = 4;
+
+    static_assert (num_streams >= 1, "BatchedLSTM needs at least one stream");
+
+public:
+    // The input projection of every stream is kept for a chunk, so the buffer
+    // is the same size as BlockLSTM's
+    static constexpr int maxChunkSize = std::max (1, 32 / num_streams);
+
+    static constexpr int getNumStreams() noexcept { return num_streams; }
+
+    BatchedLSTM()
+    {
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                b[g][k] = v_type (0.0f);
+
+                for (int i = 0; i < input_size; ++i)
+                    W[i][g][k] = v_type (0.0f);
+
+                for (int j = 0; j < hidden_size; ++j)
+                    U[j][g][k] = v_type (0.0f);
+            }
+        }
+
+        for (int k = 0; k < v_hidden; ++k)
+            denseW[k] = v_type (0.0f);
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (int s = 0; s < num_streams; ++s)
+        {
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                h[s][k] = v_type (0.0f);
+                c[s][k] = v_type (0.0f);
+            }
+        }
+
+        for (int j = 0; j < hidden_size; ++j)
+            for (int s = 0; s < num_streams; ++s)
+                hBroadcast[j][s] = v_type (0.0f);
+    }
+
+    /** The hidden and cell state of every stream */
+    static constexpr size_t getStateSize() noexcept
+    {
+        return sizeof (v_type[num_streams][v_hidden]) * 2 + sizeof (v_type[hidden_size][num_streams]);
+    }
+
+    void saveState (void* dest) const noexcept
+    {
+        auto* bytes = static_cast<char*> (dest);
+        std::memcpy (bytes, h, sizeof (h));
+        std::memcpy (bytes + sizeof (h), c, sizeof (c));
+        std::memcpy (bytes + sizeof (h) + sizeof (c), hBroadcast, sizeof (hBroadcast));
+    }
+
+    void restoreState (const void* source) noexcept
+    {
+        const auto* bytes = static_cast<const char*> (source);
+        std::memcpy (h, bytes, sizeof (h));
+        std::memcpy (c, bytes + sizeof (h), sizeof (c));
+        std::memcpy (hBroadcast, bytes + sizeof (h) + sizeof (c), sizeof (hBroadcast));
+    }
+
+    /** wVals has the shape [input_size][4 * hidden_size], with the rows stored contiguously */
+    void setWVals (const float* wVals)
+    {
+        for (int i = 0; i < input_size; ++i)
+            for (int g = 0; g < numGates; ++g)
+                loadPadded (W[i][g], wVals + (i * numGates + g) * hidden_size);
+    }
+
+    /** uVals has the shape [hidden_size][4 * hidden_size], with the rows stored contiguously */
+    void setUVals (const float* uVals)
+    {
+        for (int j = 0; j < hidden_size; ++j)
+            for (int g = 0; g < numGates; ++g)
+                loadPadded (U[j][g], uVals + (j * numGates + g) * hidden_size);
+    }
+
+    /** bVals has the shape [4 * hidden_size], with the input and hidden biases already summed */
+    void setBVals (const float* bVals)
+    {
+        for (int g = 0; g < numGates; ++g)
+            loadPadded (b[g], bVals + g * hidden_size);
+    }
+
+    /** weights has the shape [1][hidden_size] */
+    void setDenseWeights (const float* weights)
+    {
+        loadPadded (denseW, weights);
+    }
+
+    void setDenseBias (const float* bias)
+    {
+        denseB = bias[0];
+    }
+
+    /** Adds the input sample to the output (enabled by default) */
+    void setSkipConnection (bool shouldAddInput)
+    {
+        skipGain = shouldAddInput ? 1.0f : 0.0f;
+    }
+
+    /** Processes a block of num_streams channels, with the conditioning
+        parameters moving linearly from paramsStart to paramsEnd like BlockLSTM.
+
+        An input may be the same buffer as any output. Outputs that are nullptr
+        are processed but not written.
+    */
+    void process (const float* const* input, const float* paramsStart, const float* paramsEnd, float* const* output, int numSamples) noexcept
+    {
+        if (numSamples <= 0)
+            return;
+
+        const auto isRamping = prepareConditioning (paramsStart, paramsEnd, numSamples);
+
+        for (int start = 0; start < numSamples; start += maxChunkSize)
+        {
+            const auto chunkSize = std::min (maxChunkSize, numSamples - start);
+
+            if (isRamping)
+                projectInputs<true> (input, start, chunkSize);
+            else
+                projectInputs<false> (input, start, chunkSize);
+
+            for (int n = 0; n < chunkSize; ++n)
+            {
+                float y[num_streams];
+                recurrentStep (projection[n], y);
+
+                for (int s = 0; s < num_streams; ++s)
+                    if (output[s] != nullptr)
+                        output[s][start + n] = y[s] + skipGain * inputChunk[n][s];
+            }
+        }
+    }
+
+    /** Runs the same signal through every stream and returns the first one, which
+        is how a multi-stream model is warmed up
+    */
+    void process (const float* input, const float* paramsStart, const float* paramsEnd, float* output, int numSamples) noexcept
+    {
+        const float* inputs[num_streams];
+        float* outputs[num_streams] {};
+
+        std::fill (std::begin (inputs), std::end (inputs), input);
+        outputs[0] = output;
+
+        process (inputs, paramsStart, paramsEnd, outputs, numSamples);
+    }
+
+private:
+    using GateBlock = v_type[numGates][v_hidden];
+
+    static void loadPadded (v_type (&dest)[v_hidden], const float* src)
+    {
+        alignas (v_type) float padded[v_hidden * v_size] {};
+        std::copy (src, src + hidden_size, padded);
+
+        for (int k = 0; k < v_hidden; ++k)
+            dest[k] = xsimd::load_aligned (padded + k * v_size);
+    }
+
+    // Same as BlockLSTM: the parameters are shared by all the streams
+    bool prepareConditioning (const float* paramsStart, const float* paramsEnd, int numSamples) noexcept
+    {
+        bool isRamping = false;
+
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                conditioning[g][k] = b[g][k];
+                conditioningStep[g][k] = v_type (0.0f);
+            }
+        }
+
+        for (int i = 1; i < input_size; ++i)
+        {
+            const auto delta = (paramsEnd[i - 1] - paramsStart[i - 1]) / (float) numSamples;
+            const v_type p (paramsEnd[i - 1] - delta * (float) (numSamples - 1));
+            const v_type dp (delta);
+
+            for (int g = 0; g < numGates; ++g)
+            {
+                for (int k = 0; k < v_hidden; ++k)
+                {
+                    conditioning[g][k] = xsimd::fma (W[i][g][k], p, conditioning[g][k]);
+                    conditioningStep[g][k] = xsimd::fma (W[i][g][k], dp, conditioningStep[g][k]);
+                }
+            }
+
+            isRamping = isRamping || delta != 0.0f;
+        }
+
+        return isRamping;
+    }
+
+    // projection[n][s] = b + W_p * p[n] + W_x * x[s][n]. The inputs are copied
+    // first, so outputs can overwrite them.
+    template <bool isRamping>
+    void projectInputs (const float* const* input, int start, int chunkSize) noexcept
+    {
+        for (int n = 0; n < chunkSize; ++n)
+        {
+            for (int s = 0; s < num_streams; ++s)
+            {
+                const auto x = input[s][start + n];
+                inputChunk[n][s] = x;
+
+                const v_type xs (x);
+
+                for (int g = 0; g < numGates; ++g)
+                    for (int k = 0; k < v_hidden; ++k)
+                        projection[n][s][g][k] = xsimd::fma (W[0][g][k], xs, conditioning[g][k]);
+            }
+
+            if (isRamping)
+                for (int g = 0; g < numGates; ++g)
+                    for (int k = 0; k < v_hidden; ++k)
+                        conditioning[g][k] += conditioningStep[g][k];
+        }
+    }
+
+    inline void recurrentStep (const GateBlock (&inputProjection)[num_streams], float (&y)[num_streams]) noexcept
+    {
+        GateBlock gates[num_streams];
+
+        // One register of gates at a time for every stream: U[j][g][k] is loaded
+        // once per column and multiplied with the broadcast h[j] of each stream
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                v_type sum[num_streams];
+
+                for (int s = 0; s < num_streams; ++s)
+                    sum[s] = inputProjection[s][g][k];
+
+                for (int j = 0; j < hidden_size; ++j)
+                {
+                    const auto u = U[j][g][k];
+
+                    for (int s = 0; s < num_streams; ++s)
+                        sum[s] = xsimd::fma (u, hBroadcast[j][s], sum[s]);
+                }
+
+                for (int s = 0; s < num_streams; ++s)
+                    gates[s][g][k] = sum[s];
+            }
+        }
+
+        for (int s = 0; s < num_streams; ++s)
+        {
+            v_type ySum (0.0f);
+
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                const auto it = Activation::sigmoid (gates[s][0][k]);
+                const auto ft = Activation::sigmoid (gates[s][1][k]);
+                const auto ct = Activation::tanh (gates[s][2][k]);
+                const auto ot = Activation::sigmoid (gates[s][3][k]);
+
+                c[s][k] = xsimd::fma (ft, c[s][k], it * ct);
+                h[s][k] = ot * Activation::tanh (c[s][k]);
+
+                ySum = xsimd::fma (denseW[k], h[s][k], ySum);
+            }
+
+            alignas (v_type) float hScalar[v_hidden * v_size];
+
+            for (int k = 0; k < v_hidden; ++k)
+                h[s][k].store_aligned (hScalar + k * v_size);
+
+            for (int j = 0; j < hidden_size; ++j)
+                hBroadcast[j][s] = v_type (hScalar[j]);
+
+            alignas (v_type) float ySums[v_size];
+            ySum.store_aligned (ySums);
+            y[s] = std::accumulate (ySums, ySums + v_size, denseB);
+        }
+    }
+
+    // Padded lanes have zero weights and biases, so their state stays exactly zero
+    v_type W[input_size][numGates][v_hidden];
+    v_type U[hidden_size][numGates][v_hidden];
+    v_type b[numGates][v_hidden];
+    v_type denseW[v_hidden];
+    float denseB = 0.0f;
+    float skipGain = 1.0f;
+
+    v_type h[num_streams][v_hidden];
+    v_type c[num_streams][v_hidden];
+
+    // h[j] of every stream in all lanes, the right hand side of the next step
+    v_type hBroadcast[hidden_size][num_streams];
+
+    GateBlock conditioning;
+    GateBlock conditioningStep;
+    GateBlock projection[maxChunkSize][num_streams];
+    float inputChunk[maxChunkSize][num_streams];
+};
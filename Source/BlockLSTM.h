@@ -0,0 +1,410 @@
+#pragma once
+
+#include <RTNeural/RTNeural.h>
+
+#include "Activations.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+/**
+    Single layer LSTM followed by a Dense(hidden_size -> 1) output layer and
+    an optional skip connection, processed one block at a time.
+
+    The input-to-hidden product W*x does not depend on the recurrence, so for
+    every chunk of up to maxChunkSize samples it is computed up-front. The
+    columns of W belonging to the conditioning parameters (gain/master) are
+    only evaluated once per block, so the per-sample part of that product is
+    a single column times the guitar sample. The per-sample loop then only
+    has to do the recurrent U*h product, the gate activations, the cell update
+    and the output layer.
+
+    Each gate is padded to a whole number of SIMD registers with zero weights,
+    and the four gates of a row of U are stored next to each other, so U*h is
+    a single pass over U without tail handling, and the activations, the cell
+    update and the Dense output all happen in one loop over the registers.
+    Packing the gates without padding (10 instead of 12 AVX registers per row
+    at hidden size 20) needs the gates realigned before the activations, and
+    without lane shuffles that is a round trip through memory for every gate.
+    NeuralPiModelBenchmark -r compares the time per sample with RTNeural's
+    LSTMLayerT on the same weights.
+
+    The weight setters take the same layout as RTNeural's LSTMLayerT and
+    DenseT, so weights can be loaded exactly like an RTNeural::ModelT.
+    Activation is one of the implementations in Activations.h.
+*/
+template <int input_size, int hidden_size, typename Activation = Activations::Exact>
+class BlockLSTM
+{
+    using v_type = xsimd::simd_type<float>;
+    static constexpr int v_size = (int) v_type::size;
+    static constexpr int v_hidden = (hidden_size + v_size - 1) / v_size;
+
+    // Gate order is the same as PyTorch and RTNeural: input, forget, cell, output
+    static constexpr int numGates = 4;
+
+public:
+    static constexpr int maxChunkSize = 32;
+
+    BlockLSTM()
+    {
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                b[g][k] = v_type (0.0f);
+
+                for (int i = 0; i < input_size; ++i)
+                    W[i][g][k] = v_type (0.0f);
+
+                for (int j = 0; j < hidden_size; ++j)
+                    U[j][g][k] = v_type (0.0f);
+            }
+        }
+
+        for (int k = 0; k < v_hidden; ++k)
+            denseW[k] = v_type (0.0f);
+
+        reset();
+    }
+
+    void reset()
+    {
+        for (int k = 0; k < v_hidden; ++k)
+        {
+            h[k] = v_type (0.0f);
+            c[k] = v_type (0.0f);
+        }
+
+        std::fill (std::begin (hScalar), std::end (hScalar), 0.0f);
+    }
+
+    /** The hidden and cell state, which is all that changes while processing */
+    static constexpr size_t getStateSize() noexcept
+    {
+        return 2 * sizeof(v_type[v_hidden]) + sizeof(float[v_hidden * v_size]);
+    }
+
+    void saveState (void* dest) const noexcept
+    {
+        auto* bytes = static_cast<char*> (dest);
+        std::memcpy (bytes, h, sizeof (h));
+        std::memcpy (bytes + sizeof (h), c, sizeof (c));
+        std::memcpy (bytes + sizeof (h) + sizeof (c), hScalar, sizeof (hScalar));
+    }
+
+    void restoreState (const void* source) noexcept
+    {
+        const auto* bytes = static_cast<const char*> (source);
+        std::memcpy (h, bytes, sizeof (h));
+        std::memcpy (c, bytes + sizeof (h), sizeof (c));
+        std::memcpy (hScalar, bytes + sizeof (h) + sizeof (c), sizeof (hScalar));
+    }
+
+    /** wVals has the shape [input_size][4 * hidden_size] */
+    void setWVals (const std::vector<std::vector<float>>& wVals)
+    {
+        for (int i = 0; i < input_size; ++i)
+            for (int g = 0; g < numGates; ++g)
+                loadPadded (W[i][g], wVals[(size_t) i].data() + g * hidden_size);
+    }
+
+    /** Same as above, with the rows stored contiguously */
+    void setWVals (const float* wVals)
+    {
+        for (int i = 0; i < input_size; ++i)
+            for (int g = 0; g < numGates; ++g)
+                loadPadded (W[i][g], wVals + (i * numGates + g) * hidden_size);
+    }
+
+    /** uVals has the shape [hidden_size][4 * hidden_size] */
+    void setUVals (const std::vector<std::vector<float>>& uVals)
+    {
+        for (int j = 0; j < hidden_size; ++j)
+            for (int g = 0; g < numGates; ++g)
+                loadPadded (U[j][g], uVals[(size_t) j].data() + g * hidden_size);
+    }
+
+    /** Same as above, with the rows stored contiguously */
+    void setUVals (const float* uVals)
+    {
+        for (int j = 0; j < hidden_size; ++j)
+            for (int g = 0; g < numGates; ++g)
+                loadPadded (U[j][g], uVals + (j * numGates + g) * hidden_size);
+
+        rank = 0;
+    }
+
+    /** Uses the factorisation U = P * Q for the recurrent product, where pVals
+        has the shape [hidden_size][newRank] and qVals [newRank][4 * hidden_size].
+
+        Each step then computes t = P^T * h and U * h = Q^T * t, which takes
+        hidden_size * newRank + 4 * hidden_size * newRank multiply-adds instead of
+        4 * hidden_size^2, so it pays off below a rank of 4/5 of hidden_size.
+        The first newRank rows of U hold Q, so setUVals() switches back to the
+        full matrix.
+    */
+    void setLowRankUVals (const float* pVals, const float* qVals, int newRank)
+    {
+        rank = std::clamp (newRank, 0, hidden_size);
+
+        for (int j = 0; j < hidden_size; ++j)
+        {
+            alignas (v_type) float padded[v_hidden * v_size] {};
+            std::copy (pVals + j * newRank, pVals + j * newRank + rank, padded);
+
+            for (int k = 0; k < v_hidden; ++k)
+                P[j][k] = xsimd::load_aligned (padded + k * v_size);
+        }
+
+        for (int m = 0; m < hidden_size; ++m)
+        {
+            for (int g = 0; g < numGates; ++g)
+            {
+                if (m < rank)
+                    loadPadded (U[m][g], qVals + (m * numGates + g) * hidden_size);
+                else
+                    std::fill (std::begin (U[m][g]), std::end (U[m][g]), v_type (0.0f));
+            }
+        }
+    }
+
+    /** bVals has the shape [4 * hidden_size], with the input and hidden biases already summed */
+    void setBVals (const std::vector<float>& bVals)
+    {
+        setBVals (bVals.data());
+    }
+
+    void setBVals (const float* bVals)
+    {
+        for (int g = 0; g < numGates; ++g)
+            loadPadded (b[g], bVals + g * hidden_size);
+    }
+
+    /** weights has the shape [1][hidden_size] */
+    void setDenseWeights (const std::vector<std::vector<float>>& weights)
+    {
+        setDenseWeights (weights[0].data());
+    }
+
+    void setDenseWeights (const float* weights)
+    {
+        loadPadded (denseW, weights);
+    }
+
+    void setDenseBias (const float* bias)
+    {
+        denseB = bias[0];
+    }
+
+    /** Adds the input sample to the output (enabled by default) */
+    void setSkipConnection (bool shouldAddInput)
+    {
+        skipGain = shouldAddInput ? 1.0f : 0.0f;
+    }
+
+    /** Processes a block of samples.
+
+        params points to the (input_size - 1) conditioning parameters, which are
+        held constant for the block, and may be nullptr for input_size == 1.
+        input and output may point to the same buffer.
+    */
+    void process (const float* input, const float* params, float* output, int numSamples) noexcept
+    {
+        process (input, params, params, output, numSamples);
+    }
+
+    /** Processes a block of samples while the conditioning parameters move
+        linearly from paramsStart to paramsEnd, reaching paramsEnd on the last
+        sample of the block.
+
+        The contribution of the parameters to the gates is computed once per
+        block (plus a constant per-sample step while ramping), so the per-sample
+        input cost is a single column of W times the guitar sample.
+    */
+    void process (const float* input, const float* paramsStart, const float* paramsEnd, float* output, int numSamples) noexcept
+    {
+        if (numSamples <= 0)
+            return;
+
+        const auto isRamping = prepareConditioning (paramsStart, paramsEnd, numSamples);
+
+        for (int start = 0; start < numSamples; start += maxChunkSize)
+        {
+            const auto chunkSize = std::min (maxChunkSize, numSamples - start);
+
+            if (isRamping)
+                projectInputs<true> (input + start, chunkSize);
+            else
+                projectInputs<false> (input + start, chunkSize);
+
+            for (int n = 0; n < chunkSize; ++n)
+            {
+                const auto x = input[start + n];
+                output[start + n] = recurrentStep (projection[n]) + skipGain * x;
+            }
+        }
+    }
+
+private:
+    using GateBlock = v_type[numGates][v_hidden];
+
+    static void loadPadded (v_type (&dest)[v_hidden], const float* src)
+    {
+        alignas (v_type) float padded[v_hidden * v_size] {};
+        std::copy (src, src + hidden_size, padded);
+
+        for (int k = 0; k < v_hidden; ++k)
+            dest[k] = xsimd::load_aligned (padded + k * v_size);
+    }
+
+    // conditioning = b + W_p * p for the first sample of the block, and
+    // conditioningStep = W_p * (paramsEnd - paramsStart) / numSamples.
+    // Returns true if the parameters are moving during this block.
+    bool prepareConditioning (const float* paramsStart, const float* paramsEnd, int numSamples) noexcept
+    {
+        bool isRamping = false;
+
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < v_hidden; ++k)
+            {
+                conditioning[g][k] = b[g][k];
+                conditioningStep[g][k] = v_type (0.0f);
+            }
+        }
+
+        for (int i = 1; i < input_size; ++i)
+        {
+            const auto delta = (paramsEnd[i - 1] - paramsStart[i - 1]) / (float) numSamples;
+            const v_type p (paramsEnd[i - 1] - delta * (float) (numSamples - 1));
+            const v_type dp (delta);
+
+            for (int g = 0; g < numGates; ++g)
+            {
+                for (int k = 0; k < v_hidden; ++k)
+                {
+                    conditioning[g][k] = xsimd::fma (W[i][g][k], p, conditioning[g][k]);
+                    conditioningStep[g][k] = xsimd::fma (W[i][g][k], dp, conditioningStep[g][k]);
+                }
+            }
+
+            isRamping = isRamping || delta != 0.0f;
+        }
+
+        return isRamping;
+    }
+
+    // projection[n] = b + W_p * p[n] + W_x * x[n] for every sample of the chunk
+    template <bool isRamping>
+    void projectInputs (const float* input, int chunkSize) noexcept
+    {
+        for (int n = 0; n < chunkSize; ++n)
+        {
+            const v_type x (input[n]);
+
+            for (int g = 0; g < numGates; ++g)
+                for (int k = 0; k < v_hidden; ++k)
+                    projection[n][g][k] = xsimd::fma (W[0][g][k], x, conditioning[g][k]);
+
+            if (isRamping)
+                for (int g = 0; g < numGates; ++g)
+                    for (int k = 0; k < v_hidden; ++k)
+                        conditioning[g][k] += conditioningStep[g][k];
+        }
+    }
+
+    inline float recurrentStep (const GateBlock& inputProjection) noexcept
+    {
+        GateBlock gates;
+
+        for (int g = 0; g < numGates; ++g)
+            for (int k = 0; k < v_hidden; ++k)
+                gates[g][k] = inputProjection[g][k];
+
+        if (rank > 0)
+            lowRankProduct (gates);
+        else
+            for (int j = 0; j < hidden_size; ++j)
+            {
+                const v_type hj (hScalar[j]);
+
+                for (int g = 0; g < numGates; ++g)
+                    for (int k = 0; k < v_hidden; ++k)
+                        gates[g][k] = xsimd::fma (U[j][g][k], hj, gates[g][k]);
+            }
+
+        v_type y (0.0f);
+
+        for (int k = 0; k < v_hidden; ++k)
+        {
+            const auto it = Activation::sigmoid (gates[0][k]);
+            const auto ft = Activation::sigmoid (gates[1][k]);
+            const auto ct = Activation::tanh (gates[2][k]);
+            const auto ot = Activation::sigmoid (gates[3][k]);
+
+            c[k] = xsimd::fma (ft, c[k], it * ct);
+            h[k] = ot * Activation::tanh (c[k]);
+            h[k].store_aligned (hScalar + k * v_size);
+
+            y = xsimd::fma (denseW[k], h[k], y);
+        }
+
+        alignas (v_type) float ySum[v_size];
+        y.store_aligned (ySum);
+
+        return std::accumulate (ySum, ySum + v_size, denseB);
+    }
+
+    // gates += Q^T * (P^T * h), with Q in the first rank rows of U
+    inline void lowRankProduct (GateBlock& gates) noexcept
+    {
+        const auto rankRegisters = (rank + v_size - 1) / v_size;
+        v_type t[v_hidden];
+
+        for (int k = 0; k < rankRegisters; ++k)
+            t[k] = v_type (0.0f);
+
+        for (int j = 0; j < hidden_size; ++j)
+        {
+            const v_type hj (hScalar[j]);
+
+            for (int k = 0; k < rankRegisters; ++k)
+                t[k] = xsimd::fma (P[j][k], hj, t[k]);
+        }
+
+        alignas (v_type) float tScalar[v_hidden * v_size];
+
+        for (int k = 0; k < rankRegisters; ++k)
+            t[k].store_aligned (tScalar + k * v_size);
+
+        for (int m = 0; m < rank; ++m)
+        {
+            const v_type tm (tScalar[m]);
+
+            for (int g = 0; g < numGates; ++g)
+                for (int k = 0; k < v_hidden; ++k)
+                    gates[g][k] = xsimd::fma (U[m][g][k], tm, gates[g][k]);
+        }
+    }
+
+    // Padded lanes have zero weights and biases, so their state stays exactly zero
+    v_type W[input_size][numGates][v_hidden];
+    v_type U[hidden_size][numGates][v_hidden];
+    v_type P[hidden_size][v_hidden];    // only used when rank > 0
+    int rank = 0;
+    v_type b[numGates][v_hidden];
+    v_type denseW[v_hidden];
+    float denseB = 0.0f;
+    float skipGain = 1.0f;
+
+    v_type h[v_hidden];
+    v_type c[v_hidden];
+    alignas (v_type) float hScalar[v_hidden * v_size];
+
+    GateBlock conditioning;
+    GateBlock conditioningStep;
+    GateBlock projection[maxChunkSize];
+};
@@ -24,100 +24,21 @@
 */
 
 #include "CabSim.h"
-
-template <typename Element>
-class Queue
-{
-public:
-    explicit Queue (int size)
-        : fifo (size), storage (static_cast<size_t> (size)) {}
-
-    bool push (Element& element) noexcept
-    {
-        if (fifo.getFreeSpace() == 0)
-            return false;
-
-        const auto writer = fifo.write (1);
-
-        if (writer.blockSize1 != 0)
-            storage[static_cast<size_t> (writer.startIndex1)] = std::move (element);
-        else if (writer.blockSize2 != 0)
-            storage[static_cast<size_t> (writer.startIndex2)] = std::move (element);
-
-        return true;
-    }
-
-    template <typename Fn>
-    void pop (Fn&& fn) { popN (1, std::forward<Fn> (fn)); }
-
-    template <typename Fn>
-    void popAll (Fn&& fn) { popN (fifo.getNumReady(), std::forward<Fn> (fn)); }
-
-    bool hasPendingMessages() const noexcept { return fifo.getNumReady() > 0; }
-
-private:
-    template <typename Fn>
-    void popN (int n, Fn&& fn)
-    {
-        fifo.read (n).forEach ([&] (int index)
-                               {
-                                   fn (storage[static_cast<size_t> (index)]);
-                               });
-    }
-
-    AbstractFifo fifo;
-    std::vector<Element> storage;
-};
-
-class BackgroundMessageQueue : private Thread
-{
-public:
-    explicit BackgroundMessageQueue (int entries)
-        : Thread ("CabSim background loader"), queue (entries)
-    {}
-
-    using IncomingCommand = juce::dsp::FixedSizeFunction<400, void()>;
-
-    // Push functions here, and they'll be called later on a background thread.
-    // This function is wait-free.
-    // This function is only safe to call from a single thread at a time.
-    bool push (IncomingCommand& command) { return queue.push (command); }
-
-    void popAll()
-    {
-        const ScopedLock lock (popMutex);
-        queue.popAll ([] (IncomingCommand& command) { command(); command = nullptr; });
-    }
-
-    using Thread::startThread;
-    using Thread::stopThread;
-
-private:
-    void run() override
-    {
-        while (! threadShouldExit())
-        {
-            const auto tryPop = [&]
-            {
-                const ScopedLock lock (popMutex);
-
-                if (! queue.hasPendingMessages())
-                    return false;
-
-                queue.pop ([] (IncomingCommand& command) { command(); command = nullptr;});
-                return true;
-            };
-
-            if (! tryPop())
-                sleep (10);
-        }
-    }
-
-    CriticalSection popMutex;
-    Queue<IncomingCommand> queue;
-
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BackgroundMessageQueue)
-};
+#include "BackgroundMessageQueue.h"
+#include "CabSimFFT.h"
+#include "DirectFIR.h"
+#include "IRPartitionCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <thread>
+
+#if JUCE_LINUX
+ #include <pthread.h>
+ #include <sched.h>
+#endif
 
 struct CabSimMessageQueue::Impl  : public BackgroundMessageQueue
 {
@@ -148,14 +69,77 @@ struct CabSimEngine
     CabSimEngine (const float* samples,
                        size_t numSamples,
                        size_t maxBlockSize)
+        : CabSimEngine (numSamples, maxBlockSize)
+    {
+        size_t currentPtr = 0;
+
+        for (auto& buf : buffersImpulseSegments)
+        {
+            buf.clear();
+
+            auto* impulseResponse = buf.getWritePointer (0);
+
+            if (&buf == &buffersImpulseSegments.front())
+                impulseResponse[0] = 1.0f;
+
+            FloatVectorOperations::copy (impulseResponse,
+                                         samples + currentPtr,
+                                         static_cast<int> (juce::jmin (fftSize - blockSize, numSamples - currentPtr)));
+
+            fft->forward (impulseResponse, impulseResponse, fftWork.data());
+
+            currentPtr += (fftSize - blockSize);
+        }
+    }
+
+    struct Prepared {};
+
+    // Takes the partitions of an engine with the same IR and block size, as
+    // numSegments consecutive runs of getSegmentSize() samples (see getSegment).
+    CabSimEngine (Prepared,
+                  const float* segments,
+                  size_t numSamples,
+                  size_t maxBlockSize)
+        : CabSimEngine (numSamples, maxBlockSize)
+    {
+        for (auto& buf : buffersImpulseSegments)
+        {
+            buf.clear();
+            FloatVectorOperations::copy (buf.getWritePointer (0), segments, static_cast<int> (getSegmentSize()));
+            segments += getSegmentSize();
+        }
+    }
+
+    // The frequency domain data of a partition of the IR, in CabSimFFT's packed layout
+    const float* getSegment (size_t index) const noexcept  { return buffersImpulseSegments[index].getReadPointer (0); }
+    size_t getSegmentSize() const noexcept                 { return fftSize + 1; }
+    size_t getNumSegments() const noexcept                 { return numSegments; }
+    size_t getFFTSize() const noexcept                     { return fftSize; }
+
+    static size_t getFFTSize (size_t maxBlockSize)
+    {
+        const auto blockSize = (size_t) nextPowerOfTwo ((int) maxBlockSize);
+        return blockSize > 128 ? 2 * blockSize : 4 * blockSize;
+    }
+
+    // The number of partitions an IR of numSamples is split into
+    static size_t getNumSegments (size_t numSamples, size_t maxBlockSize)
+    {
+        const auto blockSize = (size_t) nextPowerOfTwo ((int) maxBlockSize);
+        return numSamples / (getFFTSize (maxBlockSize) - blockSize) + 1u;
+    }
+
+    // Allocates the buffers, leaving the partitions to the public constructors
+    CabSimEngine (size_t numSamples, size_t maxBlockSize)
         : blockSize ((size_t) nextPowerOfTwo ((int) maxBlockSize)),
-          fftSize (blockSize > 128 ? 2 * blockSize : 4 * blockSize),
-          fftObject (std::make_unique<juce::dsp::FFT> (juce::roundToInt (std::log2 (fftSize)))),
-          numSegments (numSamples / (fftSize - blockSize) + 1u),
+          fftSize (getFFTSize (maxBlockSize)),
+          fft (CabSimFFT::get (fftSize)),
+          fftWork (fft->getWorkSize()),
+          numSegments (getNumSegments (numSamples, maxBlockSize)),
           numInputSegments ((blockSize > 128 ? numSegments : 3 * numSegments)),
           bufferInput      (1, static_cast<int> (fftSize)),
-          bufferOutput     (1, static_cast<int> (fftSize * 2)),
-          bufferTempOutput (1, static_cast<int> (fftSize * 2)),
+          bufferOutput     (1, static_cast<int> (fftSize + 1)),
+          bufferTempOutput (1, static_cast<int> (fftSize + 1)),
           bufferOverlap    (1, static_cast<int> (fftSize))
     {
         bufferOutput.clear();
@@ -165,40 +149,18 @@ struct CabSimEngine
         {
             if (numSegmentsToUpdate == 0
                 || numSegmentsToUpdate != (size_t) segments.size()
-                || (size_t) segments[0].getNumSamples() != fftSize * 2)
+                || (size_t) segments[0].getNumSamples() != fftSize + 1)
             {
                 segments.clear();
 
                 for (size_t i = 0; i < numSegmentsToUpdate; ++i)
-                    segments.push_back ({ 1, static_cast<int> (fftSize * 2) });
+                    segments.push_back ({ 1, static_cast<int> (fftSize + 1) });
             }
         };
 
         updateSegmentsIfNecessary (numInputSegments, buffersInputSegments);
         updateSegmentsIfNecessary (numSegments,      buffersImpulseSegments);
 
-        auto FFTTempObject = std::make_unique<juce::dsp::FFT> (juce::roundToInt (std::log2 (fftSize)));
-        size_t currentPtr = 0;
-
-        for (auto& buf : buffersImpulseSegments)
-        {
-            buf.clear();
-
-            auto* impulseResponse = buf.getWritePointer (0);
-
-            if (&buf == &buffersImpulseSegments.front())
-                impulseResponse[0] = 1.0f;
-
-            FloatVectorOperations::copy (impulseResponse,
-                                         samples + currentPtr,
-                                         static_cast<int> (juce::jmin (fftSize - blockSize, numSamples - currentPtr)));
-
-            FFTTempObject->performRealOnlyForwardTransform (impulseResponse);
-            prepareForCabSim (impulseResponse);
-
-            currentPtr += (fftSize - blockSize);
-        }
-
         reset();
     }
 
@@ -236,10 +198,7 @@ struct CabSimEngine
             FloatVectorOperations::copy (inputData + inputDataPos, input + numSamplesProcessed, static_cast<int> (numSamplesToProcess));
 
             auto* inputSegmentData = buffersInputSegments[currentSegment].getWritePointer (0);
-            FloatVectorOperations::copy (inputSegmentData, inputData, static_cast<int> (fftSize));
-
-            fftObject->performRealOnlyForwardTransform (inputSegmentData);
-            prepareForCabSim (inputSegmentData);
+            fft->forward (inputData, inputSegmentData, fftWork.data());
 
             // Complex multiplication
             if (inputDataWasEmpty)
@@ -267,8 +226,7 @@ struct CabSimEngine
                                                 buffersImpulseSegments.front().getWritePointer (0),
                                                 outputData);
 
-            updateSymmetricFrequencyDomainData (outputData);
-            fftObject->performRealOnlyInverseTransform (outputData);
+            fft->inverse (outputData, outputData, fftWork.data());
 
             // Add overlap
             FloatVectorOperations::add (&output[numSamplesProcessed], &outputData[inputDataPos], &overlapData[inputDataPos], (int) numSamplesToProcess);
@@ -301,12 +259,8 @@ struct CabSimEngine
         // Overlap-add, zero latency CabSim algorithm with uniform partitioning
         size_t numSamplesProcessed = 0;
 
-        auto indexStep = numInputSegments / numSegments;
-
-        auto* inputData      = bufferInput.getWritePointer (0);
-        auto* outputTempData = bufferTempOutput.getWritePointer (0);
-        auto* outputData     = bufferOutput.getWritePointer (0);
-        auto* overlapData    = bufferOverlap.getWritePointer (0);
+        auto* inputData  = bufferInput.getWritePointer (0);
+        auto* outputData = bufferOutput.getWritePointer (0);
 
         while (numSamplesProcessed < numSamples)
         {
@@ -321,74 +275,81 @@ struct CabSimEngine
 
             // processing itself when needed (with latency)
             if (inputDataPos == blockSize)
-            {
-                // Copy input data in input segment
-                auto* inputSegmentData = buffersInputSegments[currentSegment].getWritePointer (0);
-                FloatVectorOperations::copy (inputSegmentData, inputData, static_cast<int> (fftSize));
+                processInputBlock();
+        }
+    }
 
-                fftObject->performRealOnlyForwardTransform (inputSegmentData);
-                prepareForCabSim (inputSegmentData);
+    // Convolves a whole block of input, and returns the output which
+    // processSamplesWithAddedLatency would only return during the next block.
+    // BackgroundTail uses this to run a block ahead of the audio thread.
+    void processBlockAhead (const float* input, float* output)
+    {
+        jassert (inputDataPos == 0);
 
-                // Complex multiplication
-                FloatVectorOperations::fill (outputTempData, 0, static_cast<int> (fftSize + 1));
+        FloatVectorOperations::copy (bufferInput.getWritePointer (0), input, static_cast<int> (blockSize));
+        processInputBlock();
+        FloatVectorOperations::copy (output, bufferOutput.getReadPointer (0), static_cast<int> (blockSize));
+    }
 
-                auto index = currentSegment;
+    // Convolves the full input buffer, leaving the output for the next block
+    // at the start of bufferOutput.
+    void processInputBlock()
+    {
+        auto indexStep = numInputSegments / numSegments;
 
-                for (size_t i = 1; i < numSegments; ++i)
-                {
-                    index += indexStep;
+        auto* inputData      = bufferInput.getWritePointer (0);
+        auto* outputTempData = bufferTempOutput.getWritePointer (0);
+        auto* outputData     = bufferOutput.getWritePointer (0);
+        auto* overlapData    = bufferOverlap.getWritePointer (0);
 
-                    if (index >= numInputSegments)
-                        index -= numInputSegments;
+        // Transform the input data into the input segment
+        auto* inputSegmentData = buffersInputSegments[currentSegment].getWritePointer (0);
+        fft->forward (inputData, inputSegmentData, fftWork.data());
 
-                    CabSimProcessingAndAccumulate (buffersInputSegments[index].getWritePointer (0),
-                                                        buffersImpulseSegments[i].getWritePointer (0),
-                                                        outputTempData);
-                }
+        // Complex multiplication
+        FloatVectorOperations::fill (outputTempData, 0, static_cast<int> (fftSize + 1));
 
-                FloatVectorOperations::copy (outputData, outputTempData, static_cast<int> (fftSize + 1));
+        auto index = currentSegment;
 
-                CabSimProcessingAndAccumulate (inputSegmentData,
-                                                    buffersImpulseSegments.front().getWritePointer (0),
-                                                    outputData);
+        for (size_t i = 1; i < numSegments; ++i)
+        {
+            index += indexStep;
 
-                updateSymmetricFrequencyDomainData (outputData);
-                fftObject->performRealOnlyInverseTransform (outputData);
+            if (index >= numInputSegments)
+                index -= numInputSegments;
 
-                // Add overlap
-                FloatVectorOperations::add (outputData, overlapData, static_cast<int> (blockSize));
+            CabSimProcessingAndAccumulate (buffersInputSegments[index].getWritePointer (0),
+                                                buffersImpulseSegments[i].getWritePointer (0),
+                                                outputTempData);
+        }
 
-                // Input buffer is empty again now
-                FloatVectorOperations::fill (inputData, 0.0f, static_cast<int> (fftSize));
+        FloatVectorOperations::copy (outputData, outputTempData, static_cast<int> (fftSize + 1));
 
-                // Extra step for segSize > blockSize
-                FloatVectorOperations::add (&(outputData[blockSize]), &(overlapData[blockSize]), static_cast<int> (fftSize - 2 * blockSize));
+        CabSimProcessingAndAccumulate (inputSegmentData,
+                                            buffersImpulseSegments.front().getWritePointer (0),
+                                            outputData);
 
-                // Save the overlap
-                FloatVectorOperations::copy (overlapData, &(outputData[blockSize]), static_cast<int> (fftSize - blockSize));
+        fft->inverse (outputData, outputData, fftWork.data());
 
-                currentSegment = (currentSegment > 0) ? (currentSegment - 1) : (numInputSegments - 1);
+        // Add overlap
+        FloatVectorOperations::add (outputData, overlapData, static_cast<int> (blockSize));
 
-                inputDataPos = 0;
-            }
-        }
-    }
+        // Input buffer is empty again now
+        FloatVectorOperations::fill (inputData, 0.0f, static_cast<int> (fftSize));
 
-    // After each FFT, this function is called to allow CabSim to be performed with only 4 SIMD functions calls.
-    void prepareForCabSim (float *samples) noexcept
-    {
-        auto FFTSizeDiv2 = fftSize / 2;
+        // Extra step for segSize > blockSize
+        FloatVectorOperations::add (&(outputData[blockSize]), &(overlapData[blockSize]), static_cast<int> (fftSize - 2 * blockSize));
 
-        for (size_t i = 0; i < FFTSizeDiv2; i++)
-            samples[i] = samples[i << 1];
+        // Save the overlap
+        FloatVectorOperations::copy (overlapData, &(outputData[blockSize]), static_cast<int> (fftSize - blockSize));
 
-        samples[FFTSizeDiv2] = 0;
+        currentSegment = (currentSegment > 0) ? (currentSegment - 1) : (numInputSegments - 1);
 
-        for (size_t i = 1; i < FFTSizeDiv2; i++)
-            samples[i + FFTSizeDiv2] = -samples[((fftSize - i) << 1) + 1];
+        inputDataPos = 0;
     }
 
-    // Does the CabSim operation itself only on half of the frequency domain samples.
+    // Does the CabSim operation itself only on half of the frequency domain samples,
+    // which CabSimFFT packs so that it takes only 4 SIMD function calls.
     void CabSimProcessingAndAccumulate (const float *input, const float *impulse, float *output)
     {
         auto FFTSizeDiv2 = fftSize / 2;
@@ -402,40 +363,277 @@ struct CabSimEngine
         output[fftSize] += input[fftSize] * impulse[fftSize];
     }
 
-    // Undoes the re-organization of samples from the function prepareForCabSim.
-    // Then takes the conjugate of the frequency domain first half of samples to fill the
-    // second half, so that the inverse transform will return real samples in the time domain.
-    void updateSymmetricFrequencyDomainData (float* samples) noexcept
+    //==============================================================================
+    const size_t blockSize;
+    const size_t fftSize;
+    const std::shared_ptr<const CabSimFFT> fft;
+    std::vector<float> fftWork;
+    const size_t numSegments;
+    const size_t numInputSegments;
+    size_t currentSegment = 0, inputDataPos = 0;
+
+    AudioBuffer<float> bufferInput, bufferOutput, bufferTempOutput, bufferOverlap;
+    std::vector<AudioBuffer<float>> buffersInputSegments, buffersImpulseSegments;
+};
+
+//==============================================================================
+class BackgroundTail;
+
+// Convolves the tails of non-uniform engines with CabSim::NonUniform::backgroundTail.
+// Like PipelineStage it runs at real-time priority if the system allows it, and
+// polls for tails every 50 us, then backs off to 1 ms (well inside the shortest
+// deadline) once none have arrived for a while.
+class CabSimTailWorker final : private Thread
+{
+public:
+    CabSimTailWorker()
+        : Thread ("CabSim tail")
     {
-        auto FFTSizeDiv2 = fftSize / 2;
+        startThread();
+    }
+
+    ~CabSimTailWorker() override
+    {
+        stopThread (-1);
+    }
+
+    // Call on the audio thread. If the queue is full the tail stays pending,
+    // and the audio thread convolves it when it collects it.
+    bool push (std::shared_ptr<BackgroundTail> tail) noexcept { return queue.push (tail); }
+
+private:
+    void run() override;
+
+    static constexpr int pollIntervalUs = 50;
+    static constexpr uint32 idleTimeoutMs = 100;
+
+    // Each engine has at most one block in flight, and there are two engines
+    // during a crossfade
+    Queue<std::shared_ptr<BackgroundTail>> queue { 8 };
+};
+
+// The tail of a non-uniform engine, convolved one block ahead of the audio
+// thread so that another thread can do it.
+//
+// The tail of the IR starts 2 * blockSize samples in, and the engines have
+// blockSize samples of latency. So the tail output of block k + 2 only depends
+// on the input up to block k, and once block k is complete there's a whole
+// block period to convolve it before its output is due. The audio thread posts
+// each complete block, and at the end of the next block collects the output:
+// if the worker hasn't claimed the block by then, which is the deadline, the
+// audio thread convolves it itself, and if the worker is still busy with it,
+// it waits. Either way there is one block in flight at most.
+//
+// Shared with the worker, so that an engine can be destroyed while its tail
+// is still queued.
+class BackgroundTail
+{
+public:
+    // One engine per channel, with a block size of blockSizeIn
+    BackgroundTail (std::vector<std::unique_ptr<CabSimEngine>> enginesIn, int blockSizeIn)
+        : blockSize (blockSizeIn),
+          engines (std::move (enginesIn)),
+          input      ((int) engines.size(), blockSizeIn),
+          output     ((int) engines.size(), blockSizeIn),
+          jobInput   ((int) engines.size(), blockSizeIn),
+          jobOutput  ((int) engines.size(), blockSizeIn)
+    {
+        // The engines process blocks of a power of two, which must fill these buffers exactly
+        jassert (isPowerOfTwo (blockSizeIn));
+        reset();
+    }
+
+    template <typename Fn>
+    void forEachEngine (Fn&& fn) const
+    {
+        for (const auto& e : engines)
+            fn (*e);
+    }
+
+    // Call on the audio thread
+    void reset() noexcept
+    {
+        cancel();
+
+        for (const auto& e : engines)
+            e->reset();
+
+        input.clear();
+        output.clear();
+        position = 0;
+    }
+
+    // Call on the audio thread. Replaces output with the tail of the first
+    // numChannels channels of input.
+    void processSamples (const juce::dsp::AudioBlock<const float>& in,
+                         const juce::dsp::AudioBlock<float>& out,
+                         size_t numChannels,
+                         CabSimTailWorker& worker,
+                         const std::shared_ptr<BackgroundTail>& self) noexcept
+    {
+        const auto numSamples = static_cast<int> (juce::jmin (in.getNumSamples(), out.getNumSamples()));
+        int numSamplesProcessed = 0;
+
+        while (numSamplesProcessed < numSamples)
+        {
+            const auto numSamplesToProcess = juce::jmin (numSamples - numSamplesProcessed, blockSize - position);
+
+            for (size_t channel = 0; channel < numChannels; ++channel)
+            {
+                const auto ch = static_cast<int> (channel);
+
+                input.copyFrom (ch, position, in.getChannelPointer (channel) + numSamplesProcessed, numSamplesToProcess);
+                FloatVectorOperations::copy (out.getChannelPointer (channel) + numSamplesProcessed,
+                                             output.getReadPointer (ch, position),
+                                             numSamplesToProcess);
+            }
+
+            numSamplesProcessed += numSamplesToProcess;
+            position += numSamplesToProcess;
+
+            if (position == blockSize)
+            {
+                collect();
+                post (static_cast<int> (numChannels), worker, self);
+                position = 0;
+            }
+        }
+    }
+
+    // Call on the worker thread. Does nothing if the audio thread got there first.
+    void convolveIfPending() noexcept
+    {
+        auto expected = State::pending;
+
+        if (! state.compare_exchange_strong (expected, State::running))
+            return;
+
+        convolve();
+        state = State::done;
+    }
+
+private:
+    enum class State { idle, pending, running, done };
+
+    void post (int numChannels, CabSimTailWorker& worker, const std::shared_ptr<BackgroundTail>& self) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            jobInput.copyFrom (channel, 0, input, channel, 0, blockSize);
+
+        jobNumChannels = numChannels;
+        state = State::pending;
+        worker.push (self);
+    }
 
-        for (size_t i = 1; i < FFTSizeDiv2; i++)
+    // Waits for the block in flight, and makes its output the next block's
+    void collect() noexcept
+    {
+        for (;;)
         {
-            samples[(fftSize - i) << 1] = samples[i];
-            samples[((fftSize - i) << 1) + 1] = -samples[FFTSizeDiv2 + i];
+            auto expected = State::pending;
+
+            // The worker missed the deadline, or couldn't be started
+            if (state.compare_exchange_strong (expected, State::running))
+            {
+                convolve();
+                break;
+            }
+
+            if (expected == State::done)
+                break;
+
+            if (expected == State::idle)
+            {
+                output.clear();
+                return;
+            }
         }
 
-        samples[1] = 0.f;
+        for (int channel = 0; channel < output.getNumChannels(); ++channel)
+        {
+            if (channel < jobNumChannels)
+                output.copyFrom (channel, 0, jobOutput, channel, 0, blockSize);
+            else
+                output.clear (channel, 0, blockSize);
+        }
 
-        for (size_t i = 1; i < FFTSizeDiv2; i++)
+        state = State::idle;
+    }
+
+    // Drops the block in flight, waiting for it if it's being convolved
+    void cancel() noexcept
+    {
+        for (;;)
         {
-            samples[i << 1] = samples[(fftSize - i) << 1];
-            samples[(i << 1) + 1] = -samples[((fftSize - i) << 1) + 1];
+            auto expected = State::pending;
+
+            if (state.compare_exchange_strong (expected, State::idle) || expected == State::idle)
+                return;
+
+            if (expected == State::done)
+            {
+                state = State::idle;
+                return;
+            }
         }
     }
 
-    //==============================================================================
-    const size_t blockSize;
-    const size_t fftSize;
-    const std::unique_ptr<juce::dsp::FFT> fftObject;
-    const size_t numSegments;
-    const size_t numInputSegments;
-    size_t currentSegment = 0, inputDataPos = 0;
+    void convolve() noexcept
+    {
+        for (int channel = 0; channel < jobNumChannels; ++channel)
+            engines[static_cast<size_t> (channel)]->processBlockAhead (jobInput.getReadPointer (channel),
+                                                                        jobOutput.getWritePointer (channel));
+    }
 
-    AudioBuffer<float> bufferInput, bufferOutput, bufferTempOutput, bufferOverlap;
-    std::vector<AudioBuffer<float>> buffersInputSegments, buffersImpulseSegments;
+    const int blockSize;
+    std::vector<std::unique_ptr<CabSimEngine>> engines;
+
+    // Owned by the audio thread
+    AudioBuffer<float> input, output;
+    int position = 0;
+
+    // Owned by whoever moved state from pending to running, until it's done
+    AudioBuffer<float> jobInput, jobOutput;
+    int jobNumChannels = 0;
+    std::atomic<State> state { State::idle };
 };
 
+void CabSimTailWorker::run()
+{
+   #if JUCE_LINUX
+    // Below the audio thread and the pipeline stages, which have shorter deadlines.
+    // Without the rights to do this it stays a normal thread.
+    sched_param param {};
+    param.sched_priority = sched_get_priority_max (SCHED_FIFO) - 2;
+    pthread_setschedparam (pthread_self(), SCHED_FIFO, &param);
+   #endif
+
+    auto lastTailTime = Time::getMillisecondCounter();
+
+    while (! threadShouldExit())
+    {
+        if (queue.hasPendingMessages())
+        {
+            std::shared_ptr<BackgroundTail> tail;
+            queue.pop ([&tail] (std::shared_ptr<BackgroundTail>& t) { tail = std::move (t); });
+
+            tail->convolveIfPending();
+            lastTailTime = Time::getMillisecondCounter();
+        }
+        else if (Time::getMillisecondCounter() - lastTailTime > idleTimeoutMs)
+        {
+            sleep (1);
+        }
+        else
+        {
+            std::this_thread::sleep_for (std::chrono::microseconds (pollIntervalUs));
+        }
+    }
+
+    // Let go of the tails still queued
+    queue.popAll ([] (std::shared_ptr<BackgroundTail>& t) { t = nullptr; });
+}
+
 //==============================================================================
 class MultichannelEngine
 {
@@ -444,66 +642,188 @@ public:
                         int maxBlockSize,
                         int maxBufferSize,
                         CabSim::NonUniform headSizeIn,
-                        bool isZeroDelayIn)
-        : tailBuffer (1, maxBlockSize),
-          latency (isZeroDelayIn ? 0 : maxBufferSize),
+                        bool isZeroDelayIn,
+                        CabSimTailWorker* tailWorkerIn)
+        : MultichannelEngine (buf.getNumSamples(), maxBlockSize, maxBufferSize, headSizeIn, isZeroDelayIn, tailWorkerIn,
+                              [&buf] (int channel, int offset, int length, int thisBlockSize)
+                              {
+                                  return std::make_unique<CabSimEngine> (buf.getReadPointer (juce::jmin (buf.getNumChannels() - 1, channel), offset),
+                                                                              length,
+                                                                              static_cast<size_t> (thisBlockSize));
+                              })
+    {}
+
+    struct Direct {};
+
+    // Convolves the whole IR with a DirectFIR per channel, with zero latency
+    MultichannelEngine (Direct, const AudioBuffer<float>& buf, int maxBlockSize)
+        : tailBuffer (2, maxBlockSize),
+          latency (0),
           irSize (buf.getNumSamples()),
           blockSize (maxBlockSize),
-          isZeroDelay (isZeroDelayIn)
+          isZeroDelay (true)
     {
         constexpr auto numChannels = 2;
 
-        const auto makeEngine = [&] (int channel, int offset, int length, uint32 thisBlockSize)
+        for (int i = 0; i < numChannels; ++i)
+            direct.emplace_back (std::make_unique<DirectFIR> (buf.getReadPointer (juce::jmin (buf.getNumChannels() - 1, i)),
+                                                              (size_t) buf.getNumSamples(),
+                                                              (size_t) maxBlockSize));
+    }
+
+    // makeEngine (channel, offset, length, blockSize) makes the engine for each part of
+    // the IR, in the order of forEachPart.
+    template <typename MakeEngine>
+    MultichannelEngine (int irSizeIn,
+                        int maxBlockSize,
+                        int maxBufferSize,
+                        CabSim::NonUniform headSizeIn,
+                        bool isZeroDelayIn,
+                        CabSimTailWorker* tailWorkerIn,
+                        MakeEngine&& makeEngine)
+        : tailBuffer (2, maxBlockSize),
+          latency (isZeroDelayIn ? 0 : maxBufferSize),
+          irSize (irSizeIn),
+          blockSize (maxBlockSize),
+          isZeroDelay (isZeroDelayIn)
+    {
+        const auto layout = getLayout (irSize, maxBlockSize, maxBufferSize, headSizeIn, isZeroDelay, tailWorkerIn != nullptr);
+
+        std::vector<std::unique_ptr<CabSimEngine>> tailEngines;
+
+        forEachPart (irSize, maxBufferSize, layout, [&] (int channel, int offset, int length, int thisBlockSize)
         {
-            return std::make_unique<CabSimEngine> (buf.getReadPointer (juce::jmin (buf.getNumChannels() - 1, channel), offset),
-                                                        length,
-                                                        static_cast<size_t> (thisBlockSize));
-        };
+            (offset == 0 ? head : tailEngines).emplace_back (makeEngine (channel, offset, length, thisBlockSize));
+        });
 
-        if (headSizeIn.headSizeInSamples == 0)
+        if (! tailEngines.empty())
         {
-            for (int i = 0; i < numChannels; ++i)
-                head.emplace_back (makeEngine (i, 0, buf.getNumSamples(), static_cast<uint32> (maxBufferSize)));
+            if (layout.backgroundTail)
+            {
+                backgroundTail = std::make_shared<BackgroundTail> (std::move (tailEngines), layout.tailBlockSize);
+                tailWorker = tailWorkerIn;
+            }
+            else
+            {
+                tail = std::move (tailEngines);
+            }
         }
-        else
-        {
-            const auto size = juce::jmin (buf.getNumSamples(), headSizeIn.headSizeInSamples);
+    }
 
-            for (int i = 0; i < numChannels; ++i)
-                head.emplace_back (makeEngine (i, 0, size, static_cast<uint32> (maxBufferSize)));
+    // Calls fn with each engine, in the order of forEachPart
+    template <typename Fn>
+    void forEachEngine (Fn&& fn) const
+    {
+        for (const auto& e : head)
+            fn (*e);
 
-            const auto tailBufferSize = static_cast<uint32> (headSizeIn.headSizeInSamples + (isZeroDelay ? 0 : maxBufferSize));
+        for (const auto& e : tail)
+            fn (*e);
 
-            if (size != buf.getNumSamples())
-                for (int i = 0; i < numChannels; ++i)
-                    tail.emplace_back (makeEngine (i, size, buf.getNumSamples() - size, tailBufferSize));
+        if (backgroundTail != nullptr)
+            backgroundTail->forEachEngine (fn);
+    }
+
+    // How an IR is split between the head and the tail
+    struct Layout
+    {
+        int headSize = 0;               // the whole IR if there's no tail
+        int tailBlockSize = 0;          // 0 if there's no tail
+        bool backgroundTail = false;
+    };
+
+    static Layout getLayout (int irSize,
+                             int maxBlockSize,
+                             int maxBufferSize,
+                             CabSim::NonUniform headSizeIn,
+                             bool isZeroDelay,
+                             bool hasTailWorker)
+    {
+        if (headSizeIn.headSizeInSamples == 0)
+            return { irSize, 0, false };
+
+        if (headSizeIn.backgroundTail && isZeroDelay && hasTailWorker)
+        {
+            // The tail's blocks are half the head, and at least the maximum block size. The engine
+            // rounds its block size up to a power of two, and BackgroundTail's buffers have to match.
+            const auto tailBlockSize = nextPowerOfTwo (juce::jmax (headSizeIn.headSizeInSamples / 2, maxBlockSize));
+            const auto size = juce::jmin (irSize, 2 * tailBlockSize);
+
+            return { size, size != irSize ? tailBlockSize : 0, true };
         }
+
+        const auto size = juce::jmin (irSize, headSizeIn.headSizeInSamples);
+        const auto tailBlockSize = headSizeIn.headSizeInSamples + (isZeroDelay ? 0 : maxBufferSize);
+
+        return { size, size != irSize ? tailBlockSize : 0, false };
+    }
+
+    // The number of partitions per channel an engine for an IR of irSize would have
+    static int getNumPartitions (int irSize, int maxBufferSize, const Layout& layout)
+    {
+        auto result = CabSimEngine::getNumSegments ((size_t) layout.headSize, (size_t) maxBufferSize);
+
+        if (layout.tailBlockSize != 0)
+            result += CabSimEngine::getNumSegments ((size_t) (irSize - layout.headSize), (size_t) layout.tailBlockSize);
+
+        return (int) result;
+    }
+
+    // Calls fn (channel, offset, length, blockSize) for each part of the IR that gets an
+    // engine: each channel of the head, then each channel of the tail
+    template <typename Fn>
+    static void forEachPart (int irSize, int maxBufferSize, const Layout& layout, Fn&& fn)
+    {
+        constexpr auto numChannels = 2;
+
+        for (int i = 0; i < numChannels; ++i)
+            fn (i, 0, layout.headSize, maxBufferSize);
+
+        if (layout.tailBlockSize != 0)
+            for (int i = 0; i < numChannels; ++i)
+                fn (i, layout.headSize, irSize - layout.headSize, layout.tailBlockSize);
     }
 
     void reset()
     {
+        for (const auto& e : direct)
+            e->reset();
+
         for (const auto& e : head)
             e->reset();
 
         for (const auto& e : tail)
             e->reset();
+
+        if (backgroundTail != nullptr)
+            backgroundTail->reset();
     }
 
     void processSamples (const juce::dsp::AudioBlock<const float>& input, juce::dsp::AudioBlock<float>& output)
     {
+        if (! direct.empty())
+        {
+            processDirect (input, output);
+            return;
+        }
+
         const auto numChannels = juce::jmin (head.size(), input.getNumChannels(), output.getNumChannels());
         const auto numSamples  = juce::jmin (input.getNumSamples(), output.getNumSamples());
 
         const juce::dsp::AudioBlock<float> fullTailBlock (tailBuffer);
         const auto tailBlock = fullTailBlock.getSubBlock (0, (size_t) numSamples);
 
-        const auto isUniform = tail.empty();
+        const auto isUniform = tail.empty() && backgroundTail == nullptr;
+
+        // Before the head, which may overwrite the input
+        if (backgroundTail != nullptr)
+            backgroundTail->processSamples (input, tailBlock, numChannels, *tailWorker, backgroundTail);
 
         for (size_t channel = 0; channel < numChannels; ++channel)
         {
-            if (! isUniform)
+            if (! tail.empty())
                 tail[channel]->processSamplesWithAddedLatency (input.getChannelPointer (channel),
-                                                               tailBlock.getChannelPointer (0),
+                                                               tailBlock.getChannelPointer (channel),
                                                                numSamples);
 
             if (isZeroDelay)
@@ -516,7 +836,7 @@ public:
                                                                numSamples);
 
             if (! isUniform)
-                output.getSingleChannelBlock (channel) += tailBlock;
+                output.getSingleChannelBlock (channel) += tailBlock.getSingleChannelBlock (channel);
         }
 
         const auto numOutputChannels = output.getNumChannels();
@@ -529,10 +849,34 @@ public:
     int getLatency() const noexcept    { return latency; }
     int getBlockSize() const noexcept  { return blockSize; }
 
+    void setIRReport (const CabSim::IRReport& report) noexcept  { irReport = report; }
+    CabSim::IRReport getIRReport() const noexcept               { return irReport; }
+
 private:
+    void processDirect (const juce::dsp::AudioBlock<const float>& input, juce::dsp::AudioBlock<float>& output)
+    {
+        const auto numChannels = juce::jmin (direct.size(), input.getNumChannels(), output.getNumChannels());
+        const auto numSamples  = juce::jmin (input.getNumSamples(), output.getNumSamples());
+
+        for (size_t channel = 0; channel < numChannels; ++channel)
+            direct[channel]->processSamples (input.getChannelPointer (channel),
+                                             output.getChannelPointer (channel),
+                                             numSamples);
+
+        const auto numOutputChannels = output.getNumChannels();
+
+        for (auto i = numChannels; i < numOutputChannels; ++i)
+            output.getSingleChannelBlock (i).copyFrom (output.getSingleChannelBlock (0));
+    }
+
+    std::vector<std::unique_ptr<DirectFIR>> direct;
     std::vector<std::unique_ptr<CabSimEngine>> head, tail;
+    std::shared_ptr<BackgroundTail> backgroundTail;
+    CabSimTailWorker* tailWorker = nullptr;
     AudioBuffer<float> tailBuffer;
 
+    CabSim::IRReport irReport;
+
     const int latency;
     const int irSize;
     const int blockSize;
@@ -549,67 +893,192 @@ static AudioBuffer<float> fixNumChannels (const AudioBuffer<float>& buf, CabSim:
     for (auto channel = 0; channel != numChannels; ++channel)
         result.copyFrom (channel, 0, buf.getReadPointer (channel), numSamples);
 
-    if (result.getNumSamples() == 0 || result.getNumChannels() == 0)
-    {
-        result.setSize (1, 1);
-        result.setSample (0, 0, 1.0f);
+    if (result.getNumSamples() == 0 || result.getNumChannels() == 0)
+    {
+        result.setSize (1, 1);
+        result.setSample (0, 0, 1.0f);
+    }
+
+    return result;
+}
+
+static AudioBuffer<float> trimImpulseResponse (const AudioBuffer<float>& buf)
+{
+    const auto thresholdTrim = juce::Decibels::decibelsToGain (-80.0f);
+
+    const auto numChannels = buf.getNumChannels();
+    const auto numSamples = buf.getNumSamples();
+
+    std::ptrdiff_t offsetBegin = numSamples;
+    std::ptrdiff_t offsetEnd   = numSamples;
+
+    for (auto channel = 0; channel < numChannels; ++channel)
+    {
+        const auto indexAboveThreshold = [&] (auto begin, auto end)
+        {
+            return std::distance (begin, std::find_if (begin, end, [&] (float sample)
+            {
+                return std::abs (sample) >= thresholdTrim;
+            }));
+        };
+
+        const auto channelBegin = buf.getReadPointer (channel);
+        const auto channelEnd = channelBegin + numSamples;
+        const auto itStart = indexAboveThreshold (channelBegin, channelEnd);
+        const auto itEnd = indexAboveThreshold (std::make_reverse_iterator (channelEnd),
+                                                std::make_reverse_iterator (channelBegin));
+
+        offsetBegin = juce::jmin (offsetBegin, itStart);
+        offsetEnd   = juce::jmin (offsetEnd,   itEnd);
+    }
+
+    if (offsetBegin == numSamples)
+    {
+        auto result = AudioBuffer<float> (numChannels, 1);
+        result.clear();
+        return result;
+    }
+
+    const auto newLength = juce::jmax (1, numSamples - static_cast<int> (offsetBegin + offsetEnd));
+
+    AudioBuffer<float> result (numChannels, newLength);
+
+    for (auto channel = 0; channel < numChannels; ++channel)
+    {
+        result.copyFrom (channel,
+                         0,
+                         buf.getReadPointer (channel, static_cast<int> (offsetBegin)),
+                         result.getNumSamples());
+    }
+
+    return result;
+}
+
+// Replaces each channel by the minimum-phase IR with the same magnitude response.
+// The cepstrum of the IR is folded onto its causal half and transformed back. The
+// FFT is four times the IR's length, which keeps the cepstrum's aliasing low.
+static AudioBuffer<float> makeMinimumPhase (const AudioBuffer<float>& buf)
+{
+    const auto numSamples = buf.getNumSamples();
+    const juce::dsp::FFT fft (juce::roundToInt (std::log2 (nextPowerOfTwo (numSamples))) + 2);
+    const auto fftSize = fft.getSize();
+
+    std::vector<juce::dsp::Complex<float>> timeData ((size_t) fftSize), freqData ((size_t) fftSize);
+    AudioBuffer<float> result (buf.getNumChannels(), numSamples);
+
+    for (auto channel = 0; channel < buf.getNumChannels(); ++channel)
+    {
+        const auto* samples = buf.getReadPointer (channel);
+
+        std::fill (timeData.begin(), timeData.end(), 0.0f);
+        std::copy (samples, samples + numSamples, timeData.begin());
+        fft.perform (timeData.data(), freqData.data(), false);
+
+        // Nulls in the response are floored at -200 dB so their log stays finite
+        const auto peak = std::accumulate (freqData.begin(), freqData.end(), 0.0f, [] (auto max, auto bin)
+        {
+            return jmax (max, std::abs (bin));
+        });
+
+        const auto floor = jmax (peak * 1.0e-10f, std::numeric_limits<float>::min());
+
+        for (auto& bin : freqData)
+            bin = std::log (jmax (std::abs (bin), floor));
+
+        // Real cepstrum, with the anticausal half folded onto the causal one
+        fft.perform (freqData.data(), timeData.data(), true);
+
+        const auto half = (size_t) fftSize / 2;
+
+        for (size_t i = 0; i < (size_t) fftSize; ++i)
+        {
+            const auto weight = (i == 0 || i == half) ? 1.0f : (i < half ? 2.0f : 0.0f);
+            timeData[i] = timeData[i].real() * weight;
+        }
+
+        fft.perform (timeData.data(), freqData.data(), false);
+
+        for (auto& bin : freqData)
+            bin = std::exp (bin);
+
+        fft.perform (freqData.data(), timeData.data(), true);
+
+        auto* output = result.getWritePointer (channel);
+
+        for (auto i = 0; i < numSamples; ++i)
+            output[i] = timeData[(size_t) i].real();
     }
 
     return result;
 }
 
-static AudioBuffer<float> trimImpulseResponse (const AudioBuffer<float>& buf)
+// Truncates the IR once all its channels together hold energyFraction of their energy,
+// and to maxLength samples if that isn't 0. The end is faded out over fadeLength samples.
+static AudioBuffer<float> truncateImpulseResponse (const AudioBuffer<float>& buf,
+                                                   float energyFraction,
+                                                   int maxLength,
+                                                   int fadeLength)
 {
-    const auto thresholdTrim = juce::Decibels::decibelsToGain (-80.0f);
-
     const auto numChannels = buf.getNumChannels();
-    const auto numSamples = buf.getNumSamples();
+    const auto numSamples  = buf.getNumSamples();
 
-    std::ptrdiff_t offsetBegin = numSamples;
-    std::ptrdiff_t offsetEnd   = numSamples;
+    auto length = numSamples;
 
-    for (auto channel = 0; channel < numChannels; ++channel)
+    if (energyFraction < 1.0f)
     {
-        const auto indexAboveThreshold = [&] (auto begin, auto end)
+        std::vector<double> energy ((size_t) numSamples, 0.0);
+
+        for (auto channel = 0; channel < numChannels; ++channel)
         {
-            return std::distance (begin, std::find_if (begin, end, [&] (float sample)
-            {
-                return std::abs (sample) >= thresholdTrim;
-            }));
-        };
+            const auto* samples = buf.getReadPointer (channel);
 
-        const auto channelBegin = buf.getReadPointer (channel);
-        const auto channelEnd = channelBegin + numSamples;
-        const auto itStart = indexAboveThreshold (channelBegin, channelEnd);
-        const auto itEnd = indexAboveThreshold (std::make_reverse_iterator (channelEnd),
-                                                std::make_reverse_iterator (channelBegin));
+            for (auto i = 0; i < numSamples; ++i)
+                energy[(size_t) i] += (double) samples[i] * (double) samples[i];
+        }
 
-        offsetBegin = juce::jmin (offsetBegin, itStart);
-        offsetEnd   = juce::jmin (offsetEnd,   itEnd);
-    }
+        const auto target = std::accumulate (energy.begin(), energy.end(), 0.0) * (double) energyFraction;
+        auto sum = 0.0;
 
-    if (offsetBegin == numSamples)
-    {
-        auto result = AudioBuffer<float> (numChannels, 1);
-        result.clear();
-        return result;
+        for (length = 0; length < numSamples && sum < target; ++length)
+            sum += energy[(size_t) length];
     }
 
-    const auto newLength = juce::jmax (1, numSamples - static_cast<int> (offsetBegin + offsetEnd));
+    if (maxLength > 0)
+        length = juce::jmin (length, maxLength);
 
-    AudioBuffer<float> result (numChannels, newLength);
+    length = juce::jmax (1, length);
+
+    if (length == numSamples)
+        return buf;
+
+    AudioBuffer<float> result (numChannels, length);
+    const auto fade = juce::jmin (fadeLength, length / 2);
 
     for (auto channel = 0; channel < numChannels; ++channel)
     {
-        result.copyFrom (channel,
-                         0,
-                         buf.getReadPointer (channel, static_cast<int> (offsetBegin)),
-                         result.getNumSamples());
+        result.copyFrom (channel, 0, buf, channel, 0, length);
+        result.applyGainRamp (channel, length - fade, fade, 1.0f, 0.0f);
     }
 
     return result;
 }
 
+// Applies CabSim::IRProcessing to an IR at the given sample rate
+static AudioBuffer<float> processImpulseResponse (const AudioBuffer<float>& buf,
+                                                  double sampleRate,
+                                                  const CabSim::IRProcessing& processing)
+{
+    auto result = processing.minimumPhase ? makeMinimumPhase (buf) : buf;
+
+    if (processing.energyFraction >= 1.0f && processing.maxLengthSeconds <= 0.0)
+        return result;
+
+    return truncateImpulseResponse (result,
+                                    processing.energyFraction,
+                                    juce::roundToInt (processing.maxLengthSeconds * sampleRate),
+                                    juce::roundToInt (0.005 * sampleRate));
+}
+
 static float calculateNormalisationFactor (float sumSquaredMagnitude)
 {
     if (sumSquaredMagnitude < 1e-8f)
@@ -640,6 +1109,14 @@ static void normaliseImpulseResponse (AudioBuffer<float>& buf)
     });
 }
 
+static int getResampledSize (int numSamples, double srcSampleRate, double destSampleRate)
+{
+    if (juce::approximatelyEqual (srcSampleRate, destSampleRate))
+        return numSamples;
+
+    return juce::roundToInt (juce::jmax (1.0, numSamples / (srcSampleRate / destSampleRate)));
+}
+
 static AudioBuffer<float> resampleImpulseResponse (const AudioBuffer<float>& buf,
                                                    const double srcSampleRate,
                                                    const double destSampleRate)
@@ -653,7 +1130,7 @@ static AudioBuffer<float> resampleImpulseResponse (const AudioBuffer<float>& buf
     MemoryAudioSource memorySource (original, false);
     ResamplingAudioSource resamplingSource (&memorySource, false, buf.getNumChannels());
 
-    const auto finalSize = juce::roundToInt (juce::jmax (1.0, buf.getNumSamples() / factorReading));
+    const auto finalSize = getResampledSize (buf.getNumSamples(), srcSampleRate, destSampleRate);
     resamplingSource.setResamplingRatio (factorReading);
     resamplingSource.prepareToPlay (finalSize, srcSampleRate);
 
@@ -663,28 +1140,6 @@ static AudioBuffer<float> resampleImpulseResponse (const AudioBuffer<float>& buf
     return result;
 }
 
-//==============================================================================
-template <typename Element>
-class TryLockedPtr
-{
-public:
-    void set (std::unique_ptr<Element> p)
-    {
-        const SpinLock::ScopedLockType lock (mutex);
-        ptr = std::move (p);
-    }
-
-    std::unique_ptr<MultichannelEngine> get()
-    {
-        const SpinLock::ScopedTryLockType lock (mutex);
-        return lock.isLocked() ? std::move (ptr) : nullptr;
-    }
-
-private:
-    std::unique_ptr<Element> ptr;
-    SpinLock mutex;
-};
-
 struct BufferWithSampleRate
 {
     BufferWithSampleRate() = default;
@@ -720,27 +1175,152 @@ static BufferWithSampleRate loadStreamToBuffer (std::unique_ptr<InputStream> str
     return result;
 }
 
+// The crossovers measured so far, by block size, kept for the rest of the process
+struct DirectCrossovers
+{
+    std::map<int, int> crossovers;
+    std::mutex mutex;           // guards the map only, never held while timing
+
+    static DirectCrossovers& getInstance()
+    {
+        static DirectCrossovers instance;
+        return instance;
+    }
+};
+
+// The crossover for this block size, if it has been measured
+static std::optional<int> findDirectCrossover (int maxBlockSize)
+{
+    auto& measured = DirectCrossovers::getInstance();
+
+    const std::lock_guard<std::mutex> lock (measured.mutex);
+    const auto existing = measured.crossovers.find (maxBlockSize);
+
+    if (existing == measured.crossovers.end())
+        return {};
+
+    return existing->second;
+}
+
+// The longest IR that a DirectFIR convolves faster than a zero latency
+// CabSimEngine, at this block size, or 0 if it never does. It's timed the
+// first time a block size is used, which takes a while, so it runs on the
+// background thread rather than in prepare().
+static int measureDirectCrossover (int maxBlockSize)
+{
+    if (const auto existing = findDirectCrossover (maxBlockSize))
+        return *existing;
+
+    // Longer IRs than this are never worth trying: the FIR's cost grows with
+    // the length, the engine's barely does
+    constexpr int maxDirectTaps = 1024;
+    constexpr int numBlocks = 16;
+    constexpr int numRuns = 3;
+
+    const auto blockSize = (size_t) juce::jmax (1, maxBlockSize);
+    std::vector<float> ir ((size_t) maxDirectTaps), input (blockSize), output (blockSize);
+
+    juce::Random random (1);
+
+    for (auto& sample : ir)
+        sample = random.nextFloat() * 2.0f - 1.0f;
+
+    for (auto& sample : input)
+        sample = random.nextFloat() * 2.0f - 1.0f;
+
+    // The best of a few runs, to keep the odd preemption out of it
+    const auto time = [&] (auto& engine)
+    {
+        auto best = std::chrono::steady_clock::duration::max();
+
+        for (int run = 0; run < numRuns; ++run)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            for (int block = 0; block < numBlocks; ++block)
+                engine.processSamples (input.data(), output.data(), blockSize);
+
+            best = juce::jmin (best, std::chrono::steady_clock::now() - start);
+        }
+
+        return best;
+    };
+
+    auto crossover = 0;
+
+    for (auto numTaps = 16; numTaps <= maxDirectTaps; numTaps *= 2)
+    {
+        DirectFIR direct (ir.data(), (size_t) numTaps, blockSize);
+        CabSimEngine partitioned (ir.data(), (size_t) numTaps, blockSize);
+
+        if (time (direct) >= time (partitioned))
+            break;
+
+        crossover = numTaps;
+    }
+
+    auto& measured = DirectCrossovers::getInstance();
+    const std::lock_guard<std::mutex> lock (measured.mutex);
+    measured.crossovers[maxBlockSize] = crossover;
+    return crossover;
+}
+
 // This class caches the data required to build a new CabSim engine
 // (in particular, impulse response data and a ProcessSpec).
 // Calls to `setProcessSpec` and `setImpulseResponse` construct a
 // new engine, which can be retrieved by calling `getEngine`.
+//
+// Engines are looked up in the IRPartitionCache first. Audio files are only
+// decoded, and the IR only processed, resampled and transformed, when the
+// engine isn't cached.
+//
+// Zero latency engines for IRs no longer than the crossover measured for the
+// block size convolve with a DirectFIR instead. Those are quick to build, so
+// they aren't cached. Until the crossover is measured it's 0, so the engines
+// are the partitioned ones that were used before there was a choice.
 class CabSimEngineFactory
 {
 public:
     CabSimEngineFactory (CabSim::Latency requiredLatency,
-                              CabSim::NonUniform requiredHeadSize)
+                              CabSim::NonUniform requiredHeadSize,
+                              CabSimTailWorker* tailWorkerToUse)
         : latency  { (requiredLatency.latencyInSamples   <= 0) ? 0 : juce::jmax (64, nextPowerOfTwo (requiredLatency.latencyInSamples)) },
-          headSize { (requiredHeadSize.headSizeInSamples <= 0) ? 0 : juce::jmax (64, nextPowerOfTwo (requiredHeadSize.headSizeInSamples)) },
-          shouldBeZeroLatency (requiredLatency.latencyInSamples == 0)
+          headSize { (requiredHeadSize.headSizeInSamples <= 0) ? 0 : juce::jmax (64, nextPowerOfTwo (requiredHeadSize.headSizeInSamples)),
+                     requiredHeadSize.backgroundTail },
+          shouldBeZeroLatency (requiredLatency.latencyInSamples == 0),
+          tailWorker (tailWorkerToUse)
     {}
 
     // It is safe to call this method simultaneously with other public
     // member functions.
-    void setProcessSpec (const juce::dsp::ProcessSpec& spec)
+    // Returns false if the crossover for this block size still has to be
+    // measured, see setDirectCrossover.
+    bool setProcessSpec (const juce::dsp::ProcessSpec& spec)
     {
         const std::lock_guard<std::mutex> lock (mutex);
         processSpec = spec;
 
+        // A fixed latency must stay the same whatever the IR, so only zero latency
+        // engines can switch to the FIR
+        const auto measured = shouldBeZeroLatency ? findDirectCrossover ((int) spec.maximumBlockSize)
+                                                  : std::optional<int> { 0 };
+        directCrossover = measured.value_or (0);
+
+        engine.set (makeEngine());
+        return measured.has_value();
+    }
+
+    // Rebuilds the engine once the crossover for maxBlockSize has been
+    // measured, unless the block size has changed since. It is safe to call
+    // this method simultaneously with other public member functions.
+    void setDirectCrossover (int maxBlockSize, int crossover)
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+
+        if (! shouldBeZeroLatency || (int) processSpec.maximumBlockSize != maxBlockSize || crossover == directCrossover)
+            return;
+
+        directCrossover = crossover;
         engine.set (makeEngine());
     }
 
@@ -752,14 +1332,58 @@ public:
                              CabSim::Normalise normalise)
     {
         const std::lock_guard<std::mutex> lock (mutex);
+
+        source = {};
+        source.stereo = stereo;
+        source.trim = trim;
+        source.hash = IRPartitionCache::hash (&buf.sampleRate, sizeof (buf.sampleRate));
+
+        for (int channel = 0; channel < buf.buffer.getNumChannels(); ++channel)
+            source.hash = IRPartitionCache::hash (buf.buffer.getReadPointer (channel),
+                                                  sizeof (float) * (size_t) buf.buffer.getNumSamples(),
+                                                  source.hash);
+
+        wantsNormalise = normalise;
+        setLoadedImpulseResponse (std::move (buf));
+
+        engine.set (makeEngine());
+    }
+
+    // Takes the bytes of an audio file, which is decoded by makeEngine
+    // if needed. It is safe to call this method simultaneously with other
+    // public member functions.
+    void setImpulseResponse (MemoryBlock&& fileData,
+                             CabSim::Stereo stereo,
+                             CabSim::Trim trim,
+                             size_t size,
+                             CabSim::Normalise normalise)
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+
+        source = {};
+        source.stereo = stereo;
+        source.trim = trim;
+        source.maxLength = size;
+        source.hash = IRPartitionCache::hash (fileData.getData(), fileData.getSize());
+        source.fileData = std::move (fileData);
+
         wantsNormalise = normalise;
-        originalSampleRate = buf.sampleRate;
+        isDecoded = false;
+        processedWith.reset();
 
-        impulseResponse = [&]
-        {
-            auto corrected = fixNumChannels (buf.buffer, stereo);
-            return trim == CabSim::Trim::yes ? trimImpulseResponse (corrected) : corrected;
-        }();
+        engine.set (makeEngine());
+    }
+
+    // It is safe to call this method simultaneously with other public
+    // member functions.
+    void setIRProcessing (const CabSim::IRProcessing& processing)
+    {
+        const std::lock_guard<std::mutex> lock (mutex);
+
+        if (processing == irProcessing)
+            return;
+
+        irProcessing = processing;
 
         engine.set (makeEngine());
     }
@@ -772,8 +1396,73 @@ public:
     std::unique_ptr<MultichannelEngine> getEngine() { return engine.get(); }
 
 private:
+    void setLoadedImpulseResponse (BufferWithSampleRate&& buf)
+    {
+        originalSampleRate = buf.sampleRate;
+
+        auto corrected = fixNumChannels (buf.buffer, source.stereo);
+        loadedImpulseResponse = source.trim == CabSim::Trim::yes ? trimImpulseResponse (corrected) : corrected;
+
+        isDecoded = true;
+        processedWith.reset();
+    }
+
+    int getMaxBufferSize() const
+    {
+        const auto currentLatency = juce::jmax (processSpec.maximumBlockSize, (uint32) latency.latencyInSamples);
+        return shouldBeZeroLatency ? static_cast<int> (processSpec.maximumBlockSize)
+                                   : nextPowerOfTwo (static_cast<int> (currentLatency));
+    }
+
+    // Everything besides the IR's content and the ProcessSpec that goes into an engine
+    IRPartitionCache::Key getCacheKey (int maxBufferSize) const
+    {
+        auto settings = IRPartitionCache::hash (nullptr, 0);
+
+        const auto add = [&settings] (auto value)
+        {
+            settings = IRPartitionCache::hash (&value, sizeof (value), settings);
+        };
+
+        add ((int) source.stereo);
+        add ((int) source.trim);
+        add ((uint64) source.maxLength);
+        add ((int) wantsNormalise);
+        add ((int) irProcessing.minimumPhase);
+        add (irProcessing.energyFraction);
+        add (irProcessing.maxLengthSeconds);
+        add (maxBufferSize);
+        add (headSize.headSizeInSamples);
+        add ((int) (headSize.backgroundTail && tailWorker != nullptr));
+        add ((int) shouldBeZeroLatency);
+
+        return { source.hash, settings, processSpec.sampleRate, processSpec.maximumBlockSize };
+    }
+
     std::unique_ptr<MultichannelEngine> makeEngine()
     {
+        const auto maxBufferSize = getMaxBufferSize();
+        auto& cache = IRPartitionCache::getInstance();
+
+        // The built-in unit impulse has no hash, and isn't worth caching
+        const auto key = getCacheKey (maxBufferSize);
+        const auto useCache = source.hash != 0;
+
+        if (useCache)
+            if (auto entry = cache.find (key); entry != nullptr && entry->getIRSize() > directCrossover)
+                if (auto result = makeEngine (*entry, maxBufferSize))
+                    return result;
+
+        if (! isDecoded)
+            setLoadedImpulseResponse (loadStreamToBuffer (std::make_unique<MemoryInputStream> (source.fileData, false),
+                                                          source.maxLength));
+
+        if (processedWith != irProcessing)
+        {
+            impulseResponse = processImpulseResponse (loadedImpulseResponse, originalSampleRate, irProcessing);
+            processedWith = irProcessing;
+        }
+
         auto resampled = resampleImpulseResponse (impulseResponse, originalSampleRate, processSpec.sampleRate);
 
         if (wantsNormalise == CabSim::Normalise::yes)
@@ -781,15 +1470,130 @@ private:
         else
             resampled.applyGain ((float) (originalSampleRate / processSpec.sampleRate));
 
-        const auto currentLatency = juce::jmax (processSpec.maximumBlockSize, (uint32) latency.latencyInSamples);
-        const auto maxBufferSize = shouldBeZeroLatency ? static_cast<int> (processSpec.maximumBlockSize)
-                                                       : nextPowerOfTwo (static_cast<int> (currentLatency));
+        const auto isDirect = resampled.getNumSamples() <= directCrossover;
+
+        auto result = isDirect ? std::make_unique<MultichannelEngine> (MultichannelEngine::Direct{},
+                                                                       resampled,
+                                                                       (int) processSpec.maximumBlockSize)
+                               : std::make_unique<MultichannelEngine> (resampled,
+                                                                       processSpec.maximumBlockSize,
+                                                                       maxBufferSize,
+                                                                       headSize,
+                                                                       shouldBeZeroLatency,
+                                                                       tailWorker);
+
+        const auto countPartitions = [&] (int irSize)
+        {
+            const auto layout = MultichannelEngine::getLayout (irSize,
+                                                               (int) processSpec.maximumBlockSize,
+                                                               maxBufferSize,
+                                                               headSize,
+                                                               shouldBeZeroLatency,
+                                                               tailWorker != nullptr);
+
+            return MultichannelEngine::getNumPartitions (irSize, maxBufferSize, layout);
+        };
+
+        CabSim::IRReport report;
+        report.originalSize = loadedImpulseResponse.getNumSamples();
+        report.processedSize = impulseResponse.getNumSamples();
+        report.numPartitions = countPartitions (resampled.getNumSamples());
+        report.numPartitionsSaved = countPartitions (getResampledSize (report.originalSize, originalSampleRate, processSpec.sampleRate))
+                                  - report.numPartitions;
+
+        result->setIRReport (report);
+
+        if (useCache && ! isDirect)
+        {
+            std::vector<IRPartitionCache::Part> parts;
+            std::vector<float> segments;
+
+            result->forEachEngine ([&] (const CabSimEngine& e)
+            {
+                parts.push_back ({ (uint32_t) e.getFFTSize(), (uint32_t) e.getNumSegments(), (uint32_t) e.getSegmentSize(), nullptr });
+            });
+
+            size_t totalSize = 0;
+
+            for (const auto& part : parts)
+                totalSize += (size_t) part.numSegments * part.segmentSize;
+
+            // The segments of each engine are stored back to back
+            segments.reserve (totalSize);
+
+            result->forEachEngine ([&] (const CabSimEngine& e)
+            {
+                for (size_t i = 0; i < e.getNumSegments(); ++i)
+                    segments.insert (segments.end(), e.getSegment (i), e.getSegment (i) + e.getSegmentSize());
+            });
+
+            auto* segmentData = segments.data();
+
+            for (auto& part : parts)
+            {
+                part.segments = segmentData;
+                segmentData += (size_t) part.numSegments * part.segmentSize;
+            }
+
+            cache.store (key, resampled.getNumSamples(), report, parts);
+        }
+
+        return result;
+    }
+
+    // Builds the engine from the partitions in a cache entry, or returns
+    // nullptr if they don't fit the current settings
+    std::unique_ptr<MultichannelEngine> makeEngine (const IRPartitionCache::Entry& entry, int maxBufferSize)
+    {
+        const auto irSize = entry.getIRSize();
+
+        if (irSize <= 0)
+            return nullptr;
+
+        const auto layout = MultichannelEngine::getLayout (irSize,
+                                                           (int) processSpec.maximumBlockSize,
+                                                           maxBufferSize,
+                                                           headSize,
+                                                           shouldBeZeroLatency,
+                                                           tailWorker != nullptr);
+
+        size_t numParts = 0;
+        auto fits = true;
+
+        MultichannelEngine::forEachPart (irSize, maxBufferSize, layout, [&] (int, int, int length, int thisBlockSize)
+        {
+            const auto fftSize = CabSimEngine::getFFTSize ((size_t) thisBlockSize);
+
+            fits = fits
+                && numParts < entry.getNumParts()
+                && entry.getPart (numParts).fftSize == fftSize
+                && entry.getPart (numParts).segmentSize == fftSize + 1
+                && entry.getPart (numParts).numSegments == CabSimEngine::getNumSegments ((size_t) length, (size_t) thisBlockSize);
+
+            ++numParts;
+        });
 
-        return std::make_unique<MultichannelEngine> (resampled,
-                                                     processSpec.maximumBlockSize,
-                                                     maxBufferSize,
-                                                     headSize,
-                                                     shouldBeZeroLatency);
+        if (! fits || numParts != entry.getNumParts())
+            return nullptr;
+
+        size_t partIndex = 0;
+
+        auto result = std::make_unique<MultichannelEngine> (irSize,
+                                                            (int) processSpec.maximumBlockSize,
+                                                            maxBufferSize,
+                                                            headSize,
+                                                            shouldBeZeroLatency,
+                                                            tailWorker,
+                                                            [&] (int, int, int length, int thisBlockSize)
+                                                            {
+                                                                return std::make_unique<CabSimEngine> (CabSimEngine::Prepared{},
+                                                                                                       entry.getPart (partIndex++).segments,
+                                                                                                       (size_t) length,
+                                                                                                       (size_t) thisBlockSize);
+                                                            });
+
+        result->setIRReport (entry.getReport());
+        return result;
     }
 
     static AudioBuffer<float> makeImpulseBuffer()
@@ -799,13 +1603,30 @@ private:
         return result;
     }
 
+    // The IR as it was loaded, before it's decoded
+    struct Source
+    {
+        MemoryBlock fileData;           // the audio file, empty if the IR came as a buffer
+        size_t maxLength = 0;
+        CabSim::Stereo stereo = CabSim::Stereo::no;
+        CabSim::Trim trim = CabSim::Trim::no;
+        uint64 hash = 0;                // of the file or the samples, 0 for the unit impulse
+    };
+
     juce::dsp::ProcessSpec processSpec { 44100.0, 128, 2 };
-    AudioBuffer<float> impulseResponse = makeImpulseBuffer();
+    Source source;
+    bool isDecoded = true;
+    AudioBuffer<float> loadedImpulseResponse = makeImpulseBuffer();
+    AudioBuffer<float> impulseResponse;
+    std::optional<CabSim::IRProcessing> processedWith;   // of impulseResponse
+    CabSim::IRProcessing irProcessing;
     double originalSampleRate = processSpec.sampleRate;
     CabSim::Normalise wantsNormalise = CabSim::Normalise::no;
     const CabSim::Latency latency;
     const CabSim::NonUniform headSize;
     const bool shouldBeZeroLatency;
+    CabSimTailWorker* const tailWorker;
+    int directCrossover = 0;        // in samples, 0 if the FIR is never used
 
     TryLockedPtr<MultichannelEngine> engine;
 
@@ -820,8 +1641,7 @@ static void setImpulseResponse (CabSimEngineFactory& factory,
                                 size_t size,
                                 CabSim::Normalise normalise)
 {
-    factory.setImpulseResponse (loadStreamToBuffer (std::make_unique<MemoryInputStream> (sourceData, sourceDataSize, false), size),
-                                stereo, trim, normalise);
+    factory.setImpulseResponse (MemoryBlock (sourceData, sourceDataSize), stereo, trim, size, normalise);
 }
 
 static void setImpulseResponse (CabSimEngineFactory& factory,
@@ -831,8 +1651,11 @@ static void setImpulseResponse (CabSimEngineFactory& factory,
                                 size_t size,
                                 CabSim::Normalise normalise)
 {
-    factory.setImpulseResponse (loadStreamToBuffer (std::make_unique<FileInputStream> (fileImpulseResponse), size),
-                                stereo, trim, normalise);
+    // A file that can't be read decodes to nothing, like an invalid one
+    MemoryBlock fileData;
+    fileImpulseResponse.loadFileAsData (fileData);
+
+    factory.setImpulseResponse (std::move (fileData), stereo, trim, size, normalise);
 }
 
 // This class acts as a destination for CabSim engines which are loaded on
@@ -847,8 +1670,9 @@ class CabSimEngineQueue final : public std::enable_shared_from_this<CabSimEngine
 public:
     CabSimEngineQueue (BackgroundMessageQueue& queue,
                             CabSim::Latency latencyIn,
-                            CabSim::NonUniform headSizeIn)
-        : messageQueue (queue), factory (latencyIn, headSizeIn) {}
+                            CabSim::NonUniform headSizeIn,
+                            CabSimTailWorker* tailWorker)
+        : messageQueue (queue), factory (latencyIn, headSizeIn, tailWorker) {}
 
     void loadImpulseResponse (AudioBuffer<float>&& buffer,
                               double sr,
@@ -887,9 +1711,31 @@ public:
         });
     }
 
+    void setIRProcessing (const CabSim::IRProcessing& processing)
+    {
+        callLater ([processing] (CabSimEngineFactory& f) mutable
+        {
+            f.setIRProcessing (processing);
+        });
+    }
+
     void prepare (const juce::dsp::ProcessSpec& spec)
     {
-        factory.setProcessSpec (spec);
+        if (factory.setProcessSpec (spec))
+            return;
+
+        // Timed on the background thread, without the factory's lock, so
+        // prepare() and the IR loads don't wait for it. If the queue is full
+        // the FIR just isn't used until the next prepare().
+        BackgroundMessageQueue::IncomingCommand command = [weak = weakFromThis(), maxBlockSize = (int) spec.maximumBlockSize]
+        {
+            const auto crossover = measureDirectCrossover (maxBlockSize);
+
+            if (auto t = weak.lock())
+                t->factory.setDirectCrossover (maxBlockSize, crossover);
+        };
+
+        messageQueue.push (command);
     }
 
     // Call this regularly to try to resend any pending message.
@@ -928,83 +1774,6 @@ private:
     BackgroundMessageQueue::IncomingCommand pendingCommand;
 };
 
-class CrossoverMixer
-{
-public:
-    void reset()
-    {
-        smoother.setCurrentAndTargetValue (1.0f);
-    }
-
-    void prepare (const juce::dsp::ProcessSpec& spec)
-    {
-        smoother.reset (spec.sampleRate, 0.05);
-        smootherBuffer.setSize (1, static_cast<int> (spec.maximumBlockSize));
-        mixBuffer.setSize (static_cast<int> (spec.numChannels), static_cast<int> (spec.maximumBlockSize));
-        reset();
-    }
-
-    template <typename ProcessCurrent, typename ProcessPrevious, typename NotifyDone>
-    void processSamples (const juce::dsp::AudioBlock<const float>& input,
-                         juce::dsp::AudioBlock<float>& output,
-                         ProcessCurrent&& current,
-                         ProcessPrevious&& previous,
-                         NotifyDone&& notifyDone)
-    {
-        if (smoother.isSmoothing())
-        {
-            const auto numSamples = static_cast<int> (input.getNumSamples());
-
-            for (auto sample = 0; sample != numSamples; ++sample)
-                smootherBuffer.setSample (0, sample, smoother.getNextValue());
-
-            juce::dsp::AudioBlock<float> mixBlock (mixBuffer);
-            mixBlock.clear();
-            previous (input, mixBlock);
-
-            for (size_t channel = 0; channel != output.getNumChannels(); ++channel)
-            {
-                FloatVectorOperations::multiply (mixBlock.getChannelPointer (channel),
-                                                 smootherBuffer.getReadPointer (0),
-                                                 numSamples);
-            }
-
-            FloatVectorOperations::multiply (smootherBuffer.getWritePointer (0), -1.0f, numSamples);
-            FloatVectorOperations::add (smootherBuffer.getWritePointer (0), 1.0f, numSamples);
-
-            current (input, output);
-
-            for (size_t channel = 0; channel != output.getNumChannels(); ++channel)
-            {
-                FloatVectorOperations::multiply (output.getChannelPointer (channel),
-                                                 smootherBuffer.getReadPointer (0),
-                                                 numSamples);
-                FloatVectorOperations::add (output.getChannelPointer (channel),
-                                            mixBlock.getChannelPointer (channel),
-                                            numSamples);
-            }
-
-            if (! smoother.isSmoothing())
-                notifyDone();
-        }
-        else
-        {
-            current (input, output);
-        }
-    }
-
-    void beginTransition()
-    {
-        smoother.setCurrentAndTargetValue (1.0f);
-        smoother.setTargetValue (0.0f);
-    }
-
-private:
-    LinearSmoothedValue<float> smoother;
-    AudioBuffer<float> smootherBuffer;
-    AudioBuffer<float> mixBuffer;
-};
-
 using OptionalQueue = OptionalScopedPointer<CabSimMessageQueue>;
 
 class CabSim::Impl
@@ -1013,10 +1782,12 @@ public:
     Impl (Latency requiredLatency,
           NonUniform requiredHeadSize,
           OptionalQueue&& queue)
-        : messageQueue (std::move (queue)),
+        : tailWorker (requiredHeadSize.backgroundTail ? std::make_unique<CabSimTailWorker>() : nullptr),
+          messageQueue (std::move (queue)),
           engineQueue (std::make_shared<CabSimEngineQueue> (*messageQueue->pimpl,
                                                                  requiredLatency,
-                                                                 requiredHeadSize))
+                                                                 requiredHeadSize,
+                                                                 tailWorker.get()))
     {}
 
     void reset()
@@ -1069,6 +1840,13 @@ public:
 
     int getLatency() const { return currentEngine != nullptr ? currentEngine->getLatency() : 0; }
 
+    IRReport getIRReport() const { return currentEngine != nullptr ? currentEngine->getIRReport() : IRReport {}; }
+
+    void setIRProcessing (const IRProcessing& processing)
+    {
+        engineQueue->setIRProcessing (processing);
+    }
+
     void loadImpulseResponse (AudioBuffer<float>&& buffer,
                               double originalSampleRate,
                               Stereo stereo,
@@ -1119,6 +1897,8 @@ private:
             installNewEngine (std::move (newEngine));
     }
 
+    // Outlives the engines using it
+    std::unique_ptr<CabSimTailWorker> tailWorker;
     OptionalQueue messageQueue;
     std::shared_ptr<CabSimEngineQueue> engineQueue;
     std::unique_ptr<MultichannelEngine> previousEngine, currentEngine;
@@ -1310,6 +2090,13 @@ int CabSim::getCurrentIRSize() const { return pimpl->getCurrentIRSize(); }
 
 int CabSim::getLatency() const { return pimpl->getLatency(); }
 
+void CabSim::setIRProcessing (const IRProcessing& processing)
+{
+    pimpl->setIRProcessing (processing);
+}
+
+CabSim::IRReport CabSim::getIRReport() const { return pimpl->getIRReport(); }
+
 void CabSim::setWetLevel(float wetLevel)
 {
     mixer.setWetLevel(wetLevel);
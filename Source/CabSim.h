@@ -123,12 +123,20 @@ public:
         non-zero latency can reduce the CPU consumption of the CabSim
         algorithm.
 
+        With zero latency, IRs short enough to be convolved faster in the
+        time domain (the crossover is timed when the first ProcessSpec with a
+        given block size is set) use a SIMD FIR filter instead of the FFT.
+
         @param requiredLatency        the minimum latency
     */
     explicit CabSim (const Latency& requiredLatency);
 
-    /** Contains configuration information for a non-uniform CabSim. */
-    struct NonUniform { int headSizeInSamples; };
+    /** Contains configuration information for a non-uniform CabSim.
+
+        With backgroundTail, the tail of the IR is convolved on a worker thread
+        instead of the audio thread (zero latency only, see the constructor).
+    */
+    struct NonUniform { int headSizeInSamples; bool backgroundTail = false; };
 
     /** Initialises an object for performing CabSim in the frequency domain
         using a non-uniform partitioned algorithm.
@@ -137,6 +145,14 @@ public:
         efficiency of the processing for IR sizes of 4096 samples or greater
         (recommended for reverberation IRs).
 
+        If backgroundTail is set, only the head runs on the audio thread, so
+        the cost there doesn't grow with the length of the IR. The tail is
+        convolved in blocks of half the head size on a real-time worker
+        thread, each block a whole block period before it is needed. If the
+        worker hasn't started a block by then, the audio thread convolves it
+        itself. The head is at least twice the maximum block size, so that
+        there's always a block period to spare.
+
         @param requiredHeadSize       the head IR size for two stage non-uniform
                                       partitioned CabSim
      */
@@ -264,6 +280,53 @@ public:
 
     void setWetLevel(float wetLevel);
 
+    //==============================================================================
+    /** Contains configuration information for processing IRs as they are loaded. */
+    struct IRProcessing
+    {
+        /** Replaces each channel by the minimum-phase IR with the same magnitude
+            response, which drops any pre-delay and moves the energy to the start.
+        */
+        bool minimumPhase = false;
+
+        /** Truncates the IR once it holds this fraction of its energy, 1 keeps it all */
+        float energyFraction = 1.0f;
+
+        /** Truncates the IR to at most this length, 0 keeps it all */
+        double maxLengthSeconds = 0.0;
+
+        bool operator== (const IRProcessing& other) const noexcept
+        {
+            return minimumPhase == other.minimumPhase
+                && energyFraction == other.energyFraction
+                && maxLengthSeconds == other.maxLengthSeconds;
+        }
+
+        bool operator!= (const IRProcessing& other) const noexcept { return ! (*this == other); }
+    };
+
+    /** Sets how impulse responses are processed after they are loaded (and trimmed),
+        before they are resampled. The minimum-phase conversion comes first, so the
+        truncation keeps the part of the IR that matters most.
+
+        If the settings change, the current IR is processed again. Like
+        loadImpulseResponse(), this function is wait-free and the work happens on
+        the background thread.
+    */
+    void setIRProcessing (const IRProcessing& processing);
+
+    /** Describes what the IR processing did to the current IR. */
+    struct IRReport
+    {
+        int originalSize = 0;           // at the IR's sample rate, as loaded
+        int processedSize = 0;          // at the IR's sample rate
+        int numPartitions = 0;          // per channel, in the current engine
+        int numPartitionsSaved = 0;     // against the IR as loaded
+    };
+
+    /** This function returns what the IR processing did to the current IR. */
+    IRReport getIRReport() const;
+
 private:
     //==============================================================================
     CabSim (const Latency&,
@@ -0,0 +1,365 @@
+#include "CabSimFFT.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if NEURALPI_USE_PFFFT
+ #include <pffft.h>
+#endif
+
+namespace
+{
+
+//==============================================================================
+class NativeFFT final : public CabSimFFT
+{
+public:
+    explicit NativeFFT (size_t sizeIn)
+        : CabSimFFT (sizeIn),
+          half (sizeIn / 2)
+    {
+        const auto twoPi = juce::MathConstants<double>::twoPi;
+
+        // exp (-2 pi i k / half), for the complex FFT of half the size
+        for (size_t k = 0; k < juce::jmax ((size_t) 1, half / 2); ++k)
+        {
+            twiddleRe.push_back ((float) std::cos (twoPi * (double) k / (double) half));
+            twiddleIm.push_back ((float) -std::sin (twoPi * (double) k / (double) half));
+        }
+
+        // exp (-2 pi i k / size), to split the half size spectrum into the real one
+        for (size_t k = 0; k < half; ++k)
+        {
+            splitRe.push_back ((float) std::cos (twoPi * (double) k / (double) size));
+            splitIm.push_back ((float) -std::sin (twoPi * (double) k / (double) size));
+        }
+    }
+
+    size_t getWorkSize() const noexcept override { return 4 * half; }
+
+    void forward (const float* input, float* spectrum, float* work) const noexcept override
+    {
+        // The even samples are the real parts of a complex signal of half the size,
+        // the odd ones its imaginary parts
+        auto* re = work;
+        auto* im = work + half;
+
+        for (size_t n = 0; n < half; ++n)
+        {
+            re[n] = input[2 * n];
+            im[n] = input[2 * n + 1];
+        }
+
+        const auto* z = transform (work);
+        const auto* zr = z;
+        const auto* zi = z + half;
+
+        spectrum[0]    = zr[0] + zi[0];
+        spectrum[half] = 0.0f;
+        spectrum[size] = zr[0] - zi[0];
+
+        // X[k] = E[k] + exp (-2 pi i k / size) O[k], with E and O the spectra of the
+        // even and odd samples, which are the conjugate-symmetric and -antisymmetric
+        // parts of Z
+        for (size_t k = 1; k < half; ++k)
+        {
+            const auto j = half - k;
+
+            const auto er = 0.5f * (zr[k] + zr[j]);
+            const auto ei = 0.5f * (zi[k] - zi[j]);
+            const auto oRe = 0.5f * (zi[k] + zi[j]);
+            const auto oIm = 0.5f * (zr[j] - zr[k]);
+
+            spectrum[k]        = er + splitRe[k] * oRe - splitIm[k] * oIm;
+            spectrum[half + k] = ei + splitRe[k] * oIm + splitIm[k] * oRe;
+        }
+    }
+
+    void inverse (const float* spectrum, float* output, float* work) const noexcept override
+    {
+        // Rebuilds Z = E + i O from the spectrum, conjugated so the forward
+        // transform does the inverse one. The halves are left out of E and O,
+        // and go into the scale with 1 / half.
+        auto* re = work;
+        auto* im = work + half;
+
+        {
+            const auto xr0 = spectrum[0];
+            const auto xrHalf = spectrum[size];
+
+            re[0] = xr0 + xrHalf;
+            im[0] = -(xr0 - xrHalf);
+        }
+
+        for (size_t k = 1; k < half; ++k)
+        {
+            const auto j = half - k;
+
+            const auto xrk = spectrum[k], xik = spectrum[half + k];
+            const auto xrj = spectrum[j], xij = spectrum[half + j];
+
+            const auto er = xrk + xrj;
+            const auto ei = xik - xij;
+            const auto dr = xrk - xrj;
+            const auto di = xik + xij;
+
+            // O = D exp (2 pi i k / size)
+            const auto oRe = dr * splitRe[k] + di * splitIm[k];
+            const auto oIm = di * splitRe[k] - dr * splitIm[k];
+
+            re[k] = er - oIm;
+            im[k] = -(ei + oRe);
+        }
+
+        const auto* z = transform (work);
+        const auto* zr = z;
+        const auto* zi = z + half;
+        const auto scale = 1.0f / (float) size;
+
+        for (size_t n = 0; n < half; ++n)
+        {
+            output[2 * n]     =  zr[n] * scale;
+            output[2 * n + 1] = -zi[n] * scale;
+        }
+    }
+
+private:
+    // Stockham FFT of half the size, from the split arrays at the start of work,
+    // using the other half of work to sort in. Returns where the result is.
+    const float* transform (float* work) const noexcept
+    {
+        auto* xr = work;
+        auto* xi = work + half;
+        auto* yr = work + 2 * half;
+        auto* yi = work + 3 * half;
+
+        for (size_t n = half, stride = 1; n > 1; n /= 2, stride *= 2)
+        {
+            const auto m = n / 2;
+
+            if (stride == 1)
+            {
+                for (size_t p = 0; p < m; ++p)
+                {
+                    const auto ar = xr[p], ai = xi[p];
+                    const auto br = xr[p + m], bi = xi[p + m];
+                    const auto dr = ar - br, di = ai - bi;
+
+                    yr[2 * p] = ar + br;
+                    yi[2 * p] = ai + bi;
+                    yr[2 * p + 1] = dr * twiddleRe[p] - di * twiddleIm[p];
+                    yi[2 * p + 1] = dr * twiddleIm[p] + di * twiddleRe[p];
+                }
+            }
+            else
+            {
+                for (size_t p = 0; p < m; ++p)
+                {
+                    const auto wr = twiddleRe[p * stride];
+                    const auto wi = twiddleIm[p * stride];
+
+                    const auto* ar = xr + stride * p;
+                    const auto* ai = xi + stride * p;
+                    const auto* br = xr + stride * (p + m);
+                    const auto* bi = xi + stride * (p + m);
+                    auto* sumRe  = yr + stride * 2 * p;
+                    auto* sumIm  = yi + stride * 2 * p;
+                    auto* diffRe = yr + stride * (2 * p + 1);
+                    auto* diffIm = yi + stride * (2 * p + 1);
+
+                    for (size_t q = 0; q < stride; ++q)
+                    {
+                        const auto dr = ar[q] - br[q], di = ai[q] - bi[q];
+
+                        sumRe[q]  = ar[q] + br[q];
+                        sumIm[q]  = ai[q] + bi[q];
+                        diffRe[q] = dr * wr - di * wi;
+                        diffIm[q] = dr * wi + di * wr;
+                    }
+                }
+            }
+
+            std::swap (xr, yr);
+            std::swap (xi, yi);
+        }
+
+        return xr;
+    }
+
+    const size_t half;
+    std::vector<float> twiddleRe, twiddleIm, splitRe, splitIm;
+};
+
+//==============================================================================
+class JuceFFT final : public CabSimFFT
+{
+public:
+    explicit JuceFFT (size_t sizeIn)
+        : CabSimFFT (sizeIn),
+          fft (juce::roundToInt (std::log2 (sizeIn)))
+    {}
+
+    size_t getWorkSize() const noexcept override { return 2 * size; }
+
+    void forward (const float* input, float* spectrum, float* work) const noexcept override
+    {
+        const auto half = size / 2;
+
+        FloatVectorOperations::copy (work, input, static_cast<int> (size));
+        fft.performRealOnlyForwardTransform (work, true);
+
+        for (size_t k = 0; k < half; ++k)
+            spectrum[k] = work[2 * k];
+
+        spectrum[half] = 0.0f;
+
+        for (size_t k = 1; k < half; ++k)
+            spectrum[half + k] = work[2 * k + 1];
+
+        spectrum[size] = work[size];
+    }
+
+    void inverse (const float* spectrum, float* output, float* work) const noexcept override
+    {
+        const auto half = size / 2;
+
+        work[0] = spectrum[0];
+        work[1] = 0.0f;
+        work[size] = spectrum[size];
+        work[size + 1] = 0.0f;
+
+        // Both halves, for the JUCE versions whose fallback FFT reads the negative frequencies
+        for (size_t k = 1; k < half; ++k)
+        {
+            work[2 * k]     = spectrum[k];
+            work[2 * k + 1] = spectrum[half + k];
+            work[2 * (size - k)]     =  spectrum[k];
+            work[2 * (size - k) + 1] = -spectrum[half + k];
+        }
+
+        fft.performRealOnlyInverseTransform (work);
+        FloatVectorOperations::copy (output, work, static_cast<int> (size));
+    }
+
+private:
+    const juce::dsp::FFT fft;
+};
+
+//==============================================================================
+#if NEURALPI_USE_PFFFT
+class PffftFFT final : public CabSimFFT
+{
+public:
+    explicit PffftFFT (size_t sizeIn)
+        : CabSimFFT (sizeIn),
+          setup (pffft_new_setup (static_cast<int> (sizeIn), PFFFT_REAL))
+    {}
+
+    ~PffftFFT() override { pffft_destroy_setup (setup); }
+
+    // Real transforms need a multiple of 2 * simd size squared
+    static bool supports (size_t size)
+    {
+        const auto simdSize = (size_t) pffft_simd_size();
+        return size % (2 * simdSize * simdSize) == 0;
+    }
+
+    size_t getWorkSize() const noexcept override { return 2 * size; }
+
+    // The ordered real spectrum is bin 0, bin size / 2, then the real and
+    // imaginary parts of the bins in between
+    void forward (const float* input, float* spectrum, float* work) const noexcept override
+    {
+        const auto half = size / 2;
+        auto* ordered = work;
+
+        pffft_transform_ordered (setup, input, ordered, work + size, PFFFT_FORWARD);
+
+        spectrum[0] = ordered[0];
+        spectrum[half] = 0.0f;
+        spectrum[size] = ordered[1];
+
+        for (size_t k = 1; k < half; ++k)
+        {
+            spectrum[k]        = ordered[2 * k];
+            spectrum[half + k] = ordered[2 * k + 1];
+        }
+    }
+
+    void inverse (const float* spectrum, float* output, float* work) const noexcept override
+    {
+        const auto half = size / 2;
+        auto* ordered = work;
+
+        ordered[0] = spectrum[0];
+        ordered[1] = spectrum[size];
+
+        for (size_t k = 1; k < half; ++k)
+        {
+            ordered[2 * k]     = spectrum[k];
+            ordered[2 * k + 1] = spectrum[half + k];
+        }
+
+        pffft_transform_ordered (setup, ordered, ordered, work + size, PFFFT_BACKWARD);
+        FloatVectorOperations::copyWithMultiply (output, ordered, 1.0f / (float) size, static_cast<int> (size));
+    }
+
+private:
+    PFFFT_Setup* const setup;
+};
+#endif
+
+std::unique_ptr<CabSimFFT> createFFT (size_t size, CabSimFFT::Backend backend)
+{
+    switch (backend)
+    {
+        case CabSimFFT::Backend::juce:
+            return std::make_unique<JuceFFT> (size);
+
+        case CabSimFFT::Backend::pffft:
+           #if NEURALPI_USE_PFFFT
+            if (PffftFFT::supports (size))
+                return std::make_unique<PffftFFT> (size);
+           #endif
+            break;
+
+        case CabSimFFT::Backend::native:
+            break;
+    }
+
+    return std::make_unique<NativeFFT> (size);
+}
+
+} // namespace
+
+//==============================================================================
+CabSimFFT::Backend CabSimFFT::getDefaultBackend() noexcept
+{
+   #if NEURALPI_USE_PFFFT
+    return Backend::pffft;
+   #elif NEURALPI_CABSIM_FFT_JUCE
+    return Backend::juce;
+   #else
+    return Backend::native;
+   #endif
+}
+
+std::shared_ptr<const CabSimFFT> CabSimFFT::get (size_t size, Backend backend)
+{
+    jassert (juce::isPowerOfTwo ((int) size) && size >= 4);
+
+    // Plans are small, and there are only a few sizes, so they're kept for good
+    static std::map<std::pair<Backend, size_t>, std::shared_ptr<const CabSimFFT>> plans;
+    static std::mutex mutex;
+
+    const std::lock_guard<std::mutex> lock (mutex);
+    auto& plan = plans[{ backend, size }];
+
+    if (plan == nullptr)
+        plan = createFFT (size, backend);
+
+    return plan;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include <memory>
+
+/**
+    Real FFTs for the CabSim engines, in the packed split-complex layout that
+    their complex multiply-accumulate works on.
+
+    The spectrum of a transform of size N is N + 1 floats: the real parts of
+    bins 0 to N/2 - 1, then the imaginary parts of the same bins (bin 0's is
+    always zero), then the real part of bin N/2. The other bins follow from
+    conjugate symmetry. inverse() scales by 1 / N, so it undoes forward().
+
+    A plan only holds read-only tables, and the transforms take a work buffer
+    from the caller, so the plan of a size is shared by every engine (see
+    get()) and can be used from several threads at once.
+
+    Backends:
+      - native: a Stockham FFT on split real and imaginary arrays, which
+        writes the packed layout directly.
+      - juce: juce::dsp::FFT, which uses FFTW, IPP or vDSP if JUCE was built
+        with them. Its interleaved spectrum is repacked after each transform.
+      - pffft: PFFFT, if the build has it (NEURALPI_CABSIM_FFT=pffft), for the
+        sizes it supports. Also repacked.
+
+    The default backend is chosen with NEURALPI_CABSIM_FFT when building.
+*/
+class CabSimFFT
+{
+public:
+    enum class Backend
+    {
+        native,
+        juce,
+        pffft
+    };
+
+    static Backend getDefaultBackend() noexcept;
+
+    /** Returns the shared plan for a power of two size of at least 4. Backends
+        that are unavailable or don't support the size fall back to native.
+        Allocates the first time a size is used, so not for the audio thread.
+    */
+    static std::shared_ptr<const CabSimFFT> get (size_t size, Backend backend = getDefaultBackend());
+
+    virtual ~CabSimFFT() = default;
+
+    size_t getSize() const noexcept          { return size; }
+    size_t getSpectrumSize() const noexcept  { return size + 1; }
+
+    /** The number of floats in the work buffer each transform needs */
+    virtual size_t getWorkSize() const noexcept = 0;
+
+    /** Transforms size real samples to a packed spectrum. input and spectrum
+        may be the same array. All arrays must be 16 byte aligned.
+    */
+    virtual void forward (const float* input, float* spectrum, float* work) const noexcept = 0;
+
+    /** Transforms a packed spectrum to size real samples. spectrum and output
+        may be the same array. All arrays must be 16 byte aligned.
+    */
+    virtual void inverse (const float* spectrum, float* output, float* work) const noexcept = 0;
+
+protected:
+    explicit CabSimFFT (size_t sizeIn) : size (sizeIn) {}
+
+    const size_t size;
+};
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include "Activations.h"
+
 //==============================================================================
 template <typename Type>
 class DelayLine
@@ -173,7 +175,8 @@ public:
                 //auto delayedSample = dline.get (delayTime);
                 auto delayedSample = filter.processSample (dline.get (delayTime));
                 auto inputSample = input[i];
-                auto dlineInputSample = std::tanh (inputSample + feedback * delayedSample);
+                // Within 4e-7 of std::tanh, at a fraction of the cost
+                auto dlineInputSample = Activations::Rational::tanh (inputSample + feedback * delayedSample);
                 dline.push (dlineInputSample);
                 auto outputSample = inputSample + wetLevel * delayedSample;
                 output[i] = outputSample;
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <RTNeural/RTNeural.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/**
+    Time domain convolution with a short IR and no latency, for the IRs that
+    it convolves faster than the partitioned FFT of the CabSim engines (which
+    transforms twice the block size in and out on every block, whatever the
+    IR's length).
+
+    The taps are stored reversed, and each block of input is appended to the
+    last numTaps - 1 input samples, so every output is the dot product of the
+    taps with a contiguous run of the buffer. Outputs are computed a few SIMD
+    registers at a time: each tap is broadcast and multiplied with unaligned
+    loads of the input, so the accumulators stay in registers for the whole
+    IR and there's no horizontal sum.
+*/
+class DirectFIR
+{
+    using v_type = xsimd::simd_type<float>;
+    static constexpr size_t v_size = v_type::size;
+
+public:
+    DirectFIR (const float* samples, size_t numSamples, size_t maxBlockSizeIn)
+        : numTaps (std::max ((size_t) 1, numSamples)),
+          maxBlockSize (std::max ((size_t) 1, maxBlockSizeIn)),
+          taps (numTaps, 0.0f),
+          history (numTaps - 1 + maxBlockSize, 0.0f)
+    {
+        std::reverse_copy (samples, samples + numSamples, taps.end() - (std::ptrdiff_t) numSamples);
+    }
+
+    void reset()
+    {
+        std::fill (history.begin(), history.end(), 0.0f);
+    }
+
+    /** input and output may be the same array */
+    void processSamples (const float* input, float* output, size_t numSamples) noexcept
+    {
+        while (numSamples > 0)
+        {
+            const auto n = std::min (numSamples, maxBlockSize);
+
+            std::copy (input, input + n, history.data() + numTaps - 1);
+            convolve (output, n);
+            std::memmove (history.data(), history.data() + n, (numTaps - 1) * sizeof (float));
+
+            input += n;
+            output += n;
+            numSamples -= n;
+        }
+    }
+
+    size_t getNumTaps() const noexcept { return numTaps; }
+
+private:
+    template <size_t numRegisters>
+    void convolveRegisters (const float* x, float* output) const noexcept
+    {
+        v_type sum[numRegisters];
+
+        for (size_t r = 0; r < numRegisters; ++r)
+            sum[r] = v_type (0.0f);
+
+        for (size_t k = 0; k < numTaps; ++k)
+        {
+            const v_type tap (taps[k]);
+
+            for (size_t r = 0; r < numRegisters; ++r)
+                sum[r] = xsimd::fma (tap, xsimd::load_unaligned (x + k + r * v_size), sum[r]);
+        }
+
+        for (size_t r = 0; r < numRegisters; ++r)
+            sum[r].store_unaligned (output + r * v_size);
+    }
+
+    void convolve (float* output, size_t numSamples) const noexcept
+    {
+        constexpr size_t numRegisters = 4;
+
+        const auto* x = history.data();
+        size_t i = 0;
+
+        for (; i + numRegisters * v_size <= numSamples; i += numRegisters * v_size)
+            convolveRegisters<numRegisters> (x + i, output + i);
+
+        for (; i + v_size <= numSamples; i += v_size)
+            convolveRegisters<1> (x + i, output + i);
+
+        for (; i < numSamples; ++i)
+        {
+            auto sum = 0.0f;
+
+            for (size_t k = 0; k < numTaps; ++k)
+                sum += taps[k] * x[i + k];
+
+            output[i] = sum;
+        }
+    }
+
+    const size_t numTaps;
+    const size_t maxBlockSize;
+    std::vector<float> taps;        // reversed
+    std::vector<float> history;     // the last numTaps - 1 inputs, then the current block
+};
@@ -0,0 +1,70 @@
+#include "EmbeddedModel.h"
+
+// Generated into the build directory by NeuralPiEmbedModels (see resources/CMakeLists.txt)
+#include "EmbeddedModels.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+namespace
+{
+    std::vector<float> copyTable(const float* values, size_t numValues)
+    {
+        return values != nullptr ? std::vector<float>(values, values + numValues) : std::vector<float>();
+    }
+
+    WeightMatrix copyMatrix(const float* values, int rows, int columns)
+    {
+        WeightMatrix matrix;
+        matrix.numRows = rows;
+        matrix.numColumns = columns;
+        matrix.values = copyTable(values, (size_t) (rows * columns));
+        return matrix;
+    }
+
+    bool equalsIgnoreCase(const std::string& a, const std::string& b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [] (char x, char y)
+        {
+            return std::tolower((unsigned char) x) == std::tolower((unsigned char) y);
+        });
+    }
+}
+
+ModelWeights EmbeddedModel::toWeights() const
+{
+    ModelWeights weights;
+    weights.architecture = architecture;
+    weights.sampleRate = sampleRate;
+    weights.denseBias = denseBias;
+    weights.denseWeights = copyTable(denseWeights, (size_t) architecture.hiddenSize);
+
+    for (int l = 0; l < architecture.numLayers; ++l)
+    {
+        const auto& layer = layers[l];
+
+        ModelWeights::RecurrentLayer recurrentLayer;
+        recurrentLayer.W = copyMatrix(layer.W, layer.wRows, layer.wColumns);
+        recurrentLayer.U = copyMatrix(layer.U, layer.uRows, layer.uColumns);
+        recurrentLayer.bias = copyTable(layer.bias, (size_t) layer.biasSize);
+        recurrentLayer.hiddenBias = copyTable(layer.hiddenBias, (size_t) layer.hiddenBiasSize);
+        weights.layers.push_back(std::move(recurrentLayer));
+    }
+
+    return weights;
+}
+
+std::vector<const EmbeddedModel*> EmbeddedModels::getAll()
+{
+    return { std::begin(all), std::end(all) };
+}
+
+const EmbeddedModel* EmbeddedModels::find(const std::string& fileName)
+{
+    for (const auto* model : all)
+        if(equalsIgnoreCase(fileName, model->fileName))
+            return model;
+
+    return nullptr;
+}
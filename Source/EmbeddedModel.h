@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ModelWeights.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+    A default tone compiled into the plugin. The NeuralPiEmbedModels build step
+    turns the model json files into constexpr tables (EmbeddedModels.h in the
+    build directory), already transposed and bias-fused like ModelWeights, so
+    loading one is a copy rather than a file read and a parse.
+
+    The hash of the json file identifies the installed copy: as long as the
+    file in the tones directory is missing or still has the same contents, the
+    tables are used instead.
+*/
+struct EmbeddedModel
+{
+    struct Layer
+    {
+        const float* W;
+        int wRows, wColumns;
+        const float* U;
+        int uRows, uColumns;
+        const float* bias;
+        int biasSize;
+        const float* hiddenBias; // GRU only, otherwise nullptr
+        int hiddenBiasSize;
+    };
+
+    /** Name of the source file, compared case-insensitively with the installed one */
+    const char* fileName;
+    size_t sourceSize;
+    uint64_t sourceHash;
+
+    ModelArchitecture architecture;
+    float sampleRate;
+    const Layer* layers;
+    const float* denseWeights;
+    float denseBias;
+
+    /** Copies the tables into ModelWeights */
+    ModelWeights toWeights() const;
+
+    /** 64 bit FNV-1a */
+    static constexpr uint64_t hash(const char* data, size_t numBytes) noexcept
+    {
+        uint64_t h = 14695981039346656037ull;
+
+        for (size_t i = 0; i < numBytes; ++i)
+            h = (h ^ (uint8_t) data[i]) * 1099511628211ull;
+
+        return h;
+    }
+};
+
+namespace EmbeddedModels
+{
+    /** All the embedded tones */
+    std::vector<const EmbeddedModel*> getAll();
+
+    /** The embedded tone with this file name, ignoring case, or nullptr */
+    const EmbeddedModel* find(const std::string& fileName);
+}
@@ -0,0 +1,256 @@
+#include "IRPartitionCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    template <typename T>
+    T readValue(const char* data, size_t offset)
+    {
+        T value;
+        std::memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void writeValue(std::vector<char>& data, size_t offset, T value)
+    {
+        std::memcpy(data.data() + offset, &value, sizeof(T));
+    }
+
+    size_t alignOffset(size_t offset)
+    {
+        const auto alignment = IRPartitionCacheFormat::dataAlignment;
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // Fills in the entry from the file's bytes, returns false if they don't hold the key
+    bool readEntry(const char* data, size_t numBytes, const IRPartitionCache::Key& key,
+                   int& irSize, CabSim::IRReport& report, std::vector<IRPartitionCache::Part>& parts)
+    {
+        using namespace IRPartitionCacheFormat;
+
+        if(numBytes < headerSize || std::memcmp(data, magic, sizeof(magic)) != 0
+            || readValue<uint32_t>(data, 4) != version || readValue<uint32_t>(data, 8) != headerSize)
+            return false;
+
+        // The file name is a hash of the key, so a different key is only a collision
+        if(readValue<uint64_t>(data, 16) != key.contentHash || readValue<uint64_t>(data, 24) != key.settingsHash
+            || readValue<double>(data, 32) != key.sampleRate || readValue<uint32_t>(data, 40) != key.maxBlockSize)
+            return false;
+
+        const auto numParts = (size_t) readValue<uint32_t>(data, 12);
+
+        if(numBytes < headerSize + numParts * partRecordSize)
+            return false;
+
+        irSize = readValue<int32_t>(data, 44);
+        report.originalSize = readValue<int32_t>(data, 48);
+        report.processedSize = readValue<int32_t>(data, 52);
+        report.numPartitions = readValue<int32_t>(data, 56);
+        report.numPartitionsSaved = readValue<int32_t>(data, 60);
+
+        parts.clear();
+
+        for(size_t i = 0; i < numParts; ++i)
+        {
+            const auto record = headerSize + i * partRecordSize;
+
+            IRPartitionCache::Part part;
+            part.fftSize = readValue<uint32_t>(data, record);
+            part.numSegments = readValue<uint32_t>(data, record + 4);
+            part.segmentSize = readValue<uint32_t>(data, record + 8);
+
+            const auto offset = readValue<uint64_t>(data, record + 16);
+            const auto partBytes = (uint64_t) part.numSegments * part.segmentSize * sizeof(float);
+
+            if(offset % dataAlignment != 0 || offset > numBytes || partBytes > numBytes - offset)
+                return false;
+
+            part.segments = reinterpret_cast<const float*>(data + offset);
+            parts.push_back(part);
+        }
+
+        return true;
+    }
+}
+
+//==============================================================================
+IRPartitionCache& IRPartitionCache::getInstance()
+{
+    static IRPartitionCache instance;
+    return instance;
+}
+
+uint64_t IRPartitionCache::hash(const void* data, size_t numBytes, uint64_t seed) noexcept
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+
+    for(size_t i = 0; i < numBytes; ++i)
+        seed = (seed ^ bytes[i]) * 1099511628211ull;
+
+    return seed;
+}
+
+void IRPartitionCache::setDirectory(const juce::File& newDirectory)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    directory = newDirectory;
+
+    if(directory != juce::File() && ! directory.createDirectory())
+        directory = juce::File();
+}
+
+void IRPartitionCache::setBudget(juce::int64 budgetInBytes)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    budget = budgetInBytes;
+    evict(juce::File());
+}
+
+juce::File IRPartitionCache::getFile(const Key& key) const
+{
+    auto keyHash = hash(&key.contentHash, sizeof(key.contentHash));
+    keyHash = hash(&key.settingsHash, sizeof(key.settingsHash), keyHash);
+    keyHash = hash(&key.sampleRate, sizeof(key.sampleRate), keyHash);
+    keyHash = hash(&key.maxBlockSize, sizeof(key.maxBlockSize), keyHash);
+
+    return directory.getChildFile(juce::String::toHexString((juce::int64) keyHash).paddedLeft('0', 16)
+                                  + IRPartitionCacheFormat::fileExtension);
+}
+
+std::unique_ptr<IRPartitionCache::Entry> IRPartitionCache::find(const Key& key)
+{
+    juce::File file;
+
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+
+        if(directory == juce::File())
+            return nullptr;
+
+        file = getFile(key);
+    }
+
+    if(! file.existsAsFile())
+        return nullptr;
+
+    auto entry = std::make_unique<Entry>();
+    entry->mappedFile = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+
+    const char* data = static_cast<const char*>(entry->mappedFile->getData());
+    auto numBytes = entry->mappedFile->getSize();
+
+    // Mapping can fail on some file systems, fall back to reading the file
+    if(data == nullptr)
+    {
+        entry->mappedFile = nullptr;
+
+        if(! file.loadFileAsData(entry->data))
+            return nullptr;
+
+        data = static_cast<const char*>(entry->data.getData());
+        numBytes = entry->data.getSize();
+    }
+
+    if(! readEntry(data, numBytes, key, entry->irSize, entry->report, entry->parts))
+        return nullptr;
+
+    // Keeps recently used files from being evicted. Eviction only needs to
+    // know roughly how old a file is, and each update is a write to the disk.
+    const auto now = juce::Time::getCurrentTime();
+
+    if(now - file.getLastModificationTime() > juce::RelativeTime::days(1))
+        file.setLastModificationTime(now);
+
+    return entry;
+}
+
+void IRPartitionCache::store(const Key& key, int irSize, const CabSim::IRReport& report, const std::vector<Part>& parts)
+{
+    using namespace IRPartitionCacheFormat;
+
+    std::vector<uint64_t> offsets;
+    auto numBytes = alignOffset(headerSize + parts.size() * partRecordSize);
+
+    for(const auto& part : parts)
+    {
+        offsets.push_back(numBytes);
+        numBytes = alignOffset(numBytes + (size_t) part.numSegments * part.segmentSize * sizeof(float));
+    }
+
+    std::vector<char> data(numBytes, 0);
+    std::memcpy(data.data(), magic, sizeof(magic));
+    writeValue<uint32_t>(data, 4, version);
+    writeValue<uint32_t>(data, 8, (uint32_t) headerSize);
+    writeValue<uint32_t>(data, 12, (uint32_t) parts.size());
+    writeValue<uint64_t>(data, 16, key.contentHash);
+    writeValue<uint64_t>(data, 24, key.settingsHash);
+    writeValue<double>(data, 32, key.sampleRate);
+    writeValue<uint32_t>(data, 40, key.maxBlockSize);
+    writeValue<int32_t>(data, 44, irSize);
+    writeValue<int32_t>(data, 48, report.originalSize);
+    writeValue<int32_t>(data, 52, report.processedSize);
+    writeValue<int32_t>(data, 56, report.numPartitions);
+    writeValue<int32_t>(data, 60, report.numPartitionsSaved);
+
+    for(size_t i = 0; i < parts.size(); ++i)
+    {
+        const auto record = headerSize + i * partRecordSize;
+        writeValue<uint32_t>(data, record, parts[i].fftSize);
+        writeValue<uint32_t>(data, record + 4, parts[i].numSegments);
+        writeValue<uint32_t>(data, record + 8, parts[i].segmentSize);
+        writeValue<uint64_t>(data, record + 16, offsets[i]);
+
+        std::memcpy(data.data() + offsets[i], parts[i].segments,
+                    (size_t) parts[i].numSegments * parts[i].segmentSize * sizeof(float));
+    }
+
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    if(directory == juce::File())
+        return;
+
+    const auto file = getFile(key);
+
+    // Written next to the target and moved into place, so readers never see half a file
+    juce::TemporaryFile temp(file);
+
+    if(temp.getFile().replaceWithData(data.data(), data.size()))
+        temp.overwriteTargetFileWithTemporary();
+
+    evict(file);
+}
+
+void IRPartitionCache::evict(const juce::File& fileToKeep)
+{
+    if(directory == juce::File())
+        return;
+
+    auto files = directory.findChildFiles(juce::File::findFiles, false, juce::String("*") + IRPartitionCacheFormat::fileExtension);
+
+    // Oldest first
+    std::sort(files.begin(), files.end(), [](const juce::File& a, const juce::File& b)
+    {
+        return a.getLastModificationTime() < b.getLastModificationTime();
+    });
+
+    juce::int64 totalBytes = 0;
+    for(const auto& file : files)
+        totalBytes += file.getSize();
+
+    for(const auto& file : files)
+    {
+        if(totalBytes <= budget)
+            break;
+
+        if(file == fileToKeep)
+            continue;
+
+        const auto size = file.getSize();
+
+        if(file.deleteFile())
+            totalBytes -= size;
+    }
+}
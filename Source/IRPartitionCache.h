@@ -0,0 +1,151 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "CabSim.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+    Process-wide on-disk cache of the frequency domain partitions of CabSim
+    engines, shared by all CabSim instances.
+
+    Building an engine decodes the IR file, resamples it to the host rate,
+    normalises it and transforms every partition. The result only depends on
+    the file's content and the settings it was built with, so it's stored
+    here and memory-mapped back in the next time the same IR is loaded at the
+    same sample rate and block size: switching IRs and starting up with many
+    of them then costs a file read instead of all of that work.
+
+    Entries are keyed by a hash of the IR's content and a hash of the CabSim
+    settings (see CabSim.cpp), along with the sample rate and block size. The
+    FFT size of each partition is stored and checked, so an entry is never
+    used for an engine it doesn't fit.
+
+    When the files exceed the byte budget the least recently used ones are
+    deleted. A file's modification time is its last use, refreshed by find()
+    at most once a day, so loading the same IRs again doesn't write to the
+    disk (an SD card on a Pi) every time. Nothing is cached until a directory
+    is set.
+
+    All methods are thread safe.
+*/
+class IRPartitionCache
+{
+public:
+    static constexpr juce::int64 defaultBudgetInBytes = 64 * 1024 * 1024;
+
+    /** The instance shared by the whole process */
+    static IRPartitionCache& getInstance();
+
+    /** 64-bit FNV-1a, continuing from seed to hash several values into one */
+    static uint64_t hash(const void* data, size_t numBytes, uint64_t seed = 14695981039346656037ull) noexcept;
+
+    struct Key
+    {
+        uint64_t contentHash = 0;
+        uint64_t settingsHash = 0;
+        double sampleRate = 0.0;
+        uint32_t maxBlockSize = 0;
+    };
+
+    /** The partitions of one engine, numSegments runs of segmentSize floats */
+    struct Part
+    {
+        uint32_t fftSize = 0;
+        uint32_t numSegments = 0;
+        uint32_t segmentSize = 0;
+        const float* segments = nullptr;
+    };
+
+    /** An entry read from the cache, valid for as long as it is alive */
+    class Entry
+    {
+    public:
+        int getIRSize() const noexcept                      { return irSize; }
+        const CabSim::IRReport& getReport() const noexcept  { return report; }
+        size_t getNumParts() const noexcept                 { return parts.size(); }
+        const Part& getPart(size_t index) const noexcept    { return parts[index]; }
+
+    private:
+        friend class IRPartitionCache;
+
+        std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+        juce::MemoryBlock data;     // if the file couldn't be mapped
+        int irSize = 0;
+        CabSim::IRReport report;
+        std::vector<Part> parts;
+    };
+
+    /** Sets where the cache files go, creating the directory if needed. An empty
+        File turns the cache off.
+    */
+    void setDirectory(const juce::File& directory);
+
+    /** Sets the maximum size of the cache files, deleting files if needed */
+    void setBudget(juce::int64 budgetInBytes);
+
+    /** Returns nullptr if the key isn't cached, or its file is truncated or of
+        another format version
+    */
+    std::unique_ptr<Entry> find(const Key& key);
+
+    /** Stores the partitions of an engine (in the order the engine is built from
+        them) for an IR of irSize samples. Does nothing if the cache is off or the
+        file can't be written: the cache is only ever a shortcut.
+    */
+    void store(const Key& key, int irSize, const CabSim::IRReport& report, const std::vector<Part>& parts);
+
+private:
+    juce::File getFile(const Key& key) const;
+    void evict(const juce::File& fileToKeep);
+
+    juce::File directory;
+    juce::int64 budget = defaultBudgetInBytes;
+
+    mutable std::mutex mutex;
+};
+
+/**
+    IR partition cache file (.npc), version 1.
+
+    Native byte order, since the cache never leaves the machine. The file
+    starts with a 64 byte header:
+
+        offset  type        field
+        0       char[4]     magic "NPIR"
+        4       uint32      format version
+        8       uint32      header size (64)
+        12      uint32      number of parts
+        16      uint64      content hash
+        24      uint64      settings hash
+        32      float64     sample rate
+        40      uint32      maximum block size
+        44      int32       IR size in samples, at the sample rate
+        48      int32[4]    CabSim::IRReport, in declaration order
+
+    followed by a 24 byte record per part:
+
+        0       uint32      FFT size
+        4       uint32      number of segments
+        8       uint32      segment size in floats
+        12      uint32      reserved, zero
+        16      uint64      offset of the segments in the file
+
+    and the float32 segments of each part, starting on a 64 byte boundary.
+
+    The version must change whenever the way engines are built from an IR
+    does, since files from older builds would otherwise still match.
+*/
+namespace IRPartitionCacheFormat
+{
+    constexpr char magic[4] = { 'N', 'P', 'I', 'R' };
+    constexpr uint32_t version = 1;
+    constexpr size_t headerSize = 64;
+    constexpr size_t partRecordSize = 24;
+    constexpr size_t dataAlignment = 64;
+    constexpr const char* fileExtension = ".npc";
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+/**
+    Decides when the amp and effects chain can be skipped because nothing is
+    being played, and when it has to run again.
+
+    The chain goes idle once the input has stayed below closeThreshold, and the
+    output of the chain below outputThreshold, for holdSeconds. Waiting for the
+    output means the amp model's recurrent state has settled on silence and the
+    delay, reverb and IR tails have died out, so emitting zeros instead is
+    inaudible, and the stages pick up where they left off when they resume.
+
+    It wakes up as soon as the input goes above openThreshold. The input of a
+    block is measured before the block is processed, so the whole block is the
+    lookahead: the first block with signal in it is processed in full, without
+    any added latency.
+*/
+class IdleDetector
+{
+public:
+    static constexpr float openThreshold = 0.0006f;     // about -64 dBFS
+    static constexpr float closeThreshold = 0.0003f;    // about -70 dBFS
+    static constexpr float outputThreshold = 0.00003f;  // about -90 dBFS
+    static constexpr double holdSeconds = 0.5;
+
+    void prepare (double sampleRate)
+    {
+        holdSamples = (int) (sampleRate * holdSeconds);
+        reset();
+    }
+
+    void reset()
+    {
+        idle = false;
+        quietSamples = 0;
+        outputPeak = 1.0f;
+    }
+
+    /** Call with the peak of a block's input before processing it. Returns true
+        if the chain can skip the block.
+    */
+    bool processInput (float inputPeak, int numSamples) noexcept
+    {
+        if (idle)
+        {
+            idle = inputPeak <= openThreshold;
+
+            if (! idle)
+                quietSamples = 0;
+
+            return idle;
+        }
+
+        if (inputPeak < closeThreshold && outputPeak < outputThreshold)
+            quietSamples += numSamples;
+        else
+            quietSamples = 0;
+
+        idle = quietSamples >= holdSamples;
+        return idle;
+    }
+
+    /** Call with the peak of the chain's output after processing a block */
+    void processOutput (float peak) noexcept
+    {
+        outputPeak = peak;
+    }
+
+    bool isIdle() const noexcept { return idle; }
+
+private:
+    bool idle = false;
+    int quietSamples = 0;
+    int holdSamples = 22050;
+    float outputPeak = 1.0f;
+};
@@ -0,0 +1,404 @@
+#include "ModelCompressor.h"
+
+#include "ModelRegistry.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    constexpr int blockSize = 128;
+
+    /** Renders the reference signal through models and compares them with the original */
+    class Evaluator
+    {
+    public:
+        explicit Evaluator(const ModelWeights& original)
+        {
+            makeSignal(original.sampleRate);
+            reference = render(original);
+
+            for (auto y : reference)
+                signalEnergy += (double) y * y;
+        }
+
+        double measure(const ModelWeights& candidate) const
+        {
+            const auto output = render(candidate);
+            double errorEnergy = 0.0;
+
+            for (size_t n = 0; n < output.size(); ++n)
+            {
+                const auto error = (double) output[n] - reference[n];
+                errorEnergy += error * error;
+            }
+
+            return signalEnergy > 0.0 ? errorEnergy / signalEnergy : 0.0;
+        }
+
+    private:
+        // Decaying plucked notes at a few pitches and levels, plus a little noise,
+        // with the gain and master parameters set differently for every note
+        void makeSignal(double sampleRate)
+        {
+            const int noteLength = (int) (sampleRate / 4);
+            const float frequencies[] = { 82.4f, 110.0f, 196.0f, 329.6f, 146.8f, 440.0f };
+            const float levels[] = { 0.8f, 0.3f, 0.5f, 0.1f, 1.0f, 0.05f };
+            const float settings[][2] = { { 0.5f, 0.5f }, { 0.0f, 1.0f }, { 1.0f, 0.25f }, { 0.25f, 0.75f }, { 0.75f, 0.0f }, { 1.0f, 1.0f } };
+
+            std::mt19937 rng(1);
+            std::normal_distribution<float> noise(0.0f, 0.002f);
+
+            for (size_t note = 0; note < std::size(frequencies); ++note)
+            {
+                for (int n = 0; n < noteLength; ++n)
+                {
+                    const auto t = (float) (n / sampleRate);
+                    const auto phase = 2.0f * 3.14159265f * frequencies[note] * t;
+                    const auto envelope = levels[note] * std::exp(-8.0f * t);
+
+                    input.push_back(envelope * (std::sin(phase) + 0.5f * std::sin(2.0f * phase) + 0.25f * std::sin(3.0f * phase)) / 1.75f
+                                    + noise(rng));
+                }
+
+                // Parameters change on block boundaries, like they do in the processor
+                while (blockParams.size() * blockSize < input.size())
+                    blockParams.push_back({ settings[note][0], settings[note][1] });
+            }
+        }
+
+        std::vector<float> render(const ModelWeights& weights) const
+        {
+            auto model = ModelRegistry::createModel(weights);
+            std::vector<float> output(input.size());
+
+            for (size_t start = 0, block = 0; start < input.size(); start += blockSize, ++block)
+            {
+                const auto numSamples = (int) std::min((size_t) blockSize, input.size() - start);
+                const auto* params = blockParams[block].data();
+                model->process(input.data() + start, params, params, output.data() + start, numSamples);
+            }
+
+            return output;
+        }
+
+        std::vector<float> input;
+        std::vector<std::array<float, 2>> blockParams;
+        std::vector<float> reference;
+        double signalEnergy = 0.0;
+    };
+
+    bool isCompressible(const ModelWeights& weights)
+    {
+        return ! weights.waveNet.has_value() && weights.architecture.numLayers == 1 && weights.layers.size() == 1;
+    }
+
+    // Finds the first candidate that passes, assuming that once one passes all
+    // the following ones do too. Returns candidates.size() if none passes.
+    template <typename Test>
+    size_t findFirstPassing(size_t numCandidates, Test&& passes)
+    {
+        size_t low = 0, high = numCandidates;
+
+        while (low < high)
+        {
+            const auto middle = low + (high - low) / 2;
+
+            if(passes(middle))
+                high = middle;
+            else
+                low = middle + 1;
+        }
+
+        return low;
+    }
+
+    /** Hidden units in order of importance: the norm of their outgoing weights,
+        to the Dense layer and to every gate of the recurrence
+    */
+    std::vector<int> rankUnits(const ModelWeights& weights)
+    {
+        const auto hiddenSize = weights.architecture.hiddenSize;
+        const auto& U = weights.layers[0].U;
+
+        std::vector<double> importance((size_t) hiddenSize);
+
+        for (int j = 0; j < hiddenSize; ++j)
+        {
+            importance[(size_t) j] = (double) weights.denseWeights[(size_t) j] * weights.denseWeights[(size_t) j];
+
+            for (int c = 0; c < U.numColumns; ++c)
+                importance[(size_t) j] += (double) U.row(j)[c] * U.row(j)[c];
+        }
+
+        std::vector<int> units((size_t) hiddenSize);
+        std::iota(units.begin(), units.end(), 0);
+        std::stable_sort(units.begin(), units.end(), [&importance] (int a, int b) { return importance[(size_t) a] > importance[(size_t) b]; });
+
+        return units;
+    }
+
+    /** Keeps the hidden units in kept, which is sorted */
+    ModelWeights prune(const ModelWeights& weights, const std::vector<int>& kept)
+    {
+        const auto numGates = weights.architecture.numGates();
+        const auto hiddenSize = weights.architecture.hiddenSize;
+        const auto newSize = (int) kept.size();
+        const auto& layer = weights.layers[0];
+
+        // Gate vectors are [gates * hidden], one block of hidden units per gate
+        const auto pruneGates = [&] (const float* values, float* dest)
+        {
+            for (int g = 0; g < numGates; ++g)
+                for (int n = 0; n < newSize; ++n)
+                    dest[g * newSize + n] = values[g * hiddenSize + kept[(size_t) n]];
+        };
+
+        ModelWeights pruned = weights;
+        pruned.architecture.hiddenSize = newSize;
+
+        auto& newLayer = pruned.layers[0];
+        newLayer.W = WeightMatrix(layer.W.numRows, numGates * newSize);
+        newLayer.U = WeightMatrix(newSize, numGates * newSize);
+        newLayer.bias.assign((size_t) (numGates * newSize), 0.0f);
+        newLayer.lowRankU.reset();
+
+        for (int i = 0; i < layer.W.numRows; ++i)
+            pruneGates(layer.W.row(i), newLayer.W.row(i));
+
+        for (int n = 0; n < newSize; ++n)
+            pruneGates(layer.U.row(kept[(size_t) n]), newLayer.U.row(n));
+
+        pruneGates(layer.bias.data(), newLayer.bias.data());
+
+        if(! layer.hiddenBias.empty())
+        {
+            newLayer.hiddenBias.assign((size_t) (numGates * newSize), 0.0f);
+            pruneGates(layer.hiddenBias.data(), newLayer.hiddenBias.data());
+        }
+
+        pruned.denseWeights.resize((size_t) newSize);
+
+        for (int n = 0; n < newSize; ++n)
+            pruned.denseWeights[(size_t) n] = weights.denseWeights[(size_t) kept[(size_t) n]];
+
+        return pruned;
+    }
+
+    /** Hidden sizes below the current one to try. A model with a specialised
+        kernel only tries the smaller specialised sizes, so it keeps one.
+    */
+    std::vector<int> getPrunedSizes(const ModelArchitecture& architecture)
+    {
+        const auto isSpecialised = ModelRegistry::isSpecialised(architecture);
+        std::vector<int> sizes;
+
+        for (int size = 1; size < architecture.hiddenSize; ++size)
+        {
+            auto candidate = architecture;
+            candidate.hiddenSize = size;
+
+            if(! isSpecialised || ModelRegistry::isSpecialised(candidate))
+                sizes.push_back(size);
+        }
+
+        return sizes;
+    }
+
+    /**
+        Singular value decomposition of U = L^T * Y by one-sided Jacobi rotations
+        of the rows: L is orthogonal and the rows of Y are orthogonal, with their
+        norms the singular values. Rows are sorted by decreasing singular value.
+    */
+    struct RowSVD
+    {
+        explicit RowSVD(const WeightMatrix& U)
+            : numRows(U.numRows), numColumns(U.numColumns),
+              Y((size_t) (numRows * numColumns)), L((size_t) (numRows * numRows), 0.0)
+        {
+            std::copy(U.values.begin(), U.values.end(), Y.begin());
+
+            for (int r = 0; r < numRows; ++r)
+                L[(size_t) (r * numRows + r)] = 1.0;
+
+            for (int sweep = 0; sweep < 50; ++sweep)
+            {
+                bool rotated = false;
+
+                for (int p = 0; p < numRows - 1; ++p)
+                    for (int q = p + 1; q < numRows; ++q)
+                        rotated = orthogonalise(p, q) || rotated;
+
+                if(! rotated)
+                    break;
+            }
+
+            order.resize((size_t) numRows);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [this] (int a, int b) { return rowNorm(a) > rowNorm(b); });
+        }
+
+        /** P = the first rank columns of L^T, Q = the first rank rows of Y */
+        ModelWeights::LowRankMatrix truncate(int rank) const
+        {
+            ModelWeights::LowRankMatrix factors { WeightMatrix(numRows, rank), WeightMatrix(rank, numColumns) };
+
+            for (int m = 0; m < rank; ++m)
+            {
+                const auto r = order[(size_t) m];
+
+                for (int j = 0; j < numRows; ++j)
+                    factors.P.row(j)[m] = (float) L[(size_t) (r * numRows + j)];
+
+                for (int c = 0; c < numColumns; ++c)
+                    factors.Q.row(m)[c] = (float) Y[(size_t) (r * numColumns + c)];
+            }
+
+            return factors;
+        }
+
+    private:
+        // Rotates rows p and q of Y (and L) to make them orthogonal.
+        // Returns false if they already are.
+        bool orthogonalise(int p, int q)
+        {
+            auto* yp = Y.data() + p * numColumns;
+            auto* yq = Y.data() + q * numColumns;
+            double alpha = 0.0, beta = 0.0, gamma = 0.0;
+
+            for (int c = 0; c < numColumns; ++c)
+            {
+                alpha += yp[c] * yp[c];
+                beta += yq[c] * yq[c];
+                gamma += yp[c] * yq[c];
+            }
+
+            if(std::abs(gamma) <= 1.0e-12 * std::sqrt(alpha * beta) || gamma == 0.0)
+                return false;
+
+            const auto zeta = (beta - alpha) / (2.0 * gamma);
+            const auto t = (zeta >= 0.0 ? 1.0 : -1.0) / (std::abs(zeta) + std::sqrt(1.0 + zeta * zeta));
+            const auto cs = 1.0 / std::sqrt(1.0 + t * t);
+            const auto sn = cs * t;
+
+            const auto rotate = [cs, sn] (double* a, double* b, int size)
+            {
+                for (int i = 0; i < size; ++i)
+                {
+                    const auto x = a[i], y = b[i];
+                    a[i] = cs * x - sn * y;
+                    b[i] = sn * x + cs * y;
+                }
+            };
+
+            rotate(yp, yq, numColumns);
+            rotate(L.data() + p * numRows, L.data() + q * numRows, numRows);
+            return true;
+        }
+
+        double rowNorm(int r) const
+        {
+            const auto* y = Y.data() + r * numColumns;
+            return std::sqrt(std::inner_product(y, y + numColumns, y, 0.0));
+        }
+
+        int numRows, numColumns;
+        std::vector<double> Y, L;
+        std::vector<int> order;
+    };
+
+    /** The same model with U replaced by its rank-limited factorisation */
+    ModelWeights factorise(const ModelWeights& weights, const RowSVD& svd, int rank)
+    {
+        ModelWeights factorised = weights;
+        auto& layer = factorised.layers[0];
+        auto factors = svd.truncate(rank);
+
+        // U holds the product for the kernels without a low-rank mode
+        for (int j = 0; j < layer.U.numRows; ++j)
+        {
+            auto* row = layer.U.row(j);
+            std::fill(row, row + layer.U.numColumns, 0.0f);
+
+            for (int m = 0; m < rank; ++m)
+                for (int c = 0; c < layer.U.numColumns; ++c)
+                    row[c] += factors.P.row(j)[m] * factors.Q.row(m)[c];
+        }
+
+        layer.lowRankU = std::move(factors);
+        return factorised;
+    }
+}
+
+ModelCompressor::Result ModelCompressor::compress(const ModelWeights& weights, double maxESR)
+{
+    Result result { weights, weights.architecture.hiddenSize, 0, 0.0 };
+
+    if(! isCompressible(weights) || maxESR <= 0.0)
+        return result;
+
+    const Evaluator evaluator(weights);
+
+    // Pruning
+    const auto units = rankUnits(weights);
+    const auto sizes = getPrunedSizes(weights.architecture);
+    std::vector<double> sizeESR(sizes.size(), 0.0);
+
+    const auto prunedTo = [&units] (const ModelWeights& source, int size)
+    {
+        std::vector<int> kept(units.begin(), units.begin() + size);
+        std::sort(kept.begin(), kept.end());
+        return prune(source, kept);
+    };
+
+    const auto firstSize = findFirstPassing(sizes.size(), [&] (size_t i)
+    {
+        sizeESR[i] = evaluator.measure(prunedTo(weights, sizes[i]));
+        return sizeESR[i] <= maxESR;
+    });
+
+    if(firstSize < sizes.size())
+    {
+        result.weights = prunedTo(weights, sizes[firstSize]);
+        result.hiddenSize = sizes[firstSize];
+        result.esr = sizeESR[firstSize];
+    }
+
+    // Low-rank recurrent matrix, worth it while 5 * hidden * rank < 4 * hidden^2
+    if(result.weights.architecture.unitType != RecurrentUnit::LSTM)
+        return result;
+
+    const auto hiddenSize = result.weights.architecture.hiddenSize;
+    const auto maxRank = (4 * hiddenSize - 1) / 5;
+
+    if(maxRank < 1)
+        return result;
+
+    const RowSVD svd(result.weights.layers[0].U);
+    std::vector<double> rankESR((size_t) maxRank, 0.0);
+
+    const auto firstRank = findFirstPassing((size_t) maxRank, [&] (size_t i)
+    {
+        rankESR[i] = evaluator.measure(factorise(result.weights, svd, (int) i + 1));
+        return rankESR[i] <= maxESR;
+    });
+
+    if(firstRank < (size_t) maxRank)
+    {
+        result.weights = factorise(result.weights, svd, (int) firstRank + 1);
+        result.rank = (int) firstRank + 1;
+        result.esr = rankESR[firstRank];
+    }
+
+    return result;
+}
+
+double ModelCompressor::measureESR(const ModelWeights& reference, const ModelWeights& candidate)
+{
+    return Evaluator(reference).measure(candidate);
+}
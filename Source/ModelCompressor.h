@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ModelWeights.h"
+
+/**
+    Makes recurrent models cheaper to run when they're loaded, as far as an
+    error budget allows.
+
+    Two transforms are tried on single layer LSTM and GRU models:
+      - pruning: the hidden units with the smallest outgoing weights (to the
+        Dense layer and to the other units) are removed, down to the smallest
+        hidden size that stays within the budget. If the model has a
+        specialised kernel, only the smaller specialised sizes are tried, so
+        the pruned model keeps one.
+      - low-rank recurrent matrix (LSTM only): U is replaced by a truncated
+        SVD P * Q of the lowest rank within the budget, if that rank saves
+        multiply-adds over the full product (see BlockLSTM::setLowRankUVals).
+
+    A transform is only kept if the error-to-signal ratio (ESR) between the
+    output of the compressed and the original model, on a guitar-like
+    reference signal swept over the conditioning parameters, is at most
+    maxESR. Both are run in float32 with exact activations, so the budget
+    doesn't include any quantisation error from ModelOptions.
+
+    Each size and rank tried is a pass over the 1.5 second reference signal,
+    a dozen or so in all, so compressing belongs on a background thread.
+*/
+namespace ModelCompressor
+{
+    struct Result
+    {
+        ModelWeights weights;
+
+        int hiddenSize = 0;         // after pruning
+        int rank = 0;               // rank of the recurrent matrix, 0 if it's full
+        double esr = 0.0;           // against the original model
+    };
+
+    /** Returns a copy of weights if nothing can be compressed within maxESR,
+        or if the model isn't a single layer LSTM or GRU
+    */
+    Result compress(const ModelWeights& weights, double maxESR);
+
+    /** ESR of candidate's output against reference's on the reference signal */
+    double measureESR(const ModelWeights& reference, const ModelWeights& candidate);
+}
@@ -0,0 +1,420 @@
+#include "ModelRegistry.h"
+
+#include <RTNeural/RTNeural.h>
+
+#include "Activations.h"
+#include "BatchedLSTM.h"
+#include "BlockLSTM.h"
+#include "QuantisedLSTM.h"
+#include "WaveNet.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    using SpecialisedHiddenSizes = std::integer_sequence<int, 8, 12, 16, 20, 24, 32, 40, 48, 64>;
+
+    // The processor provides the guitar signal plus at most two conditioning
+    // parameters (gain and master)
+    constexpr int maxInputSize = 3;
+
+    /** Adapts an RTNeural model, which runs one sample per forward() call, to NeuralModel.
+
+        RTNeural keeps the recurrent state in the layers, next to the weights, and
+        doesn't expose it, so these models have no state snapshots (getStateSize() is 0).
+    */
+    template <typename ModelType>
+    class SampleModel : public NeuralModel
+    {
+        using v_type = xsimd::simd_type<float>;
+        static constexpr int v_size = (int) v_type::size;
+
+    public:
+        template <typename... Args>
+        SampleModel(const ModelArchitecture& architecture, Args&&... args)
+            : model(std::forward<Args>(args)...),
+              numParams(architecture.inputSize - 1),
+              skipGain(architecture.skip ? 1.0f : 0.0f)
+        {
+        }
+
+        void reset() override
+        {
+            model.reset();
+        }
+
+        void process(const float* inData, const float* paramsStart, const float* paramsEnd, float* outData, int numSamples) override
+        {
+            if(numSamples <= 0)
+                return;
+
+            // Same ramp as BlockLSTM: the parameters reach paramsEnd on the last sample
+            float paramsStep[maxInputSize - 1] {};
+
+            for (int p = 0; p < numParams; ++p)
+            {
+                paramsStep[p] = (paramsEnd[p] - paramsStart[p]) / (float) numSamples;
+                input[p + 1] = paramsEnd[p] - paramsStep[p] * (float) (numSamples - 1);
+            }
+
+            for (int n = 0; n < numSamples; ++n)
+            {
+                const auto x = inData[n];
+                input[0] = x;
+                outData[n] = model.forward(input) + skipGain * x;
+
+                for (int p = 0; p < numParams; ++p)
+                    input[p + 1] += paramsStep[p];
+            }
+        }
+
+        ModelType model;
+
+    private:
+        const int numParams;
+        const float skipGain;
+
+        // Padded to whole SIMD registers, since RTNeural loads its inputs aligned
+        alignas(v_type) float input[((maxInputSize + v_size - 1) / v_size) * v_size] {};
+    };
+
+    /** Runs one copy of a model per stream, for the models without a batched kernel */
+    class StreamsModel : public NeuralModel
+    {
+    public:
+        explicit StreamsModel(std::vector<std::unique_ptr<NeuralModel>> modelsToUse)
+            : models(std::move(modelsToUse))
+        {
+        }
+
+        void reset() override
+        {
+            for (auto& model : models)
+                model->reset();
+        }
+
+        // Every copy gets the input and the first one is returned, the others write to
+        // the scratch buffer. Chunks get their part of the conditioning ramp.
+        void process(const float* inData, const float* paramsStart, const float* paramsEnd, float* outData, int numSamples) override
+        {
+            for (int start = 0; start < numSamples; start += scratchSize)
+            {
+                const auto chunkSize = std::min(scratchSize, numSamples - start);
+                float chunkParamsStart[maxInputSize - 1] {}, chunkParamsEnd[maxInputSize - 1] {};
+
+                for (int p = 0; p < maxInputSize - 1 && paramsStart != nullptr; ++p)
+                {
+                    const auto step = (paramsEnd[p] - paramsStart[p]) / (float) numSamples;
+                    chunkParamsStart[p] = paramsStart[p] + step * (float) start;
+                    chunkParamsEnd[p] = paramsStart[p] + step * (float) (start + chunkSize);
+                }
+
+                for (size_t i = 1; i < models.size(); ++i)
+                    models[i]->process(inData + start, chunkParamsStart, chunkParamsEnd, scratch, chunkSize);
+
+                models[0]->process(inData + start, chunkParamsStart, chunkParamsEnd, outData + start, chunkSize);
+            }
+        }
+
+        int getNumStreams() const override
+        {
+            return (int) models.size();
+        }
+
+        void processStreams(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numSamples) override
+        {
+            for (size_t i = 0; i < models.size(); ++i)
+                models[i]->process(inData[i], paramsStart, paramsEnd, outData[i], numSamples);
+        }
+
+        size_t getStateSize() const override
+        {
+            size_t size = 0;
+
+            for (const auto& model : models)
+            {
+                if(model->getStateSize() == 0)
+                    return 0;
+
+                size += model->getStateSize();
+            }
+
+            return size;
+        }
+
+        void saveState(void* dest) const override
+        {
+            auto* bytes = static_cast<char*>(dest);
+
+            for (const auto& model : models)
+            {
+                model->saveState(bytes);
+                bytes += model->getStateSize();
+            }
+        }
+
+        void restoreState(const void* source) override
+        {
+            const auto* bytes = static_cast<const char*>(source);
+
+            for (auto& model : models)
+            {
+                model->restoreState(bytes);
+                bytes += model->getStateSize();
+            }
+        }
+
+    private:
+        static constexpr int scratchSize = 256;
+
+        std::vector<std::unique_ptr<NeuralModel>> models;
+        float scratch[scratchSize];
+    };
+
+    template <RecurrentUnit unit, typename LayerType>
+    void loadRecurrentLayer(LayerType& layer, const ModelWeights::RecurrentLayer& weights)
+    {
+        layer.setWVals(weights.W.toVec2d());
+        layer.setUVals(weights.U.toVec2d());
+
+        if constexpr (unit == RecurrentUnit::LSTM)
+            layer.setBVals(weights.bias);
+        else
+            layer.setBVals(Vec2d { weights.bias, weights.hiddenBias });
+    }
+
+    template <typename LayerType>
+    void loadDenseLayer(LayerType& layer, const ModelWeights& weights)
+    {
+        layer.setWeights(Vec2d { weights.denseWeights });
+        layer.setBias(&weights.denseBias);
+    }
+
+    // Kernels with a low-rank recurrent product (BlockLSTM::setLowRankUVals)
+    template <typename LSTMType, typename = void>
+    struct HasLowRankU : std::false_type {};
+
+    template <typename LSTMType>
+    struct HasLowRankU<LSTMType, std::void_t<decltype(std::declval<LSTMType&>().setLowRankUVals(nullptr, nullptr, 0))>> : std::true_type {};
+
+    template <typename LSTMType, template <typename> class ModelWrapper = NeuralModelT>
+    std::unique_ptr<NeuralModel> createBlockLSTM(const ModelWeights& weights)
+    {
+        auto newModel = std::make_unique<ModelWrapper<LSTMType>>();
+        auto& lstm = newModel->model;
+        const auto& layer = weights.layers[0];
+
+        lstm.setWVals(layer.W.values.data());
+        lstm.setUVals(layer.U.values.data());
+
+        if constexpr (HasLowRankU<LSTMType>::value)
+            if(layer.lowRankU.has_value())
+                lstm.setLowRankUVals(layer.lowRankU->P.values.data(), layer.lowRankU->Q.values.data(), layer.lowRankU->P.numColumns);
+
+        lstm.setBVals(layer.bias.data());
+        lstm.setDenseWeights(weights.denseWeights.data());
+        lstm.setDenseBias(&weights.denseBias);
+        lstm.setSkipConnection(weights.architecture.skip);
+
+        return newModel;
+    }
+
+    template <RecurrentUnit unit, int input_size, int hidden_size, typename... RecurrentLayers, size_t... Is>
+    std::unique_ptr<NeuralModel> buildModelT(const ModelWeights& weights, std::index_sequence<Is...>)
+    {
+        using ModelType = RTNeural::ModelT<float, input_size, 1, RecurrentLayers..., RTNeural::DenseT<float, hidden_size, 1>>;
+
+        auto newModel = std::make_unique<SampleModel<ModelType>>(weights.architecture);
+        auto& model = newModel->model;
+
+        (loadRecurrentLayer<unit>(model.template get<Is>(), weights.layers[Is]), ...);
+        loadDenseLayer(model.template get<sizeof...(Is)>(), weights);
+
+        return newModel;
+    }
+
+    template <RecurrentUnit unit, int input_size, int hidden_size>
+    std::unique_ptr<NeuralModel> createModelT(const ModelWeights& weights)
+    {
+        using RTNeural::GRULayerT;
+        using RTNeural::LSTMLayerT;
+
+        if constexpr (unit == RecurrentUnit::LSTM)
+        {
+            if(weights.architecture.numLayers == 1)
+                return buildModelT<unit, input_size, hidden_size, LSTMLayerT<float, input_size, hidden_size>>(weights, std::make_index_sequence<1>());
+
+            return buildModelT<unit, input_size, hidden_size, LSTMLayerT<float, input_size, hidden_size>, LSTMLayerT<float, hidden_size, hidden_size>>(weights, std::make_index_sequence<2>());
+        }
+        else
+        {
+            if(weights.architecture.numLayers == 1)
+                return buildModelT<unit, input_size, hidden_size, GRULayerT<float, input_size, hidden_size>>(weights, std::make_index_sequence<1>());
+
+            return buildModelT<unit, input_size, hidden_size, GRULayerT<float, input_size, hidden_size>, GRULayerT<float, hidden_size, hidden_size>>(weights, std::make_index_sequence<2>());
+        }
+    }
+
+    // Quantised models have a single stream kernel only, createModel() makes one copy per stream
+    template <int input_size, int hidden_size, typename Activation>
+    std::unique_ptr<NeuralModel> createSingleLayerLSTM(const ModelWeights& weights, const ModelOptions& options)
+    {
+        switch (options.precision)
+        {
+            case ModelPrecision::Int8:    return createBlockLSTM<QuantisedLSTM<input_size, hidden_size, int8_t, Activation>>(weights);
+            case ModelPrecision::Float16: return createBlockLSTM<QuantisedLSTM<input_size, hidden_size, Float16, Activation>>(weights);
+            case ModelPrecision::Float32: break;
+        }
+
+        switch (options.numStreams)
+        {
+            case 2: return createBlockLSTM<BatchedLSTM<input_size, hidden_size, 2, Activation>, MultiStreamModelT>(weights);
+            case 4: return createBlockLSTM<BatchedLSTM<input_size, hidden_size, 4, Activation>, MultiStreamModelT>(weights);
+            case 8: return createBlockLSTM<BatchedLSTM<input_size, hidden_size, 8, Activation>, MultiStreamModelT>(weights);
+            default: break;
+        }
+
+        return createBlockLSTM<BlockLSTM<input_size, hidden_size, Activation>>(weights);
+    }
+
+    template <int input_size, int hidden_size>
+    std::unique_ptr<NeuralModel> createSpecialised(const ModelWeights& weights, const ModelOptions& options)
+    {
+        const auto& architecture = weights.architecture;
+
+        if(architecture.unitType == RecurrentUnit::LSTM && architecture.numLayers == 1)
+        {
+            switch (options.activations)
+            {
+                case ModelActivations::Rational: return createSingleLayerLSTM<input_size, hidden_size, Activations::Rational>(weights, options);
+                case ModelActivations::Exact:    break;
+            }
+
+            return createSingleLayerLSTM<input_size, hidden_size, Activations::Exact>(weights, options);
+        }
+
+        if(architecture.unitType == RecurrentUnit::LSTM)
+            return createModelT<RecurrentUnit::LSTM, input_size, hidden_size>(weights);
+
+        return createModelT<RecurrentUnit::GRU, input_size, hidden_size>(weights);
+    }
+
+    template <int input_size, int... hidden_sizes>
+    std::unique_ptr<NeuralModel> createForHiddenSize(const ModelWeights& weights, const ModelOptions& options, std::integer_sequence<int, hidden_sizes...>)
+    {
+        std::unique_ptr<NeuralModel> newModel;
+
+        ((weights.architecture.hiddenSize == hidden_sizes
+              && (newModel = createSpecialised<input_size, hidden_sizes>(weights, options), true)) || ...);
+
+        return newModel;
+    }
+
+    template <int... hidden_sizes>
+    bool isSpecialisedHiddenSize(int hiddenSize, std::integer_sequence<int, hidden_sizes...>)
+    {
+        return ((hiddenSize == hidden_sizes) || ...);
+    }
+
+    std::unique_ptr<NeuralModel> createWaveNet(const WaveNetWeights& weights)
+    {
+        auto newModel = std::make_unique<NeuralModelT<WaveNetModel>>();
+        newModel->model.setWeights(weights);
+        return newModel;
+    }
+
+    // Run-time sized fallback for anything that isn't specialised
+    std::unique_ptr<NeuralModel> createDynamic(const ModelWeights& weights)
+    {
+        const auto& architecture = weights.architecture;
+        const int hidden_size = architecture.hiddenSize;
+
+        auto newModel = std::make_unique<SampleModel<RTNeural::Model<float>>>(architecture, architecture.inputSize);
+        auto& model = newModel->model;
+
+        for (int l = 0; l < architecture.numLayers; ++l)
+        {
+            const int layer_input_size = l == 0 ? architecture.inputSize : hidden_size;
+
+            if(architecture.unitType == RecurrentUnit::LSTM)
+            {
+                auto* layer = new RTNeural::LSTMLayer<float>(layer_input_size, hidden_size);
+                loadRecurrentLayer<RecurrentUnit::LSTM>(*layer, weights.layers[(size_t) l]);
+                model.addLayer(layer);
+            }
+            else
+            {
+                auto* layer = new RTNeural::GRULayer<float>(layer_input_size, hidden_size);
+                loadRecurrentLayer<RecurrentUnit::GRU>(*layer, weights.layers[(size_t) l]);
+                model.addLayer(layer);
+            }
+        }
+
+        auto* dense = new RTNeural::Dense<float>(hidden_size, 1);
+        loadDenseLayer(*dense, weights);
+        model.addLayer(dense);
+
+        return newModel;
+    }
+
+    std::unique_ptr<NeuralModel> createKernel(const ModelWeights& weights, const ModelOptions& options)
+    {
+        const auto& architecture = weights.architecture;
+
+        if(weights.waveNet.has_value())
+            return createWaveNet(*weights.waveNet);
+
+        if(architecture.inputSize < 1 || architecture.inputSize > maxInputSize)
+            throw std::runtime_error("Unsupported input_size: " + std::to_string(architecture.inputSize));
+
+        if((int) weights.layers.size() != architecture.numLayers)
+            throw std::runtime_error("Model weights don't match the number of layers");
+
+        if(! ModelRegistry::isSpecialised(architecture))
+            return createDynamic(weights);
+
+        switch (architecture.inputSize)
+        {
+            case 1: return createForHiddenSize<1>(weights, options, SpecialisedHiddenSizes());
+            case 2: return createForHiddenSize<2>(weights, options, SpecialisedHiddenSizes());
+            default: return createForHiddenSize<3>(weights, options, SpecialisedHiddenSizes());
+        }
+    }
+}
+
+bool ModelRegistry::isSpecialised(const ModelArchitecture& architecture)
+{
+    return architecture.inputSize >= 1 && architecture.inputSize <= maxInputSize
+        && architecture.numLayers <= 2
+        && isSpecialisedHiddenSize(architecture.hiddenSize, SpecialisedHiddenSizes());
+}
+
+std::unique_ptr<NeuralModel> ModelRegistry::createModel(const ModelWeights& weights, const ModelOptions& options)
+{
+    const auto numStreams = options.numStreams;
+
+    if(numStreams != 1 && numStreams != 2 && numStreams != 4 && numStreams != 8)
+        throw std::runtime_error("Unsupported number of streams: " + std::to_string(numStreams));
+
+    auto newModel = createKernel(weights, options);
+
+    if(newModel->getNumStreams() == numStreams)
+        return newModel;
+
+    // No batched kernel for this one, so every stream gets its own copy
+    auto singleStreamOptions = options;
+    singleStreamOptions.numStreams = 1;
+
+    std::vector<std::unique_ptr<NeuralModel>> streams;
+    streams.push_back(std::move(newModel));
+
+    while((int) streams.size() < numStreams)
+        streams.push_back(createKernel(weights, singleStreamOptions));
+
+    return std::make_unique<StreamsModel>(std::move(streams));
+}
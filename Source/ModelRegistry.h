@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+
+#include "ModelWeights.h"
+#include "NeuralModel.h"
+
+/** Storage of the recurrent weights. Reduced precision only applies to
+    single layer LSTMs with a specialised kernel, everything else runs in float.
+*/
+enum class ModelPrecision {
+    Float32,
+    Float16,
+    Int8
+};
+
+/** Sigmoid/tanh implementation of the LSTM gates, see Activations.h for the
+    error bounds. Only applies to single layer LSTMs with a specialised
+    kernel, the others use RTNeural's activations.
+*/
+enum class ModelActivations {
+    Exact,
+    Rational
+};
+
+/** How a model is instantiated, chosen when it's loaded */
+struct ModelOptions
+{
+    ModelPrecision precision = ModelPrecision::Float32;
+    ModelActivations activations = ModelActivations::Exact;
+
+    /** Runs the model at ModelWeights::sampleRate, resampling from and back to
+        the host rate. This is applied by NeuralNetwork, the registry ignores it.
+    */
+    bool nativeSampleRate = false;
+
+    /** Independent signals the model runs in lock-step, each with its own
+        state: 1, 2, 4 or 8. Single layer float32 LSTMs with a specialised
+        kernel batch them (BatchedLSTM), anything else runs one copy of the
+        model per stream.
+    */
+    int numStreams = 1;
+
+    /** Compresses the model when it's loaded (see ModelCompressor), as far as
+        the error-to-signal ratio against the original stays within this bound.
+        0 turns it off. This is applied by NeuralNetwork, the registry ignores it.
+    */
+    float maxCompressionESR = 0.0f;
+
+    bool operator==(const ModelOptions& other) const
+    {
+        return precision == other.precision && activations == other.activations
+            && nativeSampleRate == other.nativeSampleRate && numStreams == other.numStreams
+            && maxCompressionESR == other.maxCompressionESR;
+    }
+
+    bool operator!=(const ModelOptions& other) const { return ! (*this == other); }
+};
+
+/**
+    Builds the fastest available implementation for a set of model weights.
+
+    Common architectures are compiled ahead of time:
+      - LSTM, 1 layer:       BlockLSTM (block-batched input projection, with
+                             the low-rank recurrent product of compressed models), or
+                             QuantisedLSTM for ModelPrecision::Float16/Int8,
+                             or BatchedLSTM for several float32 streams,
+                             with the activations from ModelOptions
+      - LSTM/GRU, 1-2 layers: RTNeural::ModelT
+    for hidden sizes 8, 12, 16, 20, 24, 32, 40, 48 and 64 and 1 to 3 inputs.
+    Anything else runs on RTNeural's dynamic (run-time sized) model, which is
+    slower but accepts any hidden size and number of layers.
+
+    NAM WaveNets always run on WaveNetModel, and ignore the precision and
+    activations options.
+*/
+namespace ModelRegistry
+{
+    /** Returns true if the architecture has a compile-time specialised kernel */
+    bool isSpecialised(const ModelArchitecture& architecture);
+
+    /** Throws std::runtime_error if the architecture can't be run at all, or
+        for an unsupported ModelOptions::numStreams
+    */
+    std::unique_ptr<NeuralModel> createModel(const ModelWeights& weights, const ModelOptions& options = {});
+}
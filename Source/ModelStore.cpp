@@ -0,0 +1,149 @@
+#include "ModelStore.h"
+
+#include "EmbeddedModel.h"
+
+#include <optional>
+
+static ModelWeights load_json(const juce::File &file)
+{
+    // Read in the JSON file
+    std::ifstream i2(file.getFullPathName().toUTF8());
+	nlohmann::json weights_json;
+	i2 >> weights_json;
+
+    return ModelWeights::fromJson(weights_json);
+}
+
+static ModelWeights load_nam(const juce::File &file)
+{
+    std::ifstream i2(file.getFullPathName().toUTF8());
+    nlohmann::json nam_json;
+    i2 >> nam_json;
+
+    return ModelWeights::fromNam(nam_json);
+}
+
+static ModelWeights load_binary(const juce::File &file)
+{
+    // The tensors are stored ready to use, so they are copied straight out of the mapped file
+    juce::MemoryMappedFile mappedFile(file, juce::MemoryMappedFile::readOnly);
+
+    if(mappedFile.getData() != nullptr)
+        return ModelWeights::fromBinary(mappedFile.getData(), mappedFile.getSize());
+
+    // Mapping can fail on some file systems, fall back to reading the file
+    juce::MemoryBlock data;
+    if(! file.loadFileAsData(data))
+        throw std::runtime_error("Unable to read " + file.getFullPathName().toStdString());
+
+    return ModelWeights::fromBinary(data.getData(), data.getSize());
+}
+
+// The default tones are compiled in, and used without parsing the file while it's
+// missing (not installed yet, or a read-only file system) or still the original
+static std::optional<ModelWeights> load_embedded(const juce::File &file)
+{
+    const auto* embedded = EmbeddedModels::find(file.getFileName().toStdString());
+
+    if(embedded == nullptr)
+        return std::nullopt;
+
+    if(file.existsAsFile())
+    {
+        juce::MemoryBlock data;
+
+        if(file.getSize() != (juce::int64) embedded->sourceSize || ! file.loadFileAsData(data)
+            || EmbeddedModel::hash(static_cast<const char*>(data.getData()), data.getSize()) != embedded->sourceHash)
+            return std::nullopt;
+    }
+
+    return embedded->toWeights();
+}
+
+static ModelWeights load_weights(const juce::File &file)
+{
+    if(auto weights = load_embedded(file))
+        return std::move(*weights);
+
+    if(file.hasFileExtension(".json"))
+        return load_json(file);
+
+    if(file.hasFileExtension(ModelBinaryFormat::fileExtension))
+        return load_binary(file);
+
+    if(file.hasFileExtension(".nam"))
+        return load_nam(file);
+
+    throw std::runtime_error("Unsupported model file: " + file.getFullPathName().toStdString());
+}
+
+//==============================================================================
+ModelStore& ModelStore::getInstance()
+{
+    static ModelStore instance;
+    return instance;
+}
+
+std::shared_ptr<const ModelWeights> ModelStore::getWeights(const juce::File& file)
+{
+    const Key key { file.getFullPathName(), file.getLastModificationTime().toMilliseconds(), file.getSize() };
+
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+
+        if(const auto it = index.find(key); it != index.end())
+        {
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->weights;
+        }
+    }
+
+    std::shared_ptr<const ModelWeights> weights = std::make_shared<ModelWeights>(load_weights(file));
+    const auto numBytes = weights->getNumBytes();
+
+    const std::lock_guard<std::mutex> lock(mutex);
+
+    // Another instance may have loaded the same file in the meantime
+    if(const auto it = index.find(key); it != index.end())
+        return it->second->weights;
+
+    entries.push_front({ key, weights, numBytes });
+    index[key] = entries.begin();
+    cachedBytes += numBytes;
+
+    evict();
+    return weights;
+}
+
+void ModelStore::setBudget(size_t budgetInBytes)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    budget = budgetInBytes;
+    evict();
+}
+
+size_t ModelStore::getCachedBytes() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return cachedBytes;
+}
+
+void ModelStore::clear()
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    entries.clear();
+    cachedBytes = 0;
+}
+
+void ModelStore::evict()
+{
+    // The most recently used entry always stays, even if it's over budget on its own
+    while(cachedBytes > budget && entries.size() > 1)
+    {
+        const auto& entry = entries.back();
+        cachedBytes -= entry.numBytes;
+        index.erase(entry.key);
+        entries.pop_back();
+    }
+}
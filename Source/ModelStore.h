@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "ModelWeights.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+/**
+    Process-wide cache of parsed model weights, shared by all NeuralNetwork
+    instances (e.g. several NeuralPi plugins in one Sushi process).
+
+    Weights are immutable once loaded and handed out by reference count, so
+    instances using the same model share a single copy, and switching back to
+    a recently used model skips both the disk and the parser.
+
+    Entries are keyed by path, modification time and file size, so an edited
+    file is loaded again. When the cached weights exceed the byte budget the
+    least recently used entries are dropped; weights that are still in use stay
+    alive until their last user releases them.
+
+    All methods are thread safe. Loading happens outside the lock, so a slow
+    load doesn't hold up other instances.
+*/
+class ModelStore
+{
+public:
+    static constexpr size_t defaultBudgetInBytes = 16 * 1024 * 1024;
+
+    /** The instance shared by the whole process */
+    static ModelStore& getInstance();
+
+    /** Returns the weights of a .json, .npb or .nam model file, loading it only if it
+        isn't cached. The default tones come from the tables compiled into the plugin
+        (see EmbeddedModel), even if the file doesn't exist. Throws std::runtime_error
+        if the file can't be loaded.
+    */
+    std::shared_ptr<const ModelWeights> getWeights(const juce::File& file);
+
+    /** Sets the maximum memory used by cached weights, evicting entries if needed */
+    void setBudget(size_t budgetInBytes);
+
+    size_t getCachedBytes() const;
+
+    void clear();
+
+private:
+    struct Key
+    {
+        juce::String path;
+        juce::int64 modificationTime;
+        juce::int64 fileSize;
+
+        bool operator<(const Key& other) const
+        {
+            return std::tie(path, modificationTime, fileSize) < std::tie(other.path, other.modificationTime, other.fileSize);
+        }
+    };
+
+    struct Entry
+    {
+        Key key;
+        std::shared_ptr<const ModelWeights> weights;
+        size_t numBytes;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    void evict();
+
+    // Most recently used first
+    EntryList entries;
+    std::map<Key, EntryList::iterator> index;
+
+    size_t budget = defaultBudgetInBytes;
+    size_t cachedBytes = 0;
+
+    mutable std::mutex mutex;
+};
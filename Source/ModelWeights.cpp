@@ -0,0 +1,614 @@
+#include "ModelWeights.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+Vec2d WeightMatrix::toVec2d() const
+{
+    Vec2d result((size_t) numRows);
+
+    for (int r = 0; r < numRows; ++r)
+        result[(size_t) r].assign(row(r), row(r) + numColumns);
+
+    return result;
+}
+
+namespace
+{
+    void checkShape(const Vec2d& x, int rows, int columns, const std::string& name)
+    {
+        if ((int) x.size() != rows)
+            throw std::runtime_error(name + ": expected " + std::to_string(rows) + " rows, got " + std::to_string(x.size()));
+
+        for (const auto& r : x)
+            if ((int) r.size() != columns)
+                throw std::runtime_error(name + ": expected " + std::to_string(columns) + " columns, got " + std::to_string(r.size()));
+    }
+
+    void checkSize(const std::vector<float>& x, int size, const std::string& name)
+    {
+        if ((int) x.size() != size)
+            throw std::runtime_error(name + ": expected " + std::to_string(size) + " values, got " + std::to_string(x.size()));
+    }
+
+    // PyTorch stores [gates * hidden][inputs], RTNeural wants [inputs][gates * hidden]
+    WeightMatrix transposed(const Vec2d& x)
+    {
+        WeightMatrix y((int) x[0].size(), (int) x.size());
+
+        for (int i = 0; i < y.numColumns; ++i)
+            for (int j = 0; j < y.numRows; ++j)
+                y.row(j)[i] = x[(size_t) i][(size_t) j];
+
+        return y;
+    }
+
+    bool isLittleEndianHost()
+    {
+        const uint32_t one = 1;
+        unsigned char firstByte;
+        std::memcpy(&firstByte, &one, 1);
+        return firstByte == 1;
+    }
+
+    uint32_t swapBytes(uint32_t x)
+    {
+        return (x >> 24) | ((x >> 8) & 0xff00u) | ((x << 8) & 0xff0000u) | (x << 24);
+    }
+
+    size_t alignedOffset(size_t offset)
+    {
+        const auto alignment = ModelBinaryFormat::tensorAlignment;
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    class BinaryWriter
+    {
+    public:
+        void writeUint32(uint32_t x)
+        {
+            if(! isLittleEndianHost())
+                x = swapBytes(x);
+
+            const auto* bytes = reinterpret_cast<const char*>(&x);
+            data.insert(data.end(), bytes, bytes + sizeof(x));
+        }
+
+        void writeFloat(float x)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            writeUint32(bits);
+        }
+
+        void writeTensor(const std::vector<float>& tensor)
+        {
+            padTo(alignedOffset(data.size()));
+
+            for (auto x : tensor)
+                writeFloat(x);
+        }
+
+        void padTo(size_t size)
+        {
+            data.resize(std::max(size, data.size()), 0);
+        }
+
+        std::vector<char> data;
+    };
+
+    class BinaryReader
+    {
+    public:
+        BinaryReader(const void* dataToRead, size_t numBytes)
+            : data(static_cast<const char*>(dataToRead)), size(numBytes)
+        {
+        }
+
+        uint32_t readUint32(size_t offset) const
+        {
+            checkRange(offset, sizeof(uint32_t));
+
+            uint32_t x;
+            std::memcpy(&x, data + offset, sizeof(x));
+            return isLittleEndianHost() ? x : swapBytes(x);
+        }
+
+        float readFloat(size_t offset) const
+        {
+            const auto bits = readUint32(offset);
+
+            float x;
+            std::memcpy(&x, &bits, sizeof(x));
+            return x;
+        }
+
+        // Tensors are read in file order, each from the next aligned offset
+        void readTensor(std::vector<float>& tensor, size_t numValues)
+        {
+            position = alignedOffset(position);
+            checkRange(position, numValues * sizeof(float));
+
+            tensor.resize(numValues);
+
+            if(isLittleEndianHost())
+                std::memcpy(tensor.data(), data + position, numValues * sizeof(float));
+            else
+                for (size_t i = 0; i < numValues; ++i)
+                    tensor[i] = readFloat(position + i * sizeof(float));
+
+            position += numValues * sizeof(float);
+        }
+
+        size_t position = ModelBinaryFormat::headerSize;
+
+    private:
+        void checkRange(size_t offset, size_t numBytes) const
+        {
+            if(offset > size || numBytes > size - offset)
+                throw std::runtime_error("Binary model is truncated");
+        }
+
+        const char* data;
+        size_t size;
+    };
+
+    // Reads the flat weight list of a .nam file, in the order NAM writes it
+    struct NamWeightReader
+    {
+        float next()
+        {
+            if(position >= values.size())
+                throw std::runtime_error("NAM model has fewer weights than its config needs");
+
+            return values[position++];
+        }
+
+        // NAM stores 1x1 convolutions as [outputs][inputs]
+        WeightMatrix readMatrix(int inputs, int outputs)
+        {
+            WeightMatrix matrix(inputs, outputs);
+
+            for (int o = 0; o < outputs; ++o)
+                for (int i = 0; i < inputs; ++i)
+                    matrix.row(i)[o] = next();
+
+            return matrix;
+        }
+
+        std::vector<float> readVector(int size)
+        {
+            std::vector<float> vector((size_t) size);
+
+            for (auto& x : vector)
+                x = next();
+
+            return vector;
+        }
+
+        const std::vector<float>& values;
+        size_t position = 0;
+    };
+
+    WaveNetActivation parseWaveNetActivation(const std::string& name)
+    {
+        if(name == "Tanh")     return WaveNetActivation::Tanh;
+        if(name == "Fasttanh") return WaveNetActivation::FastTanh;
+        if(name == "Hardtanh") return WaveNetActivation::HardTanh;
+        if(name == "ReLU")     return WaveNetActivation::ReLU;
+        if(name == "Sigmoid")  return WaveNetActivation::Sigmoid;
+
+        throw std::runtime_error("Unsupported WaveNet activation: " + name);
+    }
+
+    size_t numValues(const WeightMatrix& matrix) { return matrix.values.size(); }
+    size_t numValues(const std::vector<float>& vector) { return vector.size(); }
+
+    // PyTorch orders the GRU gates reset, update, new. RTNeural expects update, reset, new.
+    void swapResetAndUpdate(float* gateVector, int hiddenSize)
+    {
+        std::swap_ranges(gateVector, gateVector + hiddenSize, gateVector + hiddenSize);
+    }
+}
+
+int WaveNetWeights::getReceptiveField() const
+{
+    int receptiveField = 1;
+
+    for (const auto& layerArray : layerArrays)
+        for (const auto& layer : layerArray.layers)
+            receptiveField += layer.dilation * (layerArray.kernelSize - 1);
+
+    return receptiveField;
+}
+
+size_t ModelWeights::getNumBytes() const
+{
+    size_t totalValues = denseWeights.size() + 1;
+
+    for (const auto& layer : layers)
+    {
+        totalValues += layer.W.values.size() + layer.U.values.size() + layer.bias.size() + layer.hiddenBias.size();
+
+        if(layer.lowRankU.has_value())
+            totalValues += layer.lowRankU->P.values.size() + layer.lowRankU->Q.values.size();
+    }
+
+    if(waveNet.has_value())
+    {
+        for (const auto& layerArray : waveNet->layerArrays)
+        {
+            totalValues += numValues(layerArray.rechannel) + numValues(layerArray.headRechannel) + numValues(layerArray.headBias);
+
+            for (const auto& layer : layerArray.layers)
+            {
+                for (const auto& tap : layer.conv)
+                    totalValues += numValues(tap);
+
+                totalValues += numValues(layer.convBias) + numValues(layer.inputMixin) + numValues(layer.oneByOne) + numValues(layer.oneByOneBias);
+            }
+        }
+    }
+
+    return sizeof(ModelWeights) + totalValues * sizeof(float);
+}
+
+bool ModelWeights::canMorph(const ModelWeights& a, const ModelWeights& b)
+{
+    return ! a.waveNet.has_value() && ! b.waveNet.has_value()
+        && a.architecture == b.architecture && a.sampleRate == b.sampleRate
+        && a.layers.size() == b.layers.size() && a.denseWeights.size() == b.denseWeights.size();
+}
+
+ModelWeights ModelWeights::morph(const ModelWeights& a, const ModelWeights& b, float amount)
+{
+    if(! canMorph(a, b))
+        throw std::runtime_error("Models with different architectures can't be morphed");
+
+    const auto interpolate = [amount] (const std::vector<float>& x, const std::vector<float>& y)
+    {
+        if(x.size() != y.size())
+            throw std::runtime_error("Models with different tensor shapes can't be morphed");
+
+        std::vector<float> result(x.size());
+
+        for (size_t i = 0; i < x.size(); ++i)
+            result[i] = x[i] + (y[i] - x[i]) * amount;
+
+        return result;
+    };
+
+    ModelWeights weights = a;
+
+    for (size_t l = 0; l < weights.layers.size(); ++l)
+    {
+        auto& layer = weights.layers[l];
+        const auto& layerA = a.layers[l];
+        const auto& layerB = b.layers[l];
+
+        layer.W.values = interpolate(layerA.W.values, layerB.W.values);
+        layer.U.values = interpolate(layerA.U.values, layerB.U.values);
+        layer.bias = interpolate(layerA.bias, layerB.bias);
+        layer.hiddenBias = interpolate(layerA.hiddenBias, layerB.hiddenBias);
+
+        // The factors of a compressed model don't interpolate to those of the blend
+        layer.lowRankU.reset();
+    }
+
+    weights.denseWeights = interpolate(a.denseWeights, b.denseWeights);
+    weights.denseBias = a.denseBias + (b.denseBias - a.denseBias) * amount;
+
+    return weights;
+}
+
+ModelWeights ModelWeights::fromJson(const nlohmann::json &weights_json)
+{
+    ModelWeights weights;
+    auto& architecture = weights.architecture;
+
+    const auto& model_data = weights_json.at("model_data");
+    architecture.inputSize = model_data.at("input_size");
+    architecture.hiddenSize = model_data.at("hidden_size");
+    architecture.numLayers = model_data.value("num_layers", 1);
+    architecture.skip = model_data.value("skip", 1) != 0;
+
+    const auto unit_type = model_data.value("unit_type", std::string("LSTM"));
+
+    if(unit_type == "LSTM")
+        architecture.unitType = RecurrentUnit::LSTM;
+    else if(unit_type == "GRU")
+        architecture.unitType = RecurrentUnit::GRU;
+    else
+        throw std::runtime_error("Unsupported unit_type: " + unit_type);
+
+    if(model_data.value("output_size", 1) != 1)
+        throw std::runtime_error("Only models with a single output are supported");
+
+    if(architecture.inputSize < 1 || architecture.hiddenSize < 1 || architecture.numLayers < 1)
+        throw std::runtime_error("Invalid model_data");
+
+    // Different trainers store the rate under different names, in model_data or at the top level
+    for (const auto* metadata : { &model_data, &weights_json })
+        for (const auto* key : { "sample_rate", "samplerate" })
+            if(metadata->contains(key))
+                weights.sampleRate = metadata->at(key).get<float>();
+
+    if(! (weights.sampleRate > 0.0f))
+        throw std::runtime_error("Invalid sample rate");
+
+    const auto& state_dict = weights_json.at("state_dict");
+    const int hidden_size = architecture.hiddenSize;
+    const int gate_size = architecture.numGates() * hidden_size;
+
+    for (int l = 0; l < architecture.numLayers; ++l)
+    {
+        const auto suffix = "_l" + std::to_string(l);
+        const int layer_input_size = l == 0 ? architecture.inputSize : hidden_size;
+
+        Vec2d weights_ih = state_dict.at("rec.weight_ih" + suffix);
+        Vec2d weights_hh = state_dict.at("rec.weight_hh" + suffix);
+        std::vector<float> bias_ih = state_dict.at("rec.bias_ih" + suffix);
+        std::vector<float> bias_hh = state_dict.at("rec.bias_hh" + suffix);
+
+        checkShape(weights_ih, gate_size, layer_input_size, "rec.weight_ih" + suffix);
+        checkShape(weights_hh, gate_size, hidden_size, "rec.weight_hh" + suffix);
+        checkSize(bias_ih, gate_size, "rec.bias_ih" + suffix);
+        checkSize(bias_hh, gate_size, "rec.bias_hh" + suffix);
+
+        RecurrentLayer layer;
+        layer.W = transposed(weights_ih);
+        layer.U = transposed(weights_hh);
+
+        if(architecture.unitType == RecurrentUnit::LSTM)
+        {
+            for (int i = 0; i < gate_size; ++i)
+                bias_hh[(size_t) i] += bias_ih[(size_t) i];
+
+            layer.bias = std::move(bias_hh);
+        }
+        else
+        {
+            for (int i = 0; i < layer.W.numRows; ++i)
+                swapResetAndUpdate(layer.W.row(i), hidden_size);
+
+            for (int i = 0; i < layer.U.numRows; ++i)
+                swapResetAndUpdate(layer.U.row(i), hidden_size);
+
+            swapResetAndUpdate(bias_ih.data(), hidden_size);
+            swapResetAndUpdate(bias_hh.data(), hidden_size);
+
+            layer.bias = std::move(bias_ih);
+            layer.hiddenBias = std::move(bias_hh);
+        }
+
+        weights.layers.push_back(std::move(layer));
+    }
+
+    Vec2d dense_weights = state_dict.at("lin.weight");
+    checkShape(dense_weights, 1, hidden_size, "lin.weight");
+    weights.denseWeights = dense_weights[0];
+
+    if(state_dict.contains("lin.bias"))
+    {
+        std::vector<float> dense_bias = state_dict.at("lin.bias");
+        checkSize(dense_bias, 1, "lin.bias");
+        weights.denseBias = dense_bias[0];
+    }
+
+    return weights;
+}
+
+ModelWeights ModelWeights::fromNam(const nlohmann::json &nam_json)
+{
+    const auto architecture_name = nam_json.at("architecture").get<std::string>();
+
+    if(architecture_name != "WaveNet")
+        throw std::runtime_error("Unsupported NAM architecture: " + architecture_name);
+
+    const auto& config = nam_json.at("config");
+
+    if(config.contains("head") && ! config.at("head").is_null())
+        throw std::runtime_error("WaveNet models with a head are not supported");
+
+    ModelWeights weights;
+    weights.architecture.inputSize = 1;
+    weights.architecture.hiddenSize = 0;
+    weights.architecture.numLayers = 0;
+    weights.architecture.skip = false;
+
+    // NAM trains at 48 kHz, older files don't say so
+    weights.sampleRate = 48000.0f;
+
+    if(nam_json.contains("sample_rate") && ! nam_json.at("sample_rate").is_null())
+        weights.sampleRate = nam_json.at("sample_rate").get<float>();
+
+    if(! (weights.sampleRate > 0.0f))
+        throw std::runtime_error("Invalid sample rate");
+
+    const std::vector<float> values = nam_json.at("weights");
+    NamWeightReader reader { values };
+
+    auto& waveNet = weights.waveNet.emplace();
+
+    for (const auto& array_config : config.at("layers"))
+    {
+        WaveNetWeights::LayerArray layerArray;
+        layerArray.inputSize = array_config.at("input_size");
+        layerArray.conditionSize = array_config.at("condition_size");
+        layerArray.headSize = array_config.at("head_size");
+        layerArray.channels = array_config.at("channels");
+        layerArray.kernelSize = array_config.at("kernel_size");
+        layerArray.gated = array_config.value("gated", false);
+        layerArray.activation = parseWaveNetActivation(array_config.at("activation"));
+
+        const bool head_bias = array_config.value("head_bias", false);
+        const std::vector<int> dilations = array_config.at("dilations");
+
+        if(layerArray.inputSize < 1 || layerArray.headSize < 1 || layerArray.channels < 1 || layerArray.kernelSize < 1 || dilations.empty())
+            throw std::runtime_error("Invalid WaveNet layer config");
+
+        // The condition is the input signal itself
+        if(layerArray.conditionSize != 1)
+            throw std::runtime_error("Only WaveNet models conditioned on the input are supported");
+
+        const int channels = layerArray.channels;
+        const int conv_outputs = layerArray.convOutputs();
+
+        layerArray.rechannel = reader.readMatrix(layerArray.inputSize, channels);
+
+        for (const auto dilation : dilations)
+        {
+            if(dilation < 1)
+                throw std::runtime_error("Invalid WaveNet dilation");
+
+            WaveNetWeights::Layer layer;
+            layer.dilation = dilation;
+
+            // The dilated convolution is stored [outputs][inputs][taps]
+            layer.conv.assign((size_t) layerArray.kernelSize, WeightMatrix(channels, conv_outputs));
+
+            for (int o = 0; o < conv_outputs; ++o)
+                for (int i = 0; i < channels; ++i)
+                    for (auto& tap : layer.conv)
+                        tap.row(i)[o] = reader.next();
+
+            layer.convBias = reader.readVector(conv_outputs);
+            layer.inputMixin = reader.readMatrix(layerArray.conditionSize, conv_outputs);
+            layer.oneByOne = reader.readMatrix(channels, channels);
+            layer.oneByOneBias = reader.readVector(channels);
+
+            layerArray.layers.push_back(std::move(layer));
+        }
+
+        layerArray.headRechannel = reader.readMatrix(channels, layerArray.headSize);
+        layerArray.headBias = head_bias ? reader.readVector(layerArray.headSize) : std::vector<float>((size_t) layerArray.headSize, 0.0f);
+
+        waveNet.layerArrays.push_back(std::move(layerArray));
+    }
+
+    waveNet.headScale = reader.next();
+
+    if(reader.position != values.size())
+        throw std::runtime_error("NAM model has more weights than its config needs");
+
+    // Each array continues the residual stream and the head of the one before
+    const auto& arrays = waveNet.layerArrays;
+
+    if(arrays.empty() || arrays.front().inputSize != 1 || arrays.back().headSize != 1)
+        throw std::runtime_error("Only WaveNet models with a single input and output are supported");
+
+    for (size_t a = 1; a < arrays.size(); ++a)
+        if(arrays[a].inputSize != arrays[a - 1].channels || arrays[a].channels != arrays[a - 1].headSize)
+            throw std::runtime_error("WaveNet layer arrays don't fit together");
+
+    return weights;
+}
+
+ModelWeights ModelWeights::fromBinary(const void* data, size_t numBytes)
+{
+    if(numBytes < ModelBinaryFormat::headerSize
+        || std::memcmp(data, ModelBinaryFormat::magic, sizeof(ModelBinaryFormat::magic)) != 0)
+        throw std::runtime_error("Not a NeuralPi binary model");
+
+    BinaryReader reader(data, numBytes);
+
+    const auto version = reader.readUint32(4);
+    if(version > ModelBinaryFormat::version)
+        throw std::runtime_error("Binary model version " + std::to_string(version) + " is not supported");
+
+    reader.position = reader.readUint32(8);
+
+    ModelWeights weights;
+    auto& architecture = weights.architecture;
+
+    const auto unit_type = reader.readUint32(12);
+    if(unit_type > 1)
+        throw std::runtime_error("Unsupported unit_type: " + std::to_string(unit_type));
+
+    architecture.unitType = unit_type == 0 ? RecurrentUnit::LSTM : RecurrentUnit::GRU;
+    architecture.inputSize = (int) reader.readUint32(16);
+    architecture.hiddenSize = (int) reader.readUint32(20);
+    architecture.numLayers = (int) reader.readUint32(24);
+    architecture.skip = (reader.readUint32(28) & 1) != 0;
+    weights.denseBias = reader.readFloat(32);
+
+    // Files written before the sample rate was stored have zero here
+    if(const auto sampleRate = reader.readFloat(40); sampleRate > 0.0f)
+        weights.sampleRate = sampleRate;
+
+    if(reader.readUint32(36) != numBytes)
+        throw std::runtime_error("Binary model is truncated");
+
+    // The limits only guard the size arithmetic below, the file size check does the rest
+    constexpr int maxDimension = 1 << 16;
+
+    if(architecture.inputSize < 1 || architecture.hiddenSize < 1 || architecture.numLayers < 1
+        || architecture.inputSize > maxDimension || architecture.hiddenSize > maxDimension || architecture.numLayers > maxDimension)
+        throw std::runtime_error("Invalid model header");
+
+    const int hidden_size = architecture.hiddenSize;
+    const int gate_size = architecture.numGates() * hidden_size;
+
+    for (int l = 0; l < architecture.numLayers; ++l)
+    {
+        RecurrentLayer layer;
+        layer.W.numRows = l == 0 ? architecture.inputSize : hidden_size;
+        layer.W.numColumns = gate_size;
+        layer.U.numRows = hidden_size;
+        layer.U.numColumns = gate_size;
+
+        reader.readTensor(layer.W.values, (size_t) layer.W.numRows * (size_t) gate_size);
+        reader.readTensor(layer.U.values, (size_t) layer.U.numRows * (size_t) gate_size);
+        reader.readTensor(layer.bias, (size_t) gate_size);
+
+        if(architecture.unitType == RecurrentUnit::GRU)
+            reader.readTensor(layer.hiddenBias, (size_t) gate_size);
+
+        weights.layers.push_back(std::move(layer));
+    }
+
+    reader.readTensor(weights.denseWeights, (size_t) hidden_size);
+
+    return weights;
+}
+
+std::vector<char> ModelWeights::toBinary() const
+{
+    if(waveNet.has_value())
+        throw std::runtime_error("WaveNet models can't be stored in the binary format");
+
+    BinaryWriter writer;
+
+    writer.data.assign(ModelBinaryFormat::magic, ModelBinaryFormat::magic + sizeof(ModelBinaryFormat::magic));
+    writer.writeUint32(ModelBinaryFormat::version);
+    writer.writeUint32((uint32_t) ModelBinaryFormat::headerSize);
+    writer.writeUint32(architecture.unitType == RecurrentUnit::LSTM ? 0 : 1);
+    writer.writeUint32((uint32_t) architecture.inputSize);
+    writer.writeUint32((uint32_t) architecture.hiddenSize);
+    writer.writeUint32((uint32_t) architecture.numLayers);
+    writer.writeUint32(architecture.skip ? 1 : 0);
+    writer.writeFloat(denseBias);
+    writer.writeUint32(0); // total size, patched below
+    writer.writeFloat(sampleRate);
+    writer.padTo(ModelBinaryFormat::headerSize);
+
+    for (const auto& layer : layers)
+    {
+        writer.writeTensor(layer.W.values);
+        writer.writeTensor(layer.U.values);
+        writer.writeTensor(layer.bias);
+
+        if(architecture.unitType == RecurrentUnit::GRU)
+            writer.writeTensor(layer.hiddenBias);
+    }
+
+    writer.writeTensor(denseWeights);
+
+    BinaryWriter totalSize;
+    totalSize.writeUint32((uint32_t) writer.data.size());
+    std::copy(totalSize.data.begin(), totalSize.data.end(), writer.data.begin() + 36);
+
+    return std::move(writer.data);
+}
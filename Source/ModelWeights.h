@@ -0,0 +1,230 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+using Vec2d = std::vector<std::vector<float>>;
+
+enum class RecurrentUnit {
+    LSTM,
+    GRU
+};
+
+struct ModelArchitecture
+{
+    RecurrentUnit unitType = RecurrentUnit::LSTM;
+    int inputSize = 1;
+    int hiddenSize = 20;
+    int numLayers = 1;
+    bool skip = true;
+
+    int numGates() const { return unitType == RecurrentUnit::LSTM ? 4 : 3; }
+
+    bool operator==(const ModelArchitecture& other) const
+    {
+        return unitType == other.unitType && inputSize == other.inputSize && hiddenSize == other.hiddenSize
+            && numLayers == other.numLayers && skip == other.skip;
+    }
+
+    bool operator!=(const ModelArchitecture& other) const { return ! (*this == other); }
+};
+
+/** Row-major matrix with contiguous storage */
+struct WeightMatrix
+{
+    WeightMatrix() = default;
+    WeightMatrix(int rows, int columns) : numRows(rows), numColumns(columns), values((size_t) (rows * columns), 0.0f) {}
+
+    float* row(int r) { return values.data() + (size_t) r * (size_t) numColumns; }
+    const float* row(int r) const { return values.data() + (size_t) r * (size_t) numColumns; }
+
+    Vec2d toVec2d() const;
+
+    int numRows = 0;
+    int numColumns = 0;
+    std::vector<float> values;
+};
+
+/** Activation of the dilated convolutions of a WaveNet layer array */
+enum class WaveNetActivation {
+    Tanh,
+    FastTanh,
+    HardTanh,
+    ReLU,
+    Sigmoid
+};
+
+/**
+    The weights of a Neural Amp Modeler (NAM) WaveNet: a chain of layer
+    arrays, each a stack of dilated causal convolutions with a residual
+    connection and a skip ("head") output.
+
+    Matrices are stored [inputs][outputs], transposed from NAM's order, so a
+    matrix-vector product is a sum of scaled rows. Missing biases are zero.
+*/
+struct WaveNetWeights
+{
+    struct Layer
+    {
+        int dilation = 1;
+        std::vector<WeightMatrix> conv;     // one [channels][convOutputs] matrix per kernel tap, oldest first
+        std::vector<float> convBias;        // [convOutputs]
+        WeightMatrix inputMixin;            // [conditionSize][convOutputs]
+        WeightMatrix oneByOne;              // [channels][channels]
+        std::vector<float> oneByOneBias;    // [channels]
+    };
+
+    struct LayerArray
+    {
+        int inputSize = 1;
+        int conditionSize = 1;
+        int headSize = 1;
+        int channels = 1;
+        int kernelSize = 1;
+        bool gated = false;
+        WaveNetActivation activation = WaveNetActivation::Tanh;
+
+        /** Gated layers compute the activation and its sigmoid gate */
+        int convOutputs() const { return gated ? 2 * channels : channels; }
+
+        WeightMatrix rechannel;             // [inputSize][channels]
+        std::vector<Layer> layers;
+        WeightMatrix headRechannel;         // [channels][headSize]
+        std::vector<float> headBias;        // [headSize]
+    };
+
+    std::vector<LayerArray> layerArrays;
+    float headScale = 1.0f;
+
+    /** Number of past input samples that affect the current output */
+    int getReceptiveField() const;
+};
+
+/**
+    The weights of a recurrent (LSTM or GRU) model followed by a Dense layer
+    with a single output, independent of the file format they came from.
+
+    Tensors are stored the way RTNeural's layer setters expect them:
+    W is [layer inputs][gates * hidden], U is [hidden][gates * hidden].
+    LSTM gates are in input, forget, cell, output order with the input and
+    hidden biases summed into bias. GRU gates are in update, reset, candidate
+    order, and keep the hidden bias separate because the candidate gate
+    applies the reset gate after adding it.
+*/
+struct ModelWeights
+{
+    /** A factorisation U = P * Q of rank P.numColumns, with P [hidden][rank] and
+        Q [rank][gates * hidden], set by ModelCompressor
+    */
+    struct LowRankMatrix
+    {
+        WeightMatrix P;
+        WeightMatrix Q;
+    };
+
+    struct RecurrentLayer
+    {
+        WeightMatrix W;
+        WeightMatrix U;
+        std::vector<float> bias;
+        std::vector<float> hiddenBias; // GRU only
+
+        /** Kernels that can use it compute U * h through the factors. U always
+            holds the product, so the others get the same result.
+        */
+        std::optional<LowRankMatrix> lowRankU;
+    };
+
+    /** Parses a NeuralPi/Proteus (Automated-GuitarAmpModelling) json model.
+        Throws std::runtime_error if the model is malformed or unsupported.
+    */
+    static ModelWeights fromJson(const nlohmann::json& weights_json);
+
+    /** Parses a Neural Amp Modeler .nam model. Only the WaveNet architecture
+        is supported; throws std::runtime_error for anything else.
+    */
+    static ModelWeights fromNam(const nlohmann::json& nam_json);
+
+    /** Reads a NeuralPi binary model (see ModelBinaryFormat), typically from a
+        memory-mapped file. The data does not need to be aligned.
+        Throws std::runtime_error if the data is truncated or of a newer version.
+    */
+    static ModelWeights fromBinary(const void* data, size_t numBytes);
+
+    /** Serialises the weights in the NeuralPi binary model format. WaveNet
+        models can't be stored in it, and throw std::runtime_error. Low-rank
+        factors aren't stored, only their product in U.
+    */
+    std::vector<char> toBinary() const;
+
+    /** Memory used by the weight tensors */
+    size_t getNumBytes() const;
+
+    /** True if morph() can interpolate between the two models: recurrent models
+        with the same architecture, trained at the same sample rate
+    */
+    static bool canMorph(const ModelWeights& a, const ModelWeights& b);
+
+    /** Interpolates every weight and bias linearly, amount 0 giving a and 1 giving b.
+        Throws std::runtime_error if canMorph() is false.
+    */
+    static ModelWeights morph(const ModelWeights& a, const ModelWeights& b, float amount);
+
+    /** All NeuralPi and Proteus models are trained on 44.1 kHz audio */
+    static constexpr float defaultSampleRate = 44100.0f;
+
+    ModelArchitecture architecture;
+    std::vector<RecurrentLayer> layers;
+    std::vector<float> denseWeights;
+    float denseBias = 0.0f;
+
+    /** The rate of the training data, from the "sample_rate" or "samplerate"
+        metadata if the model has it
+    */
+    float sampleRate = defaultSampleRate;
+
+    /** Set for WaveNet models, which have no recurrent or dense layers.
+        Their architecture has a single input and no layers.
+    */
+    std::optional<WaveNetWeights> waveNet;
+};
+
+/**
+    NeuralPi binary model (.npb), version 1.
+
+    Everything is little-endian. The file starts with a 64 byte header:
+
+        offset  type        field
+        0       char[4]     magic "NPBM"
+        4       uint32      format version
+        8       uint32      header size (64)
+        12      uint32      unit type (0 = LSTM, 1 = GRU)
+        16      uint32      input size
+        20      uint32      hidden size
+        24      uint32      number of layers
+        28      uint32      flags (bit 0: skip connection)
+        32      float32     dense bias
+        36      uint32      total file size in bytes
+        40      float32     training sample rate (0 = 44100, in older files)
+        44      -           reserved, zero
+
+    followed by the float32 tensors of ModelWeights, already transposed and
+    bias-fused, each one starting on a 64 byte boundary:
+
+        for each layer: W, U, bias, hiddenBias (GRU only)
+        dense weights
+
+    Tensor shapes follow from the header, so there is no per-tensor metadata.
+*/
+namespace ModelBinaryFormat
+{
+    constexpr char magic[4] = { 'N', 'P', 'B', 'M' };
+    constexpr uint32_t version = 1;
+    constexpr size_t headerSize = 64;
+    constexpr size_t tensorAlignment = 64;
+    constexpr const char* fileExtension = ".npb";
+}
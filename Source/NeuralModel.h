@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+    Type-erased interface to a loaded neural network.
+
+    NeuralNetwork only instantiates the architecture that was actually loaded,
+    and dispatches through this interface once per block rather than once per
+    sample.
+*/
+class NeuralModel
+{
+public:
+    virtual ~NeuralModel() = default;
+
+    virtual void reset() = 0;
+
+    /** Processes a block of samples. The conditioning parameters move linearly
+        from paramsStart to paramsEnd over the block; models without
+        conditioning inputs ignore them. inData and outData may be the same.
+    */
+    virtual void process(const float* inData, const float* paramsStart, const float* paramsEnd, float* outData, int numSamples) = 0;
+
+    /** Size in bytes of the recurrent state, or 0 if it can't be snapshotted */
+    virtual size_t getStateSize() const { return 0; }
+
+    /** Copy the recurrent state to or from a buffer of getStateSize() bytes */
+    virtual void saveState(void* /*dest*/) const {}
+    virtual void restoreState(const void* /*source*/) {}
+
+    /** Number of signals processStreams() runs in lock-step, each with its own
+        state (see ModelOptions::numStreams). For these models process() feeds
+        its input to every stream and returns the first one.
+    */
+    virtual int getNumStreams() const { return 1; }
+
+    /** Processes getNumStreams() channels, which share the conditioning parameters.
+        Each inData[i] may be the same as outData[i].
+    */
+    virtual void processStreams(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numSamples)
+    {
+        process(inData[0], paramsStart, paramsEnd, outData[0], numSamples);
+    }
+};
+
+template <typename ModelType>
+class NeuralModelT : public NeuralModel
+{
+public:
+    void reset() override
+    {
+        model.reset();
+    }
+
+    void process(const float* inData, const float* paramsStart, const float* paramsEnd, float* outData, int numSamples) override
+    {
+        model.process(inData, paramsStart, paramsEnd, outData, numSamples);
+    }
+
+    size_t getStateSize() const override
+    {
+        return model.getStateSize();
+    }
+
+    void saveState(void* dest) const override
+    {
+        model.saveState(dest);
+    }
+
+    void restoreState(const void* source) override
+    {
+        model.restoreState(source);
+    }
+
+    ModelType model;
+};
+
+/** NeuralModelT for kernels that process several streams, like BatchedLSTM */
+template <typename ModelType>
+class MultiStreamModelT : public NeuralModelT<ModelType>
+{
+public:
+    int getNumStreams() const override
+    {
+        return ModelType::getNumStreams();
+    }
+
+    void processStreams(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numSamples) override
+    {
+        this->model.process(inData, paramsStart, paramsEnd, outData, numSamples);
+    }
+};
@@ -1,196 +1,790 @@
 #include "NeuralNetwork.h"
 
-using Vec2d = std::vector<std::vector<float>>;
+#include "ModelCompressor.h"
+#include "ModelStore.h"
 
-Vec2d transpose(const Vec2d& x)
+#include <chowdsp_dsp_utils/chowdsp_dsp_utils.h>
+
+#include <list>
+
+struct LoadedModel
 {
-    auto outer_size = x.size();
-    auto inner_size = x[0].size();
-    Vec2d y(inner_size, std::vector<float>(outer_size, 0.0f));
+    using Resampler = chowdsp::ResampledProcess<chowdsp::ResamplingTypes::LanczosResampler<>>;
 
-    for (size_t i = 0; i < outer_size; ++i)
+    // Allocates, so this is called on the loader thread, or from NeuralNetwork::prepare
+    void prepare(double hostSampleRate, int maximumBlockSize)
     {
-        for (size_t j = 0; j < inner_size; ++j)
-            y[j][i] = x[i][j];
+        const auto modelSampleRate = (double) weights->sampleRate;
+        resampling = options.nativeSampleRate && std::abs(hostSampleRate - modelSampleRate) >= 0.5;
+        latencySamples = 0;
+        numStreams = model->getNumStreams();
+        streamBuffer.setSize(numStreams, maximumBlockSize);
+
+        if(! resampling)
+            return;
+
+        const juce::dsp::ProcessSpec spec { hostSampleRate, (juce::uint32) maximumBlockSize, (juce::uint32) numStreams };
+        resampler.prepareWithTargetSampleRate(spec, modelSampleRate);
+        latencySamples = measureLatency(spec, modelSampleRate);
     }
 
-    return y;
-}
+    void reset()
+    {
+        model->reset();
 
-template <typename T1>
-void set_weights_NeuralPi(T1 model, const nlohmann::json &weights_json)
-{
-    // Initialize the correct model
-    auto& lstm = (*model).template get<0>();
-    auto& dense = (*model).template get<1>();
+        if(resampling)
+            resampler.reset();
+    }
 
-    Vec2d lstm_weights_ih = weights_json["/state_dict/rec.weight_ih_l0"_json_pointer];
-    lstm.setWVals(transpose(lstm_weights_ih));
+    // Every channel goes through its own stream of the model. A model for another number
+    // of channels, which is only heard while it's crossfaded in or out, runs the first
+    // channel through all of its streams, and the other channels get copies of the output.
+    void process(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numChannels, int numSamples)
+    {
+        if(numChannels == numStreams)
+        {
+            processStreams(inData, paramsStart, paramsEnd, outData, numSamples);
+            return;
+        }
 
-    Vec2d lstm_weights_hh = weights_json["/state_dict/rec.weight_hh_l0"_json_pointer];
-    lstm.setUVals(transpose(lstm_weights_hh));
+        for (int stream = 0; stream < numStreams; ++stream)
+            streamBuffer.copyFrom(stream, 0, inData[0], numSamples);
 
-    std::vector<float> lstm_bias_ih = weights_json["/state_dict/rec.bias_ih_l0"_json_pointer];
-    std::vector<float> lstm_bias_hh = weights_json["/state_dict/rec.bias_hh_l0"_json_pointer];
-    for (int i = 0; i < 80; ++i)
-        lstm_bias_hh[i] += lstm_bias_ih[i];
-    lstm.setBVals(lstm_bias_hh);
+        auto* const* streams = streamBuffer.getArrayOfWritePointers();
+        processStreams(streams, paramsStart, paramsEnd, streams, numSamples);
 
-    Vec2d dense_weights = weights_json["/state_dict/lin.weight"_json_pointer];
-    dense.setWeights(dense_weights);
+        for (int channel = 0; channel < numChannels; ++channel)
+            juce::FloatVectorOperations::copy(outData[channel], streams[juce::jmin(channel, numStreams - 1)], numSamples);
+    }
 
-    std::vector<float> dense_bias = weights_json["/state_dict/lin.bias"_json_pointer];
-    dense.setBias(dense_bias.data());
-}
+    void process(const float* inData, const float* paramsStart, const float* paramsEnd, float* outData, int numSamples)
+    {
+        process(&inData, paramsStart, paramsEnd, &outData, 1, numSamples);
+    }
 
-template <typename T1>
-void set_weights_Proteus(T1 model, const nlohmann::json &weights_json)
-{
-    // Initialize the correct model
-    auto& lstm = (*model).template get<0>();
-    auto& dense = (*model).template get<1>();
+    // A step of a morph between the same two models, which can take over this one's
+    // recurrent state instead of being warmed up and crossfaded in. Models without
+    // state snapshots (see NeuralModel::getStateSize()) never can.
+    bool continuesMorph(const LoadedModel& other) const
+    {
+        return morphSources[0] != nullptr && morphSources[0] == other.morphSources[0] && morphSources[1] == other.morphSources[1]
+            && options == other.options && numStreams == other.numStreams
+            && model->getStateSize() > 0 && stateTransfer.size() == model->getStateSize()
+            && other.model->getStateSize() == model->getStateSize();
+    }
 
-    Vec2d lstm_weights_ih = weights_json["/state_dict/rec.weight_ih_l0"_json_pointer];
-    lstm.setWVals(transpose(lstm_weights_ih));
+    std::shared_ptr<const ModelWeights> weights;
+    std::unique_ptr<NeuralModel> model;
+    int inputSize = 1;
+    int numStreams = 1;
+    ModelOptions options;
 
-    Vec2d lstm_weights_hh = weights_json["/state_dict/rec.weight_hh_l0"_json_pointer];
-    lstm.setUVals(transpose(lstm_weights_hh));
+    // The two models this one was morphed from, if it was
+    std::shared_ptr<const ModelWeights> morphSources[2];
 
-    std::vector<float> lstm_bias_ih = weights_json["/state_dict/rec.bias_ih_l0"_json_pointer];
-    std::vector<float> lstm_bias_hh = weights_json["/state_dict/rec.bias_hh_l0"_json_pointer];
-    for (int i = 0; i < 160; ++i)
-        lstm_bias_hh[i] += lstm_bias_ih[i];
-    lstm.setBVals(lstm_bias_hh);
+    // Room for the recurrent state, allocated here so the audio thread can hand it over
+    std::vector<char> stateTransfer;
 
-    Vec2d dense_weights = weights_json["/state_dict/lin.weight"_json_pointer];
-    dense.setWeights(dense_weights);
+    // Delay added by the resampler, in samples at the host rate
+    int latencySamples = 0;
 
-    std::vector<float> dense_bias = weights_json["/state_dict/lin.bias"_json_pointer];
-    dense.setBias(dense_bias.data());
-}
+private:
+    // Models that aren't conditioned on the gain get it as a gain ramp on their input, and
+    // models that aren't conditioned on the master get it on their output, so each model
+    // of a crossfade gets the level it would have on its own
+    void processStreams(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numSamples)
+    {
+        const float* input[NeuralNetwork::maxChannels];
+        std::copy(inData, inData + numStreams, input);
 
-void NeuralNetwork::load_json(const juce::String &filename)
-{
-    // Read in the JSON file
-    std::ifstream i2(filename.toUTF8());
-	nlohmann::json weights_json;
-	i2 >> weights_json;
+        if(inputSize == 1)
+        {
+            for (int stream = 0; stream < numStreams; ++stream)
+            {
+                applyGainRamp(inData[stream], outData[stream], paramsStart[0], paramsEnd[0], numSamples);
+                input[stream] = outData[stream];
+            }
+        }
+
+        processModel(input, paramsStart, paramsEnd, outData, numSamples);
+
+        // The master has twice the range for unconditioned models, mainly for clean ones
+        if(inputSize < 3)
+            for (int stream = 0; stream < numStreams; ++stream)
+                applyGainRamp(outData[stream], outData[stream], paramsStart[1] * 2.0f, paramsEnd[1] * 2.0f, numSamples);
+    }
+
+    static void applyGainRamp(const float* inData, float* outData, float start, float end, int numSamples)
+    {
+        const auto increment = (end - start) / (float) numSamples;
+
+        if(increment == 0.0f)
+            juce::FloatVectorOperations::multiply(outData, inData, start, numSamples);
+        else
+            for (int i = 0; i < numSamples; ++i)
+                outData[i] = inData[i] * (start + increment * (float) i);
+    }
+
+    void processModel(const float* const* input, const float* paramsStart, const float* paramsEnd, float* const* outData, int numSamples)
+    {
+        if(! resampling)
+        {
+            model->processStreams(input, paramsStart, paramsEnd, outData, numSamples);
+            return;
+        }
+
+        // The conditioning ramp covers the same time span at the model's rate
+        const juce::dsp::AudioBlock<const float> inputBlock(input, (size_t) numStreams, (size_t) numSamples);
+        juce::dsp::AudioBlock<float> outputBlock(outData, (size_t) numStreams, (size_t) numSamples);
 
-    // Get the input size of the JSON file
-	input_size = weights_json["/model_data/input_size"_json_pointer];
+        auto resampled = resampler.processIn(inputBlock);
+        float* data[NeuralNetwork::maxChannels];
 
-    int hidden_size = weights_json["/model_data/hidden_size"_json_pointer];
+        for (int stream = 0; stream < numStreams; ++stream)
+            data[stream] = resampled.getChannelPointer((size_t) stream);
+
+        model->processStreams(data, paramsStart, paramsEnd, data, (int) resampled.getNumSamples());
+        resampler.processOut(resampled, outputBlock);
+    }
 
-    if(hidden_size == 20)
+    // Sends an impulse through the round trip. The Lanczos kernel is
+    // symmetric, so the peak of the response is where the impulse went.
+    static int measureLatency(const juce::dsp::ProcessSpec& spec, double modelSampleRate)
     {
-        type = NeuralNetworkType::NeuralPi;
-        
-        // Load the appropriate model
-        if (input_size == 1) {
-            set_weights_NeuralPi(&model, weights_json);
+        Resampler probe;
+        probe.prepareWithTargetSampleRate(spec, modelSampleRate);
+
+        const auto blockSize = (int) spec.maximumBlockSize;
+        std::vector<float> buffer((size_t) blockSize);
+        auto* data = buffer.data();
+
+        int peakPosition = 0;
+        float peak = 0.0f;
+
+        for (int position = 0; position < latencyProbeLength; position += blockSize)
+        {
+            std::fill(buffer.begin(), buffer.end(), 0.0f);
+
+            if(position == 0)
+                buffer[0] = 1.0f;
+
+            juce::dsp::AudioBlock<float> block(&data, 1, (size_t) blockSize);
+            const auto resampled = probe.processIn(block);
+            probe.processOut(resampled, block);
+
+            for (int i = 0; i < blockSize; ++i)
+            {
+                if(std::abs(buffer[(size_t) i]) > peak)
+                {
+                    peak = std::abs(buffer[(size_t) i]);
+                    peakPosition = position + i;
+                }
+            }
         }
-        else if (input_size == 2) {
-            set_weights_NeuralPi(&model_cond1, weights_json);
-        } 
-        else if (input_size == 3) {
-            set_weights_NeuralPi(&model_cond2, weights_json);
+
+        return peakPosition;
+    }
+
+    static constexpr int latencyProbeLength = 4096;
+
+    Resampler resampler;
+    bool resampling = false;
+
+    // The streams of a model for another number of channels
+    juce::AudioBuffer<float> streamBuffer;
+};
+
+// Loads models on the background thread, and warms them up by running the
+// most recent input through them, so that a freshly loaded LSTM doesn't start
+// from a zero state in the middle of a note.
+//
+// Models that were used recently don't need a warm-up: when a model is
+// switched out its recurrent state is kept, and copied back in when the same
+// weights are loaded again, so A/B switching between tones is instant.
+//
+// Everything except recordInput runs on the message queue's thread, one
+// command at a time.
+class NeuralModelFactory
+{
+public:
+    // Called on the audio thread. If the loader is copying the history right
+    // now this block is simply not recorded.
+    void recordInput(const float* inData, const float* params, int numSamples) noexcept
+    {
+        const juce::SpinLock::ScopedTryLockType lock(historyMutex);
+
+        if(! lock.isLocked() || history.empty())
+            return;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            history[historyPosition] = inData[i];
+
+            if(++historyPosition == history.size())
+                historyPosition = 0;
         }
+
+        historyParams[0] = params[0];
+        historyParams[1] = params[1];
+    }
+
+    void prepare(double sampleRate, int maximumBlockSize)
+    {
+        std::vector<float> newHistory((size_t) (sampleRate * warmUpSeconds), 0.0f);
+
+        const juce::SpinLock::ScopedLockType lock(historyMutex);
+        history.swap(newHistory);
+        historyPosition = 0;
+        hostSampleRate = sampleRate;
+        maxBlockSize = maximumBlockSize;
     }
-    else if(hidden_size == 40)
+
+    void loadModel(const juce::String &filename, const ModelOptions& options)
     {
-        type = NeuralNetworkType::Proteus;
+        try {
+            // Shared with other instances, and only read from disk if it isn't cached
+            const auto weights = getCompressed(ModelStore::getInstance().getWeights(juce::File(filename)), options.maxCompressionESR);
+            auto newModel = createModel(weights, options);
+
+            if(! restoreSnapshot(*newModel))
+                warmUp(*newModel);
 
-        // Load the appropriate model
-        if (input_size == 1) {
-            set_weights_Proteus(&model_proteus, weights_json);
+            model.set(std::move(newModel));
+            lastMorph = {};
         }
-        else if (input_size == 2) {
-            set_weights_Proteus(&model_proteus_cond1, weights_json);
-        } 
-        else if (input_size == 3) {
-            set_weights_Proteus(&model_proteus_cond2, weights_json);
+        catch (const std::exception& e) {
+            DBG("Unable to load config file: " + filename);
+            std::cout << e.what();
         }
     }
-}
 
-void NeuralNetwork::loadConfig(const juce::String &filename)
-{
-    if(filename.toLowerCase().endsWith(".json"))
+    // Publishes models with weights interpolated between two others. The first one is
+    // warmed up and crossfaded in like any other model; when the amount changes after
+    // that, it moves there in steps of at most maxMorphStep, each published once the
+    // audio thread has taken the previous one and at most every morphIntervalMs. The
+    // audio thread swaps the steps in with the running state, so they need neither a
+    // warm-up nor a crossfade, unless the model has no state snapshots. Returns early
+    // when isSuperseded() becomes true.
+    // The steps aren't worth compressing, each one only runs for a moment.
+    template <typename IsSuperseded>
+    void morphModel(const juce::String& filenameA, const juce::String& filenameB, float amount, const ModelOptions& options, IsSuperseded&& isSuperseded)
     {
-        load_json(filename);
+        try {
+            auto& store = ModelStore::getInstance();
+            const auto weightsA = store.getWeights(juce::File(filenameA));
+            const auto weightsB = store.getWeights(juce::File(filenameB));
+
+            if(! ModelWeights::canMorph(*weightsA, *weightsB))
+            {
+                DBG("Unable to morph " + filenameA + " and " + filenameB + ", loading the nearer one");
+                loadModel(amount < 0.5f ? filenameA : filenameB, options);
+                return;
+            }
+
+            bool continuing = lastMorph.sources[0] == weightsA && lastMorph.sources[1] == weightsB && lastMorph.options == options;
+            float currentAmount = continuing ? lastMorph.amount : amount;
+
+            do
+            {
+                if(continuing && ! waitForMorphStep(isSuperseded))
+                {
+                    if(isSuperseded())
+                        return;
+
+                    // The audio thread isn't taking models, so the next one starts afresh
+                    continuing = false;
+                    currentAmount = amount;
+                }
+
+                if(continuing)
+                    currentAmount += juce::jlimit(-maxMorphStep, maxMorphStep, amount - currentAmount);
+
+                const auto weights = std::make_shared<const ModelWeights>(ModelWeights::morph(*weightsA, *weightsB, currentAmount));
+                auto newModel = createModel(weights, options);
+                newModel->morphSources[0] = weightsA;
+                newModel->morphSources[1] = weightsB;
+                newModel->stateTransfer.resize(newModel->model->getStateSize());
+
+                // Without the running state the step is crossfaded in like a new model
+                if(! continuing || newModel->model->getStateSize() == 0)
+                    warmUp(*newModel);
+
+                model.set(std::move(newModel));
+                lastMorph = { { weightsA, weightsB }, options, currentAmount };
+                lastMorphTime = juce::Time::getMillisecondCounter();
+                continuing = true;
+            }
+            while(currentAmount != amount);
+        }
+        catch (const std::exception& e) {
+            DBG("Unable to morph config files: " + filenameA + ", " + filenameB);
+            std::cout << e.what();
+        }
     }
-}
 
+    // Returns the most recently loaded model, or nullptr
+    std::unique_ptr<LoadedModel> getModel() { return model.get(); }
 
-void NeuralNetwork::reset()
-{
-    if(type == NeuralNetworkType::NeuralPi)
+    // Takes a snapshot of a model that has been switched out, before it's destroyed.
+    // Morphed weights are never loaded again, so their state isn't kept.
+    void retireModel(std::unique_ptr<LoadedModel> oldModel)
     {
-        model.reset();
-        model_cond1.reset();
-        model_cond2.reset();
+        if(oldModel == nullptr || oldModel->model->getStateSize() == 0 || oldModel->morphSources[0] != nullptr)
+            return;
+
+        auto it = findSnapshot(*oldModel);
+
+        if(it == snapshots.end())
+        {
+            snapshots.push_front({ oldModel->weights, oldModel->options, {} });
+
+            if(snapshots.size() > maxSnapshots)
+                snapshots.pop_back();
+        }
+        else
+        {
+            snapshots.splice(snapshots.begin(), snapshots, it);
+        }
+
+        auto& state = snapshots.front().state;
+        state.resize(oldModel->model->getStateSize());
+        oldModel->model->saveState(state.data());
     }
-    else if(type == NeuralNetworkType::Proteus)
+
+private:
+    // Only the architecture that was loaded is instantiated
+    std::unique_ptr<LoadedModel> createModel(std::shared_ptr<const ModelWeights> weights, const ModelOptions& options)
     {
-        model_proteus.reset();
-        model_proteus_cond1.reset();
-        model_proteus_cond2.reset();
+        auto newModel = std::make_unique<LoadedModel>();
+        newModel->model = ModelRegistry::createModel(*weights, options);
+        newModel->inputSize = weights->architecture.inputSize;
+        newModel->options = options;
+        newModel->weights = std::move(weights);
+
+        double sampleRate;
+        int blockSize;
+
+        {
+            const juce::SpinLock::ScopedLockType lock(historyMutex);
+            sampleRate = hostSampleRate;
+            blockSize = maxBlockSize;
+        }
+
+        newModel->prepare(sampleRate, blockSize);
+        return newModel;
     }
-}
 
-void NeuralNetwork::process(const float* inData, float param1, float param2, float* outData, int numSamples)
-{
-    if(input_size == 1)
+    // Returns the compressed weights if a compression budget is set. They're kept for
+    // as long as the source weights are loaded, so reloading a model finds the same
+    // pointer and its snapshot.
+    std::shared_ptr<const ModelWeights> getCompressed(std::shared_ptr<const ModelWeights> source, float maxESR)
     {
-        if(type == NeuralNetworkType::NeuralPi)
+        if(maxESR <= 0.0f)
+            return source;
+
+        auto it = std::find_if(compressedModels.begin(), compressedModels.end(), [&] (const CompressedModel& c)
         {
-            for (int i = 0; i < numSamples; ++i)
-                outData[i] = model.forward(inData + i) + inData[i];
+            return c.source == source && c.maxESR == maxESR;
+        });
+
+        if(it == compressedModels.end())
+        {
+            auto result = ModelCompressor::compress(*source, (double) maxESR);
+
+            DBG("Compressed to hidden size " + juce::String(result.hiddenSize) + ", rank " + juce::String(result.rank)
+                + ", ESR " + juce::String(result.esr));
+
+            compressedModels.push_front({ source, maxESR, std::make_shared<const ModelWeights>(std::move(result.weights)) });
+
+            if(compressedModels.size() > maxCompressedModels)
+                compressedModels.pop_back();
         }
-        else if(type == NeuralNetworkType::Proteus)
+        else
         {
-            for (int i = 0; i < numSamples; ++i)
-                outData[i] = model_proteus.forward(inData + i) + inData[i];
+            compressedModels.splice(compressedModels.begin(), compressedModels, it);
         }
+
+        return compressedModels.front().compressed;
     }
-    else if(input_size == 2)
+
+    // Waits until the previous step of a morph has been taken by the audio thread, and
+    // morphIntervalMs have passed since it was published. Gives up after maxMorphWaitMs.
+    template <typename IsSuperseded>
+    bool waitForMorphStep(IsSuperseded&& isSuperseded)
     {
-        if(type == NeuralNetworkType::NeuralPi)
+        const auto start = juce::Time::getMillisecondCounter();
+
+        while(model.isPending() || juce::Time::getMillisecondCounter() - lastMorphTime < morphIntervalMs)
         {
-            for (int i = 0; i < numSamples; ++i) {
-                inArray1[0] = inData[i];
-                inArray1[1] = param1;
-                outData[i] = model_cond1.forward(inArray1) + inData[i];
-            }
+            if(isSuperseded() || juce::Time::getMillisecondCounter() - start > maxMorphWaitMs)
+                return false;
+
+            juce::Thread::sleep(2);
         }
-        else if(type == NeuralNetworkType::Proteus)
+
+        return true;
+    }
+
+    struct Snapshot
+    {
+        // Keeps the weights alive, so the pointer identifies them for as long as the snapshot exists
+        std::shared_ptr<const ModelWeights> weights;
+        ModelOptions options;
+        std::vector<char> state;
+    };
+
+    // The state of a quantised model isn't interchangeable with the float one,
+    // and models with other activations or sample rates have drifted apart
+    std::list<Snapshot>::iterator findSnapshot(const LoadedModel& loadedModel)
+    {
+        return std::find_if(snapshots.begin(), snapshots.end(), [&] (const Snapshot& s)
         {
-            for (int i = 0; i < numSamples; ++i) {
-                inArray1[0] = inData[i];
-                inArray1[1] = param1;
-                outData[i] = model_proteus_cond1.forward(inArray1) + inData[i];
-            }
+            return s.weights == loadedModel.weights && s.options == loadedModel.options;
+        });
+    }
+
+    bool restoreSnapshot(LoadedModel& newModel)
+    {
+        const auto it = findSnapshot(newModel);
+
+        if(it == snapshots.end() || it->state.size() != newModel.model->getStateSize())
+            return false;
+
+        newModel.model->restoreState(it->state.data());
+        return true;
+    }
+
+    void warmUp(LoadedModel& newModel)
+    {
+        std::vector<float> input;
+        size_t position;
+        float params[2];
+        int blockSize;
+
+        {
+            const juce::SpinLock::ScopedLockType lock(historyMutex);
+            input = history;
+            position = historyPosition;
+            params[0] = historyParams[0];
+            params[1] = historyParams[1];
+            blockSize = maxBlockSize;
+        }
+
+        newModel.reset();
+
+        if(input.empty())
+            return;
+
+        std::rotate(input.begin(), input.begin() + (std::ptrdiff_t) position, input.end());
+
+        // The resampler can't take more than a block at a time
+        for (size_t start = 0; start < input.size(); start += (size_t) blockSize)
+        {
+            const auto numSamples = (int) std::min((size_t) blockSize, input.size() - start);
+            newModel.process(input.data() + start, params, params, input.data() + start, numSamples);
         }
     }
-    else if(input_size == 3)
+
+    static constexpr double warmUpSeconds = 0.3;
+    static constexpr size_t maxSnapshots = 8;
+    static constexpr size_t maxCompressedModels = 8;
+
+    // A sweep across the whole morph takes 20 steps, 0.4s at the fastest
+    static constexpr float maxMorphStep = 0.05f;
+    static constexpr juce::uint32 morphIntervalMs = 20;
+    static constexpr juce::uint32 maxMorphWaitMs = 500;
+
+    std::vector<float> history;
+    size_t historyPosition = 0;
+    float historyParams[2] = { 0.0f, 0.0f };
+    double hostSampleRate = 44100.0;
+    int maxBlockSize = 512;
+    juce::SpinLock historyMutex;
+
+    // Most recently switched out first
+    std::list<Snapshot> snapshots;
+
+    struct CompressedModel
+    {
+        std::shared_ptr<const ModelWeights> source;
+        float maxESR;
+        std::shared_ptr<const ModelWeights> compressed;
+    };
+
+    // Most recently used first
+    std::list<CompressedModel> compressedModels;
+
+    // The most recently published step of a morph
+    struct MorphStep
     {
-        if(type == NeuralNetworkType::NeuralPi)
+        std::shared_ptr<const ModelWeights> sources[2];
+        ModelOptions options;
+        float amount = 0.0f;
+    };
+
+    MorphStep lastMorph;
+    juce::uint32 lastMorphTime = 0;
+
+    TryLockedPtr<LoadedModel> model;
+};
+
+// The neural network counterpart of CabSimEngineQueue: a destination for
+// models which are loaded on the background thread.
+class NeuralModelQueue final : public std::enable_shared_from_this<NeuralModelQueue>
+{
+public:
+    explicit NeuralModelQueue(BackgroundMessageQueue& queue)
+        : messageQueue(queue) {}
+
+    // Safe to call from any thread. Only the most recent request is loaded,
+    // so sweeping the model knob doesn't load every model on the way.
+    void loadModel(const juce::String &filename, const ModelOptions& options)
+    {
+        const auto request = ++latestRequest;
+
+        callLater([filename, options, request] (NeuralModelQueue& q)
         {
-            for (int i = 0; i < numSamples; ++i) {
-                inArray2[0] = inData[i];
-                inArray2[1] = param1;
-                inArray2[2] = param2;
-                outData[i] = model_cond2.forward(inArray2) + inData[i];
-            }
+            if(request == q.latestRequest.load())
+                q.factory.loadModel(filename, options);
+        });
+    }
+
+    // Like loadModel(), but interpolates the weights of two models
+    void morphModel(const juce::String& filenameA, const juce::String& filenameB, float amount, const ModelOptions& options)
+    {
+        const auto request = ++latestRequest;
+
+        callLater([filenameA, filenameB, amount, options, request] (NeuralModelQueue& q)
+        {
+            const auto isSuperseded = [&q, request] { return request != q.latestRequest.load(); };
+
+            if(! isSuperseded())
+                q.factory.morphModel(filenameA, filenameB, amount, options, isSuperseded);
+        });
+    }
+
+    void prepare(double sampleRate, int maximumBlockSize)
+    {
+        factory.prepare(sampleRate, maximumBlockSize);
+    }
+
+    void recordInput(const float* inData, const float* params, int numSamples) noexcept
+    {
+        factory.recordInput(inData, params, numSamples);
+    }
+
+    // Call this regularly from the audio thread to (re)send the pending load
+    // request. All pushes to the message queue happen on the audio thread.
+    void postPendingCommand()
+    {
+        const juce::SpinLock::ScopedTryLockType lock(pendingMutex);
+
+        if(! lock.isLocked() || pendingCommand == nullptr)
+            return;
+
+        if(messageQueue.push(pendingCommand))
+            pendingCommand = nullptr;
+    }
+
+    std::unique_ptr<LoadedModel> getModel() { return factory.getModel(); }
+
+    void retireModel(std::unique_ptr<LoadedModel> oldModel) { factory.retireModel(std::move(oldModel)); }
+
+private:
+    template <typename Fn>
+    void callLater(Fn&& fn)
+    {
+        BackgroundMessageQueue::IncomingCommand command = [weak = weakFromThis(), callback = std::forward<Fn>(fn)]() mutable
+        {
+            if(auto t = weak.lock())
+                callback(*t);
+        };
+
+        // A request that hasn't been posted yet is superseded by this one
+        const juce::SpinLock::ScopedLockType lock(pendingMutex);
+        std::swap(pendingCommand, command);
+    }
+
+    std::weak_ptr<NeuralModelQueue> weakFromThis() { return shared_from_this(); }
+
+    BackgroundMessageQueue& messageQueue;
+    NeuralModelFactory factory;
+
+    BackgroundMessageQueue::IncomingCommand pendingCommand;
+    juce::SpinLock pendingMutex;
+    std::atomic<int> latestRequest { 0 };
+};
+
+//==============================================================================
+NeuralNetwork::NeuralNetwork()
+    : messageQueue(1000, "Neural model loader"),
+      modelQueue(std::make_shared<NeuralModelQueue>(messageQueue))
+{
+    messageQueue.startThread();
+}
+
+NeuralNetwork::~NeuralNetwork()
+{
+    messageQueue.stopThread(-1);
+}
+
+void NeuralNetwork::prepare(double sampleRate, int maximumBlockSize)
+{
+    modelQueue->prepare(sampleRate, maximumBlockSize);
+
+    // Load the most recently requested model now, so it's active from the first block
+    modelQueue->postPendingCommand();
+    messageQueue.popAll();
+
+    if(auto newModel = modelQueue->getModel())
+    {
+        currentModel = std::move(newModel);
+        input_size = currentModel->inputSize;
+    }
+
+    previousModel = nullptr;
+    mixer.prepare({ sampleRate, (juce::uint32) maximumBlockSize, (juce::uint32) maxChannels });
+
+    if(currentModel != nullptr)
+    {
+        // It may have been loaded for another host sample rate
+        currentModel->prepare(sampleRate, maximumBlockSize);
+        currentModel->reset();
+    }
+}
+
+void NeuralNetwork::reset()
+{
+    mixer.reset();
+
+    if(currentModel != nullptr)
+        currentModel->reset();
+
+    destroyPreviousModel();
+}
+
+int NeuralNetwork::getLatencySamples() const
+{
+    return currentModel != nullptr ? currentModel->latencySamples : 0;
+}
+
+void NeuralNetwork::loadConfig(const juce::String &filename)
+{
+    modelQueue->loadModel(filename, modelOptions);
+}
+
+void NeuralNetwork::morphConfigs(const juce::String &filenameA, const juce::String &filenameB, float amount)
+{
+    modelQueue->morphModel(filenameA, filenameB, juce::jlimit(0.0f, 1.0f, amount), modelOptions);
+}
+
+void NeuralNetwork::postPendingLoads()
+{
+    modelQueue->postPendingCommand();
+
+    // Nothing is heard from the network on these blocks, so a model that has been
+    // loaded takes over straight away instead of being crossfaded in later
+    mixer.reset();
+    destroyPreviousModel();
+    installPendingModel(false);
+}
+
+void NeuralNetwork::process(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numChannels, int numSamples)
+{
+    jassert(numChannels >= 1 && numChannels <= maxChannels);
+
+    modelQueue->postPendingCommand();
+    modelQueue->recordInput(inData[0], paramsEnd, numSamples);
+
+    if(previousModel == nullptr)
+        installPendingModel();
+
+    if(currentModel == nullptr)
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            if(outData[channel] != inData[channel])
+                std::copy(inData[channel], inData[channel] + numSamples, outData[channel]);
+
+        return;
+    }
+
+    const juce::dsp::AudioBlock<const float> input(inData, (size_t) numChannels, (size_t) numSamples);
+    juce::dsp::AudioBlock<float> output(outData, (size_t) numChannels, (size_t) numSamples);
+
+    const auto processModel = [&] (LoadedModel& model, const juce::dsp::AudioBlock<const float>& in, juce::dsp::AudioBlock<float>& out)
+    {
+        const float* inputs[maxChannels];
+        float* outputs[maxChannels];
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            inputs[channel] = in.getChannelPointer((size_t) channel);
+            outputs[channel] = out.getChannelPointer((size_t) channel);
         }
-        else if(type == NeuralNetworkType::Proteus)
+
+        model.process(inputs, paramsStart, paramsEnd, outputs, numChannels, (int) in.getNumSamples());
+    };
+
+    mixer.processSamples(input,
+                         output,
+                         [&] (const juce::dsp::AudioBlock<const float>& in, juce::dsp::AudioBlock<float>& out)
+                         {
+                             processModel(*currentModel, in, out);
+                         },
+                         [&] (const juce::dsp::AudioBlock<const float>& in, juce::dsp::AudioBlock<float>& out)
+                         {
+                             if(previousModel != nullptr)
+                                 processModel(*previousModel, in, out);
+                             else
+                                 out.copyFrom(in);
+                         },
+                         [this] { destroyPreviousModel(); });
+}
+
+void NeuralNetwork::destroyPreviousModel()
+{
+    if(previousModel == nullptr)
+        return;
+
+    // The loader keeps a snapshot of its state, then it's destroyed on the loader thread.
+    // If the queue is full, we'll destroy this straight away
+    BackgroundMessageQueue::IncomingCommand command = [weak = std::weak_ptr<NeuralModelQueue>(modelQueue), p = std::move(previousModel)]() mutable
+    {
+        if(auto q = weak.lock())
+            q->retireModel(std::move(p));
+
+        p = nullptr;
+    };
+
+    messageQueue.push(command);
+}
+
+void NeuralNetwork::installPendingModel(bool crossfade)
+{
+    if(auto newModel = modelQueue->getModel())
+    {
+        // The next step of a morph takes over the running model's state and resampler,
+        // and the old weights go back to the loader thread to be destroyed
+        if(currentModel != nullptr && newModel->continuesMorph(*currentModel))
         {
-            for (int i = 0; i < numSamples; ++i) {
-                inArray2[0] = inData[i];
-                inArray2[1] = param1;
-                inArray2[2] = param2;
-                outData[i] = model_proteus_cond2.forward(inArray2) + inData[i];
-            }
+            currentModel->model->saveState(newModel->stateTransfer.data());
+            newModel->model->restoreState(newModel->stateTransfer.data());
+
+            std::swap(currentModel->model, newModel->model);
+            std::swap(currentModel->weights, newModel->weights);
+            previousModel = std::move(newModel);
+            destroyPreviousModel();
+            return;
         }
+
+        destroyPreviousModel();
+        previousModel = std::move(currentModel);
+        currentModel = std::move(newModel);
+        input_size = currentModel->inputSize;
+
+        if(crossfade)
+            mixer.beginTransition();
+        else
+            destroyPreviousModel();
     }
-}
\ No newline at end of file
+}
@@ -4,62 +4,123 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 
-enum class NeuralNetworkType {
-    NeuralPi,
-    Proteus
-};
-
+#include "BackgroundMessageQueue.h"
+#include "ModelRegistry.h"
+#include "NeuralModel.h"
 
-template <int input_size, int hidden_size>
-using NeuralPiLSTM = RTNeural::ModelT<float, input_size, 1,
-        RTNeural::LSTMLayerT<float, input_size, hidden_size>,
-        RTNeural::DenseT<float, hidden_size, 1>>;
+class NeuralModelQueue;
+struct LoadedModel;
 
+/**
+    Runs the current neural model and swaps in new ones without glitches.
 
+    loadConfig() only posts a message: the model is loaded on a background
+    thread, warmed up on the last few hundred ms of input so its recurrent
+    state has settled, and handed to the audio thread through a try-lock.
+    process() then crossfades from the old model to the new one, and the old
+    model is destroyed on the background thread again.
 
+    The recurrent state of the last few models that were switched out is kept,
+    and restored instead of the warm-up when one of them is loaded again.
+*/
 class NeuralNetwork
 {
 public:
-    NeuralNetwork() = default;
+    NeuralNetwork();
+    ~NeuralNetwork();
+
+    /** Must be called before process(). Any model requested with loadConfig()
+        beforehand is loaded synchronously and is active straight away.
+    */
+    void prepare(double sampleRate, int maximumBlockSize);
 
     void reset();
 
+    /** Loads a .json, .npb or .nam (WaveNet) model asynchronously. It never waits for a
+        load, but it takes a spin lock that the audio thread holds while it posts the
+        request, so it isn't wait-free. Must not be called from more than one thread at
+        a time. The request is posted by process() or postPendingLoads().
+    */
     void loadConfig(const juce::String &filename);
 
+    /** Runs a single model whose weights are interpolated between two .json or .npb
+        models, amount 0 being filenameA and 1 filenameB, so morphing costs no more
+        than one model. Both need the same architecture and sample rate; otherwise
+        the nearer one is loaded. Changes of the amount are published to the running
+        model in small steps, at a bounded rate, without a crossfade.
+        Same threading rules as loadConfig().
+    */
+    void morphConfigs(const juce::String &filenameA, const juce::String &filenameB, float amount);
+
+    /** Precision, activations, sample rate and streams for models loaded from now on.
+        Call this from the same thread as loadConfig(), then reload the model.
+    */
+    void setModelOptions(const ModelOptions& newOptions) { modelOptions = newOptions; }
+
+    const ModelOptions& getModelOptions() const { return modelOptions; }
+
+    bool hasModel() const { return currentModel != nullptr; }
+
+    /** Starts loading anything requested since the last block. process() does this
+        itself; call this instead on blocks that don't run the model, from the
+        thread that calls process(), so loads aren't held up while the model is off
+        or the chain is idle. A model that has finished loading is installed
+        without a crossfade, since the network isn't heard on these blocks.
+    */
+    void postPendingLoads();
+
+    /** Delay added by running the current model at its native sample rate, or
+        0. Changes when a new model is installed, so poll it from process().
+    */
+    int getLatencySamples() const;
+
     void process(const float* inData, float* outData, int numSamples)
     {
-        process(inData, 0, 0, outData, numSamples);
+        process(inData, 0.0f, 0.0f, outData, numSamples);
     }
 
     void process(const float* inData, float param, float* outData, int numSamples)
     {
-        process(inData, param, 0, outData, numSamples);
+        process(inData, param, 0.0f, outData, numSamples);
     }
 
-    void process(const float* inData, float param1, float param2, float* outData, int numSamples);
-
-    int input_size = 1;
-
-    NeuralNetworkType type;
-
-private:
-    void load_json(const juce::String &filename);
+    void process(const float* inData, float param1, float param2, float* outData, int numSamples)
+    {
+        const float params[] = { param1, param2 };
+        process(inData, params, params, outData, numSamples);
+    }
 
-private:
-    NeuralPiLSTM<1, 20> model;
+    // Conditioning parameters (gain, master) move linearly from paramsStart
+    // to paramsEnd over the block. Parameters the model isn't conditioned on
+    // are applied as gains, per model so crossfades keep their level: gain
+    // before the model, and master (times 2) after it.
+    void process(const float* inData, const float* paramsStart, const float* paramsEnd, float* outData, int numSamples)
+    {
+        process(&inData, paramsStart, paramsEnd, &outData, 1, numSamples);
+    }
 
-    NeuralPiLSTM<2, 20> model_cond1;
+    // Processes up to maxChannels independent signals, the channels of a stereo input
+    // or several guitars, with the same model. Each one needs a stream of the model
+    // (ModelOptions::numStreams): while a model for another number of channels is
+    // crossfaded in or out it runs the first channel, and its output is copied to
+    // the others. Warm-up and model switching only listen to the first channel.
+    void process(const float* const* inData, const float* paramsStart, const float* paramsEnd, float* const* outData, int numChannels, int numSamples);
 
-    NeuralPiLSTM<3, 20> model_cond2;
+    static constexpr int maxChannels = 8;
 
-    NeuralPiLSTM<1, 40> model_proteus;
+    // Input size of the current model
+    int input_size = 1;
 
-    NeuralPiLSTM<2, 40> model_proteus_cond1;
+private:
+    void installPendingModel(bool crossfade = true);
+    void destroyPreviousModel();
 
-    NeuralPiLSTM<3, 40> model_proteus_cond2;
+    ModelOptions modelOptions;
 
-    // Pre-Allowcate arrays for feeding the models
-    float inArray1[2] = { 0.0f, 0.0f };
-    float inArray2[3] = { 0.0f, 0.0f, 0.0f };
+    BackgroundMessageQueue messageQueue;
+    std::shared_ptr<NeuralModelQueue> modelQueue;
 
+    // Only the architecture that was loaded is instantiated
+    std::unique_ptr<LoadedModel> previousModel, currentModel;
+    CrossoverMixer mixer;
 };
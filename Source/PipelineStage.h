@@ -0,0 +1,305 @@
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#include "BackgroundMessageQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+#if JUCE_LINUX
+ #include <pthread.h>
+ #include <sched.h>
+#endif
+
+/**
+    Runs one stage of the processing chain on a worker thread pinned to its
+    own core, one block behind the audio thread.
+
+    process() hands the current block to the worker and returns the stage's
+    output from maximumBlockSize samples earlier. The stage gets a whole block
+    period on another core while the audio thread runs the rest of the chain,
+    at a fixed cost of maximumBlockSize samples of latency, whatever block
+    sizes the host uses.
+
+    Blocks travel through two wait-free SPSC queues of preallocated buffers.
+    The audio thread never locks or makes system calls; it only spins if the
+    stage hasn't finished the previous block yet, which is an overrun the
+    serial chain would have had as well. Once the first block arrives the
+    worker takes the audio thread's scheduling policy, one priority step below
+    it, if that thread is real-time and the system allows it. It polls for
+    blocks every 50 us, then backs off to 1 ms once no blocks have arrived for
+    a while, which is well inside a block period, so the first block after a
+    break doesn't keep the audio thread waiting.
+
+    Each block carries a Payload, which goes in with the samples and comes
+    back with the stage's output, so the stage can report what it did. A block
+    has up to the number of channels the stage was prepared for; channels a
+    block doesn't have come back silent.
+*/
+template <typename Payload>
+class PipelineStage : private Thread
+{
+public:
+    using Callback = std::function<void (float* const* channels, int numChannels, int numSamples, Payload& payload)>;
+
+    /** cpuCore is ignored on machines that don't have it */
+    PipelineStage (const String& threadName, int cpuCore, Callback callbackToUse)
+        : Thread (threadName), core (cpuCore), callback (std::move (callbackToUse))
+    {}
+
+    ~PipelineStage() override
+    {
+        stopThread (-1);
+    }
+
+    /** Allocates the buffers and (re)starts the worker. Not real-time safe, and
+        process() must not be running at the same time.
+    */
+    void prepare (int numChannels, int maximumBlockSize)
+    {
+        stopThread (-1);
+
+        // Anything still queued belongs to the previous configuration
+        toWorker.popAll ([] (int&) {});
+        fromWorker.popAll ([] (int&) {});
+        numInFlight = 0;
+
+        // The host may call process() from a different thread after this
+        audioThreadKnown = false;
+
+        maxBlockSize = maximumBlockSize;
+        maxChannels = numChannels;
+
+        for (auto& block : blocks)
+            block.samples.setSize (numChannels, maximumBlockSize);
+
+        output.setSize (numChannels, 2 * maximumBlockSize);
+        reset();
+
+        startThread();
+    }
+
+    /** Stops the worker */
+    void release()
+    {
+        stopThread (-1);
+    }
+
+    /** Call on the audio thread before the stage is used again after a
+        break. The output restarts with maximumBlockSize samples of silence.
+    */
+    void reset() noexcept
+    {
+        flush();
+
+        output.clear();
+        outputReadPosition = 0;
+        outputNumReady = maxBlockSize;
+        lastPayload = Payload {};
+    }
+
+    /** Waits for the block in flight, so the worker is idle afterwards */
+    void flush() noexcept
+    {
+        while (numInFlight > 0)
+            collect();
+    }
+
+    int getLatencySamples() const noexcept { return maxBlockSize; }
+
+    /** Call on the audio thread. Replaces the samples and the payload with
+        the stage's output from maximumBlockSize samples earlier.
+    */
+    void process (float* const* channels, int numChannels, int numSamples, Payload& payload) noexcept
+    {
+        jassert (numChannels <= maxChannels && numSamples <= maxBlockSize);
+
+       #if JUCE_LINUX
+        // The worker reads the audio thread's priority itself, which keeps the
+        // system call off this thread. Published by the push below.
+        if (! audioThreadKnown.load (std::memory_order_relaxed))
+        {
+            audioThread = pthread_self();
+            audioThreadKnown.store (true, std::memory_order_relaxed);
+        }
+       #endif
+
+        auto index = nextBlock;
+        auto& block = blocks[static_cast<size_t> (index)];
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            block.samples.copyFrom (channel, 0, channels[channel], numSamples);
+
+        block.numChannels = numChannels;
+        block.numSamples = numSamples;
+        block.payload = payload;
+
+        toWorker.push (index);
+        nextBlock = 1 - nextBlock;
+        ++numInFlight;
+
+        // Only the output of the previous block is needed now
+        while (numInFlight > 1)
+            collect();
+
+        const auto ringSize = output.getNumSamples();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const auto* ring = output.getReadPointer (channel);
+            auto position = outputReadPosition;
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                channels[channel][i] = ring[position];
+                position = position + 1 == ringSize ? 0 : position + 1;
+            }
+        }
+
+        outputReadPosition = (outputReadPosition + numSamples) % ringSize;
+        outputNumReady -= numSamples;
+        payload = lastPayload;
+    }
+
+private:
+    struct Block
+    {
+        AudioBuffer<float> samples;
+        int numChannels = 0;
+        int numSamples = 0;
+        Payload payload;
+    };
+
+    void collect() noexcept
+    {
+        while (! fromWorker.hasPendingMessages())
+        {
+            // Without a worker, which only happens if the thread couldn't be
+            // started, the stage runs here instead
+            if (! isThreadRunning())
+                processNextBlock();
+        }
+
+        fromWorker.pop ([this] (int& index)
+        {
+            const auto& block = blocks[static_cast<size_t> (index)];
+            const auto ringSize = output.getNumSamples();
+
+            for (int channel = 0; channel < maxChannels; ++channel)
+            {
+                auto* ring = output.getWritePointer (channel);
+                const auto* samples = channel < block.numChannels ? block.samples.getReadPointer (channel) : nullptr;
+                auto position = (outputReadPosition + outputNumReady) % ringSize;
+
+                for (int i = 0; i < block.numSamples; ++i)
+                {
+                    ring[position] = samples != nullptr ? samples[i] : 0.0f;
+                    position = position + 1 == ringSize ? 0 : position + 1;
+                }
+            }
+
+            outputNumReady += block.numSamples;
+            lastPayload = block.payload;
+        });
+
+        --numInFlight;
+    }
+
+    bool processNextBlock() noexcept
+    {
+        if (! toWorker.hasPendingMessages())
+            return false;
+
+        int index = 0;
+        toWorker.pop ([&index] (int& i) { index = i; });
+
+        auto& block = blocks[static_cast<size_t> (index)];
+        callback (block.samples.getArrayOfWritePointers(), block.numChannels, block.numSamples, block.payload);
+
+        fromWorker.push (index);
+        return true;
+    }
+
+    void run() override
+    {
+        if (core >= 0 && core < SystemStats::getNumCpus())
+            Thread::setCurrentThreadAffinityMask (1u << core);
+
+        auto lastBlockTime = Time::getMillisecondCounter();
+        bool priorityMatched = false;
+
+        while (! threadShouldExit())
+        {
+            if (processNextBlock())
+            {
+                lastBlockTime = Time::getMillisecondCounter();
+
+                if (! priorityMatched)
+                    priorityMatched = matchAudioThreadPriority();
+            }
+            else if (Time::getMillisecondCounter() - lastBlockTime > idleTimeoutMs)
+                sleep (1);
+            else
+                std::this_thread::sleep_for (std::chrono::microseconds (pollIntervalUs));
+        }
+    }
+
+    /** Puts the worker one step below the audio thread, so it never preempts
+        the host's own real-time threads (JACK, ELK) that run above the audio
+        callback. If the audio thread isn't real-time, or the system doesn't
+        allow it, the worker stays a normal thread. Returns true once there is
+        nothing left to do.
+    */
+    bool matchAudioThreadPriority()
+    {
+       #if JUCE_LINUX
+        if (! audioThreadKnown.load (std::memory_order_relaxed))
+            return false;
+
+        int policy = 0;
+        sched_param param {};
+
+        if (pthread_getschedparam (audioThread, &policy, &param) != 0
+             || (policy != SCHED_FIFO && policy != SCHED_RR))
+            return true;
+
+        param.sched_priority = jmax (sched_get_priority_min (policy), param.sched_priority - 1);
+        pthread_setschedparam (pthread_self(), policy, &param);
+       #endif
+
+        return true;
+    }
+
+    static constexpr int pollIntervalUs = 50;
+    static constexpr uint32 idleTimeoutMs = 100;
+
+    const int core;
+    Callback callback;
+
+    // One block is processed while the audio thread fills the other
+    Block blocks[2];
+    int nextBlock = 0;
+    int numInFlight = 0;
+
+    // An AbstractFifo holds one element less than its size
+    Queue<int> toWorker { 3 }, fromWorker { 3 };
+
+    // Output samples waiting to be returned, owned by the audio thread
+    AudioBuffer<float> output;
+    int outputReadPosition = 0;
+    int outputNumReady = 0;
+    int maxBlockSize = 0;
+    int maxChannels = 0;
+
+    Payload lastPayload;
+
+   #if JUCE_LINUX
+    pthread_t audioThread {};
+   #endif
+    std::atomic<bool> audioThreadKnown { false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PipelineStage)
+};
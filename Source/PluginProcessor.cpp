@@ -9,6 +9,8 @@
 */
 
 #include "PluginProcessor.h"
+#include "EmbeddedModel.h"
+#include "IRPartitionCache.h"
 #include <iostream>
 #include <fstream>
 
@@ -30,13 +32,17 @@ NeuralPiAudioProcessor::NeuralPiAudioProcessor()
     backgroundThread.startThread();
 
     setupDataDirectories();
-    installTones();
     resetDirectory(userAppDataDirectory_tones);
     // Sort configFiles alphabetically
     std::sort(configFiles.begin(), configFiles.end());
     if (configFiles.size() > 0) {
-        loadConfig(configFiles[model_index], neuralNetwork1);
+        changeModel(configFiles[model_index]);
     }
+    // The default tones load from the compiled-in tables, the files are for the user
+    installTones();
+
+    // IRs that were loaded before skip decoding, resampling and their FFTs
+    IRPartitionCache::getInstance().setDirectory(userAppDataDirectory.getChildFile("ir_cache"));
 
     resetDirectoryIR(userAppDataDirectory_irs);
     // Sort irFiles alphabetically
@@ -51,30 +57,8 @@ NeuralPiAudioProcessor::NeuralPiAudioProcessor()
     chorus.addParameter("CentreDelay", [](auto &chorus, float newValue) { chorus.setCentreDelay(newValue); });
     chorus.addParameter("Feedback",    [](auto &chorus, float newValue) { chorus.setFeedback(newValue); });
 
-    oscReceiver.modelCallback = [&] (juce::String value) {
-        bool found = false;
-
-        for(size_t i = 0; i < configFiles.size(); i++) {
-            if(value == configFiles[i].getFileNameWithoutExtension()) {
-                float value = static_cast<float>(i) / configFiles.size();
-                apvts.getParameter(MODEL_ID)->setValueNotifyingHost(value);
-                found = true;
-                break;
-            }
-        }
-
-        if(!found)
-        {
-            File fullpath = userAppDataDirectory_tones.getFullPathName() + "/" + value + ".json";
-            if(!fullpath.existsAsFile())fullpath = userAppDataDirectory_tones.getFullPathName() + "/" + value + ".nam";
-            if(fullpath.existsAsFile())
-            {
-                configFiles.push_back(fullpath);
-                float value = static_cast<float>(configFiles.size() - 1) / configFiles.size();
-                apvts.getParameter(MODEL_ID)->setValueNotifyingHost(value);
-            }
-        }
-    };
+    oscReceiver.modelCallback =  [&] (juce::String value) { selectModel(value, MODEL_ID); };
+    oscReceiver.model2Callback = [&] (juce::String value) { selectModel(value, MODEL2_ID); };
 
     oscReceiver.irCallback = [&] (juce::String value) {
         bool found = false;
@@ -101,6 +85,9 @@ NeuralPiAudioProcessor::NeuralPiAudioProcessor()
     };
 
     oscReceiver.irWetLevelCallback = [&] (float value) { apvts.getParameter(IRWETLEVEL_ID)->setValueNotifyingHost(value); };
+    oscReceiver.irMinPhaseCallback = [&] (float value) { apvts.getParameter(IRMINPHASE_ID)->setValueNotifyingHost(value); };
+    oscReceiver.irEnergyCallback = [&] (float value) { apvts.getParameter(IRENERGY_ID)->setValueNotifyingHost(value); };
+    oscReceiver.irLengthCallback = [&] (float value) { apvts.getParameter(IRLENGTH_ID)->setValueNotifyingHost(value); };
 
     oscReceiver.gainCallback =      [&] (float value) { apvts.getParameter(GAIN_ID)->setValueNotifyingHost(value); };
     oscReceiver.masterCallback =    [&] (float value) { apvts.getParameter(MASTER_ID)->setValueNotifyingHost(value); };
@@ -108,6 +95,16 @@ NeuralPiAudioProcessor::NeuralPiAudioProcessor()
     oscReceiver.midCallback =       [&] (float value) { apvts.getParameter(MID_ID)->setValueNotifyingHost(value); };
     oscReceiver.trebleCallback =    [&] (float value) { apvts.getParameter(TREBLE_ID)->setValueNotifyingHost(value); };
     oscReceiver.presenceCallback =  [&] (float value) { apvts.getParameter(PRESENCE_ID)->setValueNotifyingHost(value); };
+    oscReceiver.precisionCallback = [&] (float value) { apvts.getParameter(PRECISION_ID)->setValueNotifyingHost(value); };
+    oscReceiver.activationsCallback = [&] (float value) { apvts.getParameter(ACTIVATIONS_ID)->setValueNotifyingHost(value); };
+    oscReceiver.nativeRateCallback = [&] (float value) { apvts.getParameter(NATIVERATE_ID)->setValueNotifyingHost(value); };
+    oscReceiver.pipelineCallback = [&] (float value) { apvts.getParameter(PIPELINE_ID)->setValueNotifyingHost(value); };
+    oscReceiver.dualAmpCallback =  [&] (float value) { apvts.getParameter(DUALAMP_ID)->setValueNotifyingHost(value); };
+    oscReceiver.ampBlendCallback = [&] (float value) { apvts.getParameter(AMPBLEND_ID)->setValueNotifyingHost(value); };
+    oscReceiver.stereoCallback =   [&] (float value) { apvts.getParameter(STEREO_ID)->setValueNotifyingHost(value); };
+    oscReceiver.morphCallback =    [&] (float value) { apvts.getParameter(MORPH_ID)->setValueNotifyingHost(value); };
+    oscReceiver.idleSkipCallback = [&] (float value) { apvts.getParameter(IDLESKIP_ID)->setValueNotifyingHost(value); };
+    oscReceiver.compressionCallback = [&] (float value) { apvts.getParameter(COMPRESSION_ID)->setValueNotifyingHost(value); };
 
     oscReceiver.delayCallback =         [&] (float value) { apvts.getParameter(DELAY_ID)->setValueNotifyingHost(value); };
     oscReceiver.delayWetLevelCallback = [&] (float value) { apvts.getParameter(DELAYWETLEVEL_ID)->setValueNotifyingHost(value); };
@@ -139,8 +136,12 @@ NeuralPiAudioProcessor::NeuralPiAudioProcessor()
     oscReceiver.recordCallback =     [&] (bool value) { apvts.getParameter(RECORD_ID)->setValueNotifyingHost(value ? 0.0f : 1.0f); };
 
     apvts.addParameterListener (MODEL_ID, this);
+    apvts.addParameterListener (MODEL2_ID, this);
     apvts.addParameterListener (IR_ID, this);
     apvts.addParameterListener (IRWETLEVEL_ID, this);
+    apvts.addParameterListener (IRMINPHASE_ID, this);
+    apvts.addParameterListener (IRENERGY_ID, this);
+    apvts.addParameterListener (IRLENGTH_ID, this);
 
     apvts.addParameterListener (GAIN_ID, this);
     apvts.addParameterListener (MASTER_ID, this);
@@ -148,6 +149,16 @@ NeuralPiAudioProcessor::NeuralPiAudioProcessor()
     apvts.addParameterListener (MID_ID, this);
     apvts.addParameterListener (TREBLE_ID, this);
     apvts.addParameterListener (PRESENCE_ID, this);
+    apvts.addParameterListener (PRECISION_ID, this);
+    apvts.addParameterListener (ACTIVATIONS_ID, this);
+    apvts.addParameterListener (NATIVERATE_ID, this);
+    apvts.addParameterListener (PIPELINE_ID, this);
+    apvts.addParameterListener (DUALAMP_ID, this);
+    apvts.addParameterListener (AMPBLEND_ID, this);
+    apvts.addParameterListener (STEREO_ID, this);
+    apvts.addParameterListener (MORPH_ID, this);
+    apvts.addParameterListener (IDLESKIP_ID, this);
+    apvts.addParameterListener (COMPRESSION_ID, this);
 
     apvts.addParameterListener (DELAY_ID, this);
     apvts.addParameterListener (DELAYWETLEVEL_ID, this);
@@ -185,8 +196,17 @@ juce::AudioProcessorValueTreeState::ParameterLayout NeuralPiAudioProcessor::crea
 
     // initialize parameters:
     params.add (std::make_unique<AudioParameterFloat>(MODEL_ID,     MODEL_NAME,     NormalisableRange<float>(0.0f, 1.0f, 0.0001f), 0.0f));
+    params.add (std::make_unique<AudioParameterFloat>(MODEL2_ID,    MODEL2_NAME,    NormalisableRange<float>(0.0f, 1.0f, 0.0001f), 0.0f));
     params.add (std::make_unique<AudioParameterFloat>(IR_ID,        IR_NAME,        NormalisableRange<float>(0.0f, 1.0f, 0.0001f), 0.0f));
     params.add (std::make_unique<AudioParameterFloat>(IRWETLEVEL_ID, IRWETLEVEL_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.01f), 1.0f));
+    // 1 = IRs are converted to minimum phase when they're loaded
+    params.add (std::make_unique<AudioParameterFloat>(IRMINPHASE_ID, IRMINPHASE_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // IRs are truncated once they hold this fraction of their energy, 1 keeps it all
+    params.add (std::make_unique<AudioParameterFloat>(IRENERGY_ID, IRENERGY_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.0001f), 1.0f));
+    // 0 = no limit, otherwise IRs are truncated to this fraction of 500 ms
+    params.add (std::make_unique<AudioParameterFloat>(IRLENGTH_ID, IRLENGTH_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.0f));
+    // Reported by the plugin: the share of the current IR's partitions IrMinPhase, IrEnergy and IrLength saved
+    params.add (std::make_unique<AudioParameterFloat>(IRSAVED_ID, IRSAVED_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.001f), 0.0f));
     
     params.add (std::make_unique<AudioParameterFloat>(GAIN_ID,      GAIN_NAME,      NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.5f));
     params.add (std::make_unique<AudioParameterFloat>(MASTER_ID,    MASTER_NAME,    NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.5f));
@@ -194,6 +214,28 @@ juce::AudioProcessorValueTreeState::ParameterLayout NeuralPiAudioProcessor::crea
     params.add (std::make_unique<AudioParameterFloat>(MID_ID,       MID_NAME,       NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.5f));
     params.add (std::make_unique<AudioParameterFloat>(TREBLE_ID,    TREBLE_NAME,    NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.5f));
     params.add (std::make_unique<AudioParameterFloat>(PRESENCE_ID,  PRESENCE_NAME,  NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.5f));
+    // 0 = float32, 0.5 = float16, 1 = int8 recurrent weights
+    params.add (std::make_unique<AudioParameterFloat>(PRECISION_ID, PRECISION_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.5f), 0.0f));
+    // 0 = exact, 1 = rational approximation
+    params.add (std::make_unique<AudioParameterFloat>(ACTIVATIONS_ID, ACTIVATIONS_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // 0 = host rate, 1 = the rate the model was trained at
+    params.add (std::make_unique<AudioParameterFloat>(NATIVERATE_ID, NATIVERATE_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // 0 = everything on the audio thread, 1 = the amp on its own core, one block later
+    params.add (std::make_unique<AudioParameterFloat>(PIPELINE_ID, PIPELINE_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // 0 = one amp, 1 = Model and Model2 in parallel on their own cores, blended by AmpBlend (0 = Model, 1 = Model2)
+    params.add (std::make_unique<AudioParameterFloat>(DUALAMP_ID, DUALAMP_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    params.add (std::make_unique<AudioParameterFloat>(AMPBLEND_ID, AMPBLEND_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.5f));
+    // Reported by the plugin: the share of a block period each amp takes
+    params.add (std::make_unique<AudioParameterFloat>(AMPLOAD1_ID, AMPLOAD1_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.001f), 0.0f));
+    params.add (std::make_unique<AudioParameterFloat>(AMPLOAD2_ID, AMPLOAD2_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.001f), 0.0f));
+    // 0 = the right input is line-in, 1 = both inputs go through the amp and the effects
+    params.add (std::make_unique<AudioParameterFloat>(STEREO_ID, STEREO_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // 1 = AmpBlend interpolates the weights of Model and Model2, which run as a single model
+    params.add (std::make_unique<AudioParameterFloat>(MORPH_ID, MORPH_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // 1 = the amp and effects are skipped while the input and their tails are silent
+    params.add (std::make_unique<AudioParameterFloat>(IDLESKIP_ID, IDLESKIP_NAME, NormalisableRange<float>(0.0f, 1.0f, 1.0f), 0.0f));
+    // 0 = off, otherwise the ESR the compressed model may differ from the original by, up to 0.05 at 1
+    params.add (std::make_unique<AudioParameterFloat>(COMPRESSION_ID, COMPRESSION_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.01f), 0.0f));
     
     params.add (std::make_unique<AudioParameterFloat>(DELAY_ID,         DELAY_NAME,         NormalisableRange<float>(0.0f, 1.0f, 0.001f), 0.0f));
     params.add (std::make_unique<AudioParameterFloat>(DELAYWETLEVEL_ID, DELAYWETLEVEL_NAME, NormalisableRange<float>(0.0f, 1.0f, 0.001f), 0.0f));
@@ -234,11 +276,8 @@ void NeuralPiAudioProcessor::parameterChanged (const juce::String& parameterID,
 
     
         
-    if (parameterID == MODEL_ID)
-    {
-        model_index = jlimit(0, static_cast<int>(configFiles.size()-1), static_cast<int>(newValue * configFiles.size() + 0.5f));
-        changeModel(configFiles[model_index]);
-    }
+    modelParameterChanged(parameterID, newValue);
+
     if (parameterID == IR_ID)
     {
         ir_index = jlimit(0, static_cast<int>(irFiles.size()-1), static_cast<int>(newValue * irFiles.size() + 0.5f));
@@ -249,6 +288,19 @@ void NeuralPiAudioProcessor::parameterChanged (const juce::String& parameterID,
         cabSimIR1.setWetLevel(newValue);
         cabSimIR2.setWetLevel(newValue);
     }
+    if (parameterID == IRMINPHASE_ID || parameterID == IRENERGY_ID || parameterID == IRLENGTH_ID)
+    {
+        if (parameterID == IRMINPHASE_ID)
+            irProcessing.minimumPhase = newValue >= 0.5f;
+        else if (parameterID == IRENERGY_ID)
+            irProcessing.energyFraction = newValue;
+        else
+            irProcessing.maxLengthSeconds = newValue * 0.5;
+
+        // Both slots, so the next IR loaded into either is processed the same way
+        cabSimIR1.setIRProcessing(irProcessing);
+        cabSimIR2.setIRProcessing(irProcessing);
+    }
 
     if (parameterID == GAIN_ID)
         gain = newValue;
@@ -257,22 +309,26 @@ void NeuralPiAudioProcessor::parameterChanged (const juce::String& parameterID,
     if (parameterID == BASS_ID)
     {
         float bass = (newValue - 0.5) * 24.0;
-        eq4band.setBass(bass);
+        for (auto& eq : eq4band)
+            eq.setBass(bass);
     }
     if (parameterID == MID_ID)
     {
         float mid = (newValue - 0.5) * 24.0;
-        eq4band.setMid(mid);
+        for (auto& eq : eq4band)
+            eq.setMid(mid);
     }
     if (parameterID == TREBLE_ID)
     {
         float treble = (newValue - 0.5) * 24.0;
-        eq4band.setTreble(treble);
+        for (auto& eq : eq4band)
+            eq.setTreble(treble);
     }
     if (parameterID == PRESENCE_ID)
     {
         float presence = (newValue - 0.5) * 24.0;
-        eq4band.setPresence(presence);
+        for (auto& eq : eq4band)
+            eq.setPresence(presence);
     }
 
     if (parameterID == DELAY_ID)
@@ -341,12 +397,111 @@ void NeuralPiAudioProcessor::parameterChanged (const juce::String& parameterID,
         recording = newValue >= 0.5f;
 }
 
+// Parameters that load models. They can be set from the host's threads, the message
+// thread and the OSC receiver, and loadConfig() and the model options must only be
+// changed from one thread at a time.
+void NeuralPiAudioProcessor::modelParameterChanged (const juce::String& parameterID, float newValue)
+{
+    const ScopedLock sl (modelLock);
+
+    if (parameterID == MODEL_ID)
+    {
+        model_index = jlimit(0, static_cast<int>(configFiles.size()-1), static_cast<int>(newValue * configFiles.size() + 0.5f));
+        changeModel(configFiles[model_index]);
+    }
+    if (parameterID == MODEL2_ID)
+    {
+        model2_index = jlimit(0, static_cast<int>(configFiles.size()-1), static_cast<int>(newValue * configFiles.size() + 0.5f));
+
+        if (morphEnabled)
+            changeModel(configFiles[model_index]);
+        else if (dualAmpEnabled)
+            changeModel2(configFiles[model2_index]);
+    }
+    if (parameterID == PRECISION_ID || parameterID == ACTIVATIONS_ID || parameterID == NATIVERATE_ID || parameterID == STEREO_ID
+        || parameterID == COMPRESSION_ID)
+    {
+        auto options = neuralNetwork.getModelOptions();
+
+        if (parameterID == PRECISION_ID)
+            options.precision = newValue < 0.25f ? ModelPrecision::Float32
+                              : newValue < 0.75f ? ModelPrecision::Float16
+                                                 : ModelPrecision::Int8;
+        else if (parameterID == NATIVERATE_ID)
+            options.nativeSampleRate = newValue >= 0.5f;
+        else if (parameterID == STEREO_ID)
+            options.numStreams = newValue >= 0.5f ? 2 : 1;
+        else if (parameterID == COMPRESSION_ID)
+            options.maxCompressionESR = newValue * 0.05f;
+        else
+            options.activations = newValue < 0.5f ? ModelActivations::Exact
+                                                  : ModelActivations::Rational;
+
+        // Until the models for the new number of channels are crossfaded in, the old
+        // ones run the left channel for both
+        if (parameterID == STEREO_ID)
+            stereoEnabled = newValue >= 0.5f;
+
+        if (options != neuralNetwork.getModelOptions())
+        {
+            neuralNetwork.setModelOptions(options);
+            neuralNetwork2.setModelOptions(options);
+
+            if (configFiles.size() > 0)
+            {
+                changeModel(configFiles[model_index]);
+
+                if (dualAmpEnabled)
+                    changeModel2(configFiles[model2_index]);
+            }
+        }
+    }
+    if (parameterID == PIPELINE_ID)
+        pipelineEnabled = newValue >= 0.5f;
+    if (parameterID == IDLESKIP_ID)
+        idleSkipEnabled = newValue >= 0.5f;
+    if (parameterID == DUALAMP_ID)
+    {
+        // The second amp only loads its model once it's used
+        if (newValue >= 0.5f && ! dualAmpEnabled && configFiles.size() > 0)
+            changeModel2(configFiles[model2_index]);
+
+        dualAmpEnabled = newValue >= 0.5f;
+    }
+    if (parameterID == AMPBLEND_ID)
+    {
+        ampBlend = newValue;
+
+        if (morphEnabled && configFiles.size() > 0)
+            changeModel(configFiles[model_index]);
+    }
+    if (parameterID == MORPH_ID && morphEnabled != (newValue >= 0.5f))
+    {
+        morphEnabled = newValue >= 0.5f;
+
+        if (configFiles.size() > 0)
+        {
+            changeModel(configFiles[model_index]);
+
+            // Model2 may have changed while it was only a morph target
+            if (! morphEnabled && dualAmpEnabled)
+                changeModel2(configFiles[model2_index]);
+        }
+    }
+}
+
 
 NeuralPiAudioProcessor::~NeuralPiAudioProcessor()
 {
+    cancelPendingUpdate();
+
     apvts.removeParameterListener(MODEL_ID, this);
+    apvts.removeParameterListener(MODEL2_ID, this);
     apvts.removeParameterListener(IR_ID, this);
     apvts.removeParameterListener(IRWETLEVEL_ID, this);
+    apvts.removeParameterListener(IRMINPHASE_ID, this);
+    apvts.removeParameterListener(IRENERGY_ID, this);
+    apvts.removeParameterListener(IRLENGTH_ID, this);
 
     apvts.removeParameterListener(GAIN_ID, this);
     apvts.removeParameterListener(MASTER_ID, this);
@@ -354,6 +509,16 @@ NeuralPiAudioProcessor::~NeuralPiAudioProcessor()
     apvts.removeParameterListener(MID_ID, this);
     apvts.removeParameterListener(TREBLE_ID, this);
     apvts.removeParameterListener(PRESENCE_ID, this);
+    apvts.removeParameterListener(PRECISION_ID, this);
+    apvts.removeParameterListener(ACTIVATIONS_ID, this);
+    apvts.removeParameterListener(NATIVERATE_ID, this);
+    apvts.removeParameterListener(PIPELINE_ID, this);
+    apvts.removeParameterListener(DUALAMP_ID, this);
+    apvts.removeParameterListener(AMPBLEND_ID, this);
+    apvts.removeParameterListener(STEREO_ID, this);
+    apvts.removeParameterListener(MORPH_ID, this);
+    apvts.removeParameterListener(IDLESKIP_ID, this);
+    apvts.removeParameterListener(COMPRESSION_ID, this);
     
     apvts.removeParameterListener(DELAY_ID, this);
     apvts.removeParameterListener(DELAYWETLEVEL_ID, this);
@@ -454,22 +619,41 @@ void NeuralPiAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlo
     // initialisation that you need..
 
     // set up DC blocker
-    dcBlocker.coefficients = dsp::IIR::Coefficients<float>::makeHighPass(sampleRate, 35.0f);
+    *dcBlocker.state = *dsp::IIR::Coefficients<float>::makeHighPass(sampleRate, 35.0f);
     dsp::ProcessSpec spec{ sampleRate, static_cast<uint32> (samplesPerBlock), 2 };
     dcBlocker.prepare(spec);
 
-    constexpr double targetSampleRate = 44100.0;
-    resampler.prepareWithTargetSampleRate({ sampleRate, (uint32)samplesPerBlock, 1 }, targetSampleRate);
+    idleDetector.prepare(sampleRate);
 
-    //std::ofstream of("/tmp/debug",std::ios_base::ate);
-    //of<<"Downsampling from "<<sampleRate<<" to "<<targetSampleRate<<std::endl;
+    gainSmoothed.reset(sampleRate, 0.05);
+    gainSmoothed.setCurrentAndTargetValue(gain);
+    masterSmoothed.reset(sampleRate, 0.05);
+    masterSmoothed.setCurrentAndTargetValue(master);
 
     // Set up IR
     cabSimIR1.prepare(spec);
     cabSimIR2.prepare(spec);
 
-    neuralNetwork1.reset();
-    neuralNetwork2.reset();
+    // Stops the amp stages' workers before the networks are touched
+    ampStage.prepare(2, samplesPerBlock);
+    ampStage2.prepare(2, samplesPerBlock);
+    pipelineActive = false;
+    dualAmpActive = false;
+
+    neuralNetwork.prepare(sampleRate, samplesPerBlock);
+    neuralNetwork2.prepare(sampleRate, samplesPerBlock);
+    reportedLatency = ampState && lstmState ? neuralNetwork.getLatencySamples() + (pipelineEnabled || (dualAmpEnabled && ! morphEnabled) ? ampStage.getLatencySamples() : 0) : 0;
+
+    dualAmpBuffer.setSize(2, samplesPerBlock);
+    ampBlendSmoothed.reset(sampleRate, 0.05);
+    ampBlendSmoothed.setCurrentAndTargetValue(ampBlend);
+
+    for (auto& delayLine : alignmentDelay)
+    {
+        delayLine.prepare(spec);
+        delayLine.setMaximumDelayInSamples(maxAlignmentDelay);
+    }
+    setLatencySamples(reportedLatency);
 
     // fx chain
     delay.prepare(spec);
@@ -482,6 +666,88 @@ void NeuralPiAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    ampStage.release();
+    ampStage2.release();
+    pipelineActive = false;
+    dualAmpActive = false;
+}
+
+// Runs on the amp stage's worker when the pipeline is on, otherwise on the audio thread.
+// The network is only ever touched from here, so it never sees both threads at once.
+void NeuralPiAudioProcessor::processAmpStage(NeuralNetwork& network, float* const* channels, int numChannels, int numSamples, AmpStageBlock& ampBlock)
+{
+    const auto startTicks = Time::getHighResolutionTicks();
+
+    // Models that aren't conditioned on the gain get it applied to their input by the network.
+    // With NativeRate on, the network resamples to the model's rate and back. In stereo each
+    // channel is a stream of the model. A network without a model, like the second amp's
+    // when DualAmp has just been switched on, passes the input through until its model
+    // is loaded. Loads requested meanwhile are started either way.
+    if (ampBlock.runModel)
+        network.process(channels, ampBlock.paramsStart, ampBlock.paramsEnd, channels, numChannels, numSamples);
+    else
+        network.postPendingLoads();
+
+    ampBlock.modelActive = ampBlock.runModel && network.hasModel();
+
+    ampBlock.modelInputSize = network.input_size;
+    ampBlock.modelLatency = ampBlock.modelActive ? network.getLatencySamples() : 0;
+    ampBlock.processingSeconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks);
+}
+
+// Mixes the second amp into the first. The networks put the master on their models'
+// output when the models aren't conditioned on it; an amp without a model gets it here.
+void NeuralPiAudioProcessor::blendAmps(float* const* amp1, float* const* amp2, int numChannels, int numSamples, AmpStageBlock& amp1Block, const AmpStageBlock& amp2Block)
+{
+    float* const* amps[] = { amp1, amp2 };
+    const AmpStageBlock* blocks[] = { &amp1Block, &amp2Block };
+    const int latency = jmax(amp1Block.modelLatency, amp2Block.modelLatency);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        const auto& ampBlock = *blocks[i];
+        auto& delayLine = alignmentDelay[i];
+        delayLine.setDelay(static_cast<float>(jmin(latency - ampBlock.modelLatency, maxAlignmentDelay)));
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            auto* samples = amps[i][channel];
+
+            if (! ampBlock.modelActive && (ampBlock.modelInputSize == 1 || ampBlock.modelInputSize == 2))
+            {
+                const float start = ampBlock.paramsStart[1] * 2.0f;
+                const float increment = (ampBlock.paramsEnd[1] * 2.0f - start) / static_cast<float>(numSamples);
+
+                for (int n = 0; n < numSamples; ++n)
+                    samples[n] *= start + increment * static_cast<float>(n);
+            }
+
+            for (int n = 0; n < numSamples; ++n)
+            {
+                delayLine.pushSample(channel, samples[n]);
+                samples[n] = delayLine.popSample(channel);
+            }
+        }
+    }
+
+    ampBlendSmoothed.setTargetValue(ampBlend);
+
+    for (int n = 0; n < numSamples; ++n)
+    {
+        const float blend = ampBlendSmoothed.getNextValue();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            amp1[channel][n] += (amp2[channel][n] - amp1[channel][n]) * blend;
+    }
+
+    amp1Block.modelLatency = latency;
+}
+
+void NeuralPiAudioProcessor::updateAmpLoad(int amp, const AmpStageBlock& ampBlock, float blockDurationSeconds)
+{
+    // Averaged like the input RMS, over about the last second
+    const float currentLoad = static_cast<float>(ampBlock.processingSeconds) / blockDurationSeconds;
+    ampLoad[amp] = (ampLoad[amp].load() + currentLoad * blockDurationSeconds) / (1.0f + blockDurationSeconds);
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -518,20 +784,139 @@ void NeuralPiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
     const int numInputChannels = getTotalNumInputChannels();
     const int sampleRate = getSampleRate();
 
-    dsp::AudioBlock<float> block = dsp::AudioBlock<float>(buffer).getSingleChannelBlock(0);
+    // In stereo both channels go through the amp and the effects, otherwise only the
+    // left one does and the right one is line-in
+    const int numAmpChannels = stereoEnabled && numInputChannels >= 2 && buffer.getNumChannels() >= 2 ? 2 : 1;
+
+    dsp::AudioBlock<float> block = dsp::AudioBlock<float>(buffer).getSubsetChannelBlock(0, static_cast<size_t>(numAmpChannels));
     dsp::ProcessContextReplacing<float> context(block);
 
     float currentBufferDurationSeconds = static_cast<float>(numSamples) / sampleRate;
+
+    // Gain and master ramp from their current to their next smoothed value over this block
+    gainSmoothed.setTargetValue(gain);
+    masterSmoothed.setTargetValue(master);
+    const float paramsStart[] = { gainSmoothed.getCurrentValue(), masterSmoothed.getCurrentValue() };
+    const float paramsEnd[] = { gainSmoothed.skip(numSamples), masterSmoothed.skip(numSamples) };
     
+    AmpStageBlock ampBlock;
+    std::copy(paramsStart, paramsStart + 2, ampBlock.paramsStart);
+    std::copy(paramsEnd, paramsEnd + 2, ampBlock.paramsEnd);
+    ampBlock.runModel = lstmState;
+    AmpStageBlock ampBlock2 = ampBlock;
+
+    // The pipeline is switched on the audio thread, between blocks. Switching
+    // it off waits for the block in flight, so the network is idle afterwards.
+    // Both amps of the dual-amp mode are pipelined, so they line up.
+    const bool useDualAmp = ampState && dualAmpEnabled && ! morphEnabled;
+    const bool usePipeline = ampState && (pipelineEnabled || useDualAmp);
+
+    if (usePipeline != pipelineActive)
+    {
+        if (usePipeline)
+            ampStage.reset();
+        else
+            ampStage.flush();
+
+        pipelineActive = usePipeline;
+        pipelinedModelActive[0] = neuralNetwork.hasModel();
+    }
+    else if (pipelineActive && numAmpChannels != numAmpChannelsActive)
+    {
+        // The block in flight has the old number of channels
+        ampStage.reset();
+
+        if (dualAmpActive)
+            ampStage2.reset();
+    }
+
+    numAmpChannelsActive = numAmpChannels;
+
+    if (useDualAmp != dualAmpActive)
+    {
+        if (useDualAmp)
+        {
+            ampStage2.reset();
+            ampBlendSmoothed.setCurrentAndTargetValue(ampBlend);
+
+            for (auto& delayLine : alignmentDelay)
+                delayLine.reset();
+        }
+        else
+        {
+            ampStage2.flush();
+        }
+
+        dualAmpActive = useDualAmp;
+        pipelinedModelActive[1] = neuralNetwork2.hasModel();
+    }
+
+    // With the pipeline on, the networks belong to the amp stages' workers and
+    // report whether they have a model with their output
+    const bool modelActive = pipelineActive ? pipelinedModelActive[0] || (dualAmpActive && pipelinedModelActive[1])
+                                            : neuralNetwork.hasModel();
+
+    // Between songs the amp and effects are skipped and silence is output, until
+    // the input comes back (see IdleDetector)
+    bool chainIdle = false;
+
+    if (ampState && idleSkipEnabled)
+    {
+        float inputPeak = 0.0f;
+
+        for (int channel = 0; channel < numAmpChannels; ++channel)
+            inputPeak = jmax(inputPeak, buffer.getMagnitude(channel, 0, numSamples));
+
+        chainIdle = idleDetector.processInput(inputPeak, numSamples);
+    }
+    else
+    {
+        idleDetector.reset();
+    }
+
+    if (chainIdle)
+    {
+        for (int channel = 0; channel < numAmpChannels; ++channel)
+            buffer.clear(channel, 0, numSamples);
+
+        updateAmpLoad(0, AmpStageBlock(), currentBufferDurationSeconds);
+
+        if (dualAmpActive)
+            updateAmpLoad(1, AmpStageBlock(), currentBufferDurationSeconds);
+
+        // The amp stages get no blocks while idle. Resetting them waits for the block in
+        // flight, so the networks then belong to the audio thread, which keeps loading the
+        // models chosen between songs, and drops what the stages had queued before the break.
+        if (pipelineActive)
+        {
+            ampStage.reset();
+
+            if (dualAmpActive)
+                ampStage2.reset();
+        }
+
+        neuralNetwork.postPendingLoads();
+
+        if (dualAmpActive)
+            neuralNetwork2.postPendingLoads();
+    }
+
     // Amp =============================================================================
-    if (ampState) {
-        if (model_loaded && lstmState)
+    bool masterApplied = false;
+
+    if (ampState && ! chainIdle) {
+        if (modelActive && lstmState)
         {
             //Applying (auto adjusted) preamp gain
-            buffer.applyGain(0, 0, numSamples, preampGain);
+            float currentRMS0 = 0.0f;
+
+            for (int channel = 0; channel < numAmpChannels; ++channel)
+            {
+                buffer.applyGain(channel, 0, numSamples, preampGain);
+                currentRMS0 = jmax(currentRMS0, buffer.getRMSLevel(channel, 0, numSamples));
+            }
 
-            //Averaged input RMS over the last 2 seconds
-            float currentRMS0 = buffer.getRMSLevel(0, 0, numSamples);
+            //Averaged input RMS over the last 2 seconds, of the louder channel in stereo
             averagedRMSInput = (averagedRMSInput * 2 + currentRMS0 * currentBufferDurationSeconds) / (2 + currentBufferDurationSeconds);
 
             /*static int counter = 0;
@@ -550,51 +935,43 @@ void NeuralPiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
                 preampGain = preampGain / averagedRMSInput;
                 averagedRMSInput = 1.0f;
             }
+        }
 
-            if(currentNeuralNetwork == 0)
+        // Pipelined, the rest of the chain gets the amp's output from one block earlier.
+        // With two amps, the second gets a copy of the input and is blended back in here.
+        if (pipelineActive)
+        {
+            if (dualAmpActive)
             {
-                // Applying gain
-                if (neuralNetwork1.input_size == 1) {
-                    buffer.applyGain(0, 0, numSamples, gain);
-                }
-
-                //auto block44k = resampler.processIn(block);
-
-                auto readPointer = buffer.getReadPointer(0);
-                auto writePointer = buffer.getWritePointer(0);
+                for (int channel = 0; channel < numAmpChannels; ++channel)
+                    dualAmpBuffer.copyFrom(channel, 0, buffer, channel, 0, numSamples);
 
-                //auto readPointer = block44k.getReadPointer(0);
-                //auto writePointer = block44k.getWritePointer(0);
-
-                neuralNetwork1.process(readPointer, gain, master, writePointer, numSamples);
-
-                //resampler.processOut(block44k, block);
+                ampStage2.process(dualAmpBuffer.getArrayOfWritePointers(), numAmpChannels, numSamples, ampBlock2);
+                pipelinedModelActive[1] = ampBlock2.modelActive;
+                updateAmpLoad(1, ampBlock2, currentBufferDurationSeconds);
             }
-            else
-            {
-                // Applying gain
-                if (neuralNetwork2.input_size == 1) {
-                    buffer.applyGain(0, 0, numSamples, gain);
-                }
-
-                //auto block44k = resampler.processIn(block);
-
-                auto readPointer = buffer.getReadPointer(0);
-                auto writePointer = buffer.getWritePointer(0);
-
-                //auto readPointer = block44k.getReadPointer(0);
-                //auto writePointer = block44k.getWritePointer(0);
 
-                neuralNetwork2.process(readPointer, gain, master, writePointer, numSamples);
+            ampStage.process(buffer.getArrayOfWritePointers(), numAmpChannels, numSamples, ampBlock);
+            pipelinedModelActive[0] = ampBlock.modelActive;
+        }
+        else
+        {
+            processAmpStage(neuralNetwork, buffer.getArrayOfWritePointers(), numAmpChannels, numSamples, ampBlock);
+        }
 
-                //resampler.processOut(block44k, block);
-            }
+        updateAmpLoad(0, ampBlock, currentBufferDurationSeconds);
 
+        // Until the second amp has a model, only the first one is heard
+        if (dualAmpActive && ampBlock2.modelActive)
+        {
+            blendAmps(buffer.getArrayOfWritePointers(), dualAmpBuffer.getArrayOfWritePointers(), numAmpChannels, numSamples, ampBlock, ampBlock2);
+            masterApplied = true;
         }
 
         dcBlocker.process(context);
 
-        eq4band.process(buffer.getReadPointer(0), buffer.getWritePointer(0), midiMessages, numSamples, numInputChannels, sampleRate);
+        for (int channel = 0; channel < numAmpChannels; ++channel)
+            eq4band[channel].process(buffer.getReadPointer(channel), buffer.getWritePointer(channel), midiMessages, numSamples, numInputChannels, sampleRate);
 
         // Process Delay, Reverb, Chorus and Flanger
         delay.process(context);
@@ -602,9 +979,10 @@ void NeuralPiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
         flanger.process(context);
         reverb.process(context);
 
-        //    Master Volume 
-		if (currentNeuralNetwork == 0 && (neuralNetwork1.input_size == 1 || neuralNetwork1.input_size == 2) || currentNeuralNetwork == 1 && (neuralNetwork2.input_size == 1 || neuralNetwork2.input_size == 2)) {
-			buffer.applyGain(0, 0, numSamples, master * 2.0); // Adding volume range (2x) mainly for clean models
+        //    Master Volume, which the network applies to models that aren't conditioned on it
+		if (! masterApplied && ! ampBlock.modelActive && (ampBlock.modelInputSize == 1 || ampBlock.modelInputSize == 2)) {
+			for (int channel = 0; channel < numAmpChannels; ++channel)
+				buffer.applyGainRamp(channel, 0, numSamples, paramsStart[1] * 2.0f, paramsEnd[1] * 2.0f); // Adding volume range (2x) mainly for clean models
 		}
 
         // Process IR
@@ -618,6 +996,40 @@ void NeuralPiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
                 cabSimIR2.process(context);
             }
         }
+
+        float outputPeak = 0.0f;
+
+        for (int channel = 0; channel < numAmpChannels; ++channel)
+            outputPeak = jmax(outputPeak, buffer.getMagnitude(channel, 0, numSamples));
+
+        idleDetector.processOutput(outputPeak);
+    }
+
+    // A network the amp stages didn't run belongs to the audio thread, which starts
+    // the loads requested for it, so they don't wait for the amp to be switched on
+    if (! ampState)
+        neuralNetwork.postPendingLoads();
+
+    if (! dualAmpActive)
+        neuralNetwork2.postPendingLoads();
+
+    // The host is told about the resampler's and the pipeline's latency whenever they change.
+    // Skipped blocks don't know the amp's latency, but it can't have changed.
+    const int latency = chainIdle ? reportedLatency.load()
+                                  : ampBlock.modelLatency + (pipelineActive ? ampStage.getLatencySamples() : 0);
+
+    // The amp loads are reported twice a second
+    loadReportCountdown -= numSamples;
+
+    if (! ampState)
+        ampLoad[0] = 0.0f;
+    if (! dualAmpActive)
+        ampLoad[1] = 0.0f;
+
+    if (latency != reportedLatency.exchange(latency) || loadReportCountdown <= 0)
+    {
+        loadReportCountdown = sampleRate / 2;
+        triggerAsyncUpdate();
     }
 
     if(recording)
@@ -655,6 +1067,10 @@ void NeuralPiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffe
     }
 
 
+    // In stereo there is no line-in to mix
+    if (numAmpChannels == 2)
+        return;
+
     //Calculate averaged RMS over the last 10 seconds
     float currentRMS1 = buffer.getRMSLevel(1, 0, numSamples);
     averagedRMSLineIn = (averagedRMSLineIn * 10 + currentRMS1 * currentBufferDurationSeconds) / (10 + currentBufferDurationSeconds);
@@ -692,30 +1108,43 @@ void NeuralPiAudioProcessor::setStateInformation(const void* data, int sizeInByt
 
 void NeuralPiAudioProcessor::changeModel(File configFile)
 {
-    if(currentNeuralNetwork == 0)
-    {
-        loadConfig(configFile, neuralNetwork2);
-        currentNeuralNetwork = 1;
-    }
+    // Loaded, warmed up and crossfaded in by the network without blocking this thread.
+    // Morphing, the network runs the weights of this model blended with Model2's.
+    if (morphEnabled)
+        neuralNetwork.morphConfigs(configFile.getFullPathName(), configFiles[model2_index].getFullPathName(), ampBlend);
     else
-    {
-        loadConfig(configFile, neuralNetwork1);
-        currentNeuralNetwork = 0;
-    }
+        neuralNetwork.loadConfig(configFile.getFullPathName());
 }
 
-void NeuralPiAudioProcessor::loadConfig(File configFile, NeuralNetwork &out)
+void NeuralPiAudioProcessor::changeModel2(File configFile)
 {
-    try {
-        out.reset();
+    neuralNetwork2.loadConfig(configFile.getFullPathName());
+}
 
-        // Load the config file into the correct model
-        out.loadConfig(configFile.getFullPathName());
-        model_loaded = true;
+void NeuralPiAudioProcessor::selectModel(const String& name, const String& parameterID)
+{
+    bool found = false;
+
+    for(size_t i = 0; i < configFiles.size(); i++) {
+        if(name == configFiles[i].getFileNameWithoutExtension()) {
+            float value = static_cast<float>(i) / configFiles.size();
+            apvts.getParameter(parameterID)->setValueNotifyingHost(value);
+            found = true;
+            break;
+        }
     }
-    catch (const std::exception& e) {
-        DBG("Unable to load config file: " + configFile.getFullPathName());
-        std::cout << e.what();
+
+    if(!found)
+    {
+        File fullpath = userAppDataDirectory_tones.getFullPathName() + "/" + name + ".json";
+        if(!fullpath.existsAsFile())fullpath = userAppDataDirectory_tones.getFullPathName() + "/" + name + ".npb";
+        if(!fullpath.existsAsFile())fullpath = userAppDataDirectory_tones.getFullPathName() + "/" + name + ".nam";
+        if(fullpath.existsAsFile())
+        {
+            configFiles.push_back(fullpath);
+            float value = static_cast<float>(configFiles.size() - 1) / configFiles.size();
+            apvts.getParameter(parameterID)->setValueNotifyingHost(value);
+        }
     }
 }
 
@@ -753,10 +1182,22 @@ void NeuralPiAudioProcessor::resetDirectory(const File& file)
     if (file.isDirectory())
     {
         juce::Array<juce::File> results;
-        file.findChildFiles(results, juce::File::findFiles, false, "*.json");
+        file.findChildFiles(results, juce::File::findFiles, false, "*.json;*.npb;*.nam");
         for (int i = results.size(); --i >= 0;)
             configFiles.push_back(File(results.getReference(i).getFullPathName()));
     }
+
+    // The default tones are compiled in, so they're there even if they couldn't be installed
+    for (const auto* embedded : EmbeddedModels::getAll())
+    {
+        const String fileName(embedded->fileName);
+        const bool installed = std::any_of(configFiles.begin(), configFiles.end(), [&] (const File& configFile) {
+            return configFile.getFileName().equalsIgnoreCase(fileName);
+        });
+
+        if (! installed)
+            configFiles.push_back(file.getChildFile(fileName));
+    }
 }
 
 void NeuralPiAudioProcessor::resetDirectoryIR(const File& file)
@@ -817,39 +1258,15 @@ void NeuralPiAudioProcessor::installTones()
     File bjdirty_tone = userAppDataDirectory_tones.getFullPathName() + "/BluesJR.json";
     File ht40od_tone = userAppDataDirectory_tones.getFullPathName() + "/HT40_Overdrive.json";
 
-    if (ts9_tone.existsAsFile() == false) {
-        std::string string_command = ts9_tone.getFullPathName().toStdString();
-        const char* char_ts9_tone = &string_command[0];
-
-        std::ofstream myfile;
-        myfile.open(char_ts9_tone);
-        myfile << BinaryData::TS9_json;
-
-        myfile.close();
-    }
-
-    if (bjdirty_tone.existsAsFile() == false) {
-        std::string string_command = bjdirty_tone.getFullPathName().toStdString();
-        const char* char_bjdirty = &string_command[0];
+    // Written as is, so ModelStore recognises them and loads the compiled-in weights instead
+    if (ts9_tone.existsAsFile() == false)
+        ts9_tone.replaceWithData(BinaryData::TS9_json, BinaryData::TS9_jsonSize);
 
-        std::ofstream myfile;
-        myfile.open(char_bjdirty);
-        myfile << BinaryData::BluesJr_json;
+    if (bjdirty_tone.existsAsFile() == false)
+        bjdirty_tone.replaceWithData(BinaryData::BluesJr_json, BinaryData::BluesJr_jsonSize);
 
-        myfile.close();
-    }
-
-    if (ht40od_tone.existsAsFile() == false) {
-        std::string string_command = ht40od_tone.getFullPathName().toStdString();
-        const char* char_ht40od = &string_command[0];
-
-        std::ofstream myfile;
-        myfile.open(char_ht40od);
-        myfile << BinaryData::HT40_Overdrive_json;
-
-        myfile.close();
-    }
-    
+    if (ht40od_tone.existsAsFile() == false)
+        ht40od_tone.replaceWithData(BinaryData::HT40_Overdrive_json, BinaryData::HT40_Overdrive_jsonSize);
 }
 
 void NeuralPiAudioProcessor::set_delayParams(float paramValue)
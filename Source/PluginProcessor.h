@@ -17,6 +17,8 @@
 #include "Delay.h"
 #include "AmpOSCReceiver.h"
 #include "SmoothingEffect.h"
+#include "PipelineStage.h"
+#include "IdleDetector.h"
 
 #pragma once
 
@@ -24,10 +26,20 @@
 
 #define MODEL_ID "model"
 #define MODEL_NAME "Model"
+#define MODEL2_ID "model2"
+#define MODEL2_NAME "Model2"
 #define IR_ID "ir"
 #define IR_NAME "Ir"
 #define IRWETLEVEL_ID "irWetLevel"
 #define IRWETLEVEL_NAME "IrWetLevel"
+#define IRMINPHASE_ID "irMinPhase"
+#define IRMINPHASE_NAME "IrMinPhase"
+#define IRENERGY_ID "irEnergy"
+#define IRENERGY_NAME "IrEnergy"
+#define IRLENGTH_ID "irLength"
+#define IRLENGTH_NAME "IrLength"
+#define IRSAVED_ID "irSaved"
+#define IRSAVED_NAME "IrSaved"
 
 #define GAIN_ID "gain"
 #define GAIN_NAME "Gain"
@@ -41,6 +53,30 @@
 #define TREBLE_NAME "Treble"
 #define PRESENCE_ID "presence"
 #define PRESENCE_NAME "Presence"
+#define PRECISION_ID "precision"
+#define PRECISION_NAME "Precision"
+#define ACTIVATIONS_ID "activations"
+#define ACTIVATIONS_NAME "Activations"
+#define NATIVERATE_ID "nativeRate"
+#define NATIVERATE_NAME "NativeRate"
+#define PIPELINE_ID "pipeline"
+#define PIPELINE_NAME "Pipeline"
+#define DUALAMP_ID "dualAmp"
+#define DUALAMP_NAME "DualAmp"
+#define AMPBLEND_ID "ampBlend"
+#define AMPBLEND_NAME "AmpBlend"
+#define AMPLOAD1_ID "ampLoad1"
+#define AMPLOAD1_NAME "AmpLoad1"
+#define AMPLOAD2_ID "ampLoad2"
+#define AMPLOAD2_NAME "AmpLoad2"
+#define STEREO_ID "stereo"
+#define STEREO_NAME "Stereo"
+#define MORPH_ID "morph"
+#define MORPH_NAME "Morph"
+#define IDLESKIP_ID "idleSkip"
+#define IDLESKIP_NAME "IdleSkip"
+#define COMPRESSION_ID "compression"
+#define COMPRESSION_NAME "Compression"
 
 #define DELAY_ID "delay"
 #define DELAY_NAME "Delay"
@@ -98,7 +134,7 @@
 //==============================================================================
 /**
 */
-class NeuralPiAudioProcessor  : public AudioProcessor, public juce::AudioProcessorValueTreeState::Listener
+class NeuralPiAudioProcessor  : public AudioProcessor, public juce::AudioProcessorValueTreeState::Listener, private juce::AsyncUpdater
 {
 public:
     //==============================================================================
@@ -148,7 +184,7 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
 
     void changeModel(File configFile);
-    void loadConfig(File configFile, NeuralNetwork &out);
+    void changeModel2(File configFile);
     void loadIR(File irFile);
     void setupDataDirectories();
     void installTones();
@@ -175,14 +211,15 @@ public:
     float chorusValue = 0.0f;
     float flangerValue = 0.0f;
     float reverbValue = 0.0f;
+    float ampBlend = 0.5f;
 
     bool ampState = true;
     bool lstmState = true;
     bool irState = true;
 
     // Pedal/amp states
-    bool model_loaded = false;
     int model_index = 0;
+    int model2_index = 0;
 
     bool ir_loaded = false;
     int ir_index = 0;
@@ -193,26 +230,99 @@ public:
     float averagedRMSLineIn = 0;
 
 private:
+    void handleAsyncUpdate() override
+    {
+        setLatencySamples(reportedLatency.load());
+
+        apvts.getParameter(AMPLOAD1_ID)->setValueNotifyingHost(ampLoad[0].load());
+        apvts.getParameter(AMPLOAD2_ID)->setValueNotifyingHost(ampLoad[1].load());
+
+        const auto irReport = currentIR == 0 ? cabSimIR1.getIRReport() : cabSimIR2.getIRReport();
+        const auto numPartitionsLoaded = irReport.numPartitions + irReport.numPartitionsSaved;
+        apvts.getParameter(IRSAVED_ID)->setValueNotifyingHost(numPartitionsLoaded > 0 ? (float) irReport.numPartitionsSaved / (float) numPartitionsLoaded : 0.0f);
+    }
+
+    void selectModel(const String& name, const String& parameterID);
+    void modelParameterChanged(const juce::String& parameterID, float newValue);
+
+    // Serialises loading models and changing their options
+    CriticalSection modelLock;
+
+    std::atomic<int> reportedLatency { 0 };
+
+    // What the amp stage needs to process a block, and what it reports back.
+    // In the pipelined mode the report arrives with the audio, a block later.
+    struct AmpStageBlock
+    {
+        float paramsStart[2] {};
+        float paramsEnd[2] {};
+        bool runModel = false;
+
+        bool modelActive = false;
+        int modelInputSize = 1;
+        int modelLatency = 0;
+        double processingSeconds = 0.0;
+    };
+
+    void processAmpStage(NeuralNetwork& network, float* const* channels, int numChannels, int numSamples, AmpStageBlock& ampBlock);
+    void blendAmps(float* const* amp1, float* const* amp2, int numChannels, int numSamples, AmpStageBlock& amp1Block, const AmpStageBlock& amp2Block);
+    void updateAmpLoad(int amp, const AmpStageBlock& ampBlock, float blockDurationSeconds);
+
+    // Fraction of a block period each amp spent processing, averaged over about a second
+    std::atomic<float> ampLoad[2] {};
+    int loadReportCountdown = 0;
+
     bool recording = false;
     TimeSliceThread backgroundThread { "Audio Recorder Thread" };
     std::unique_ptr<AudioFormatWriter::ThreadedWriter> threadedWriter;
     CriticalSection writerLock;
     std::atomic<AudioFormatWriter::ThreadedWriter*> activeWriter { nullptr };
 
-    chowdsp::ResampledProcess<chowdsp::ResamplingTypes::LanczosResampler<>> resampler;
-
-    std::atomic<int> currentNeuralNetwork = 0;
-    NeuralNetwork neuralNetwork1;
-    NeuralNetwork neuralNetwork2;
-
-    Eq4Band eq4band; // Amp EQ
-
-    dsp::IIR::Filter<float> dcBlocker;
-
-    // IR processing
+    // Gain and master are smoothed per sample. Conditioned models get them as a
+    // linear ramp over the block, the others as a gain ramp on the buffer.
+    SmoothedValue<float> gainSmoothed;
+    SmoothedValue<float> masterSmoothed;
+
+    NeuralNetwork neuralNetwork;
+    NeuralNetwork neuralNetwork2; // The second amp of the dual-amp mode
+
+    // The amp stage can run on its own core, one block behind the rest of the chain.
+    // The dual-amp mode runs both amps that way, on cores 1 and 2.
+    std::atomic<bool> pipelineEnabled { false };
+    std::atomic<bool> dualAmpEnabled { false };
+    std::atomic<bool> morphEnabled { false }; // AmpBlend morphs the weights of Model into Model2 instead
+    bool pipelineActive = false;
+    bool dualAmpActive = false;
+    bool pipelinedModelActive[2] {};
+    PipelineStage<AmpStageBlock> ampStage { "NeuralPi amp stage", 1, [this] (float* const* channels, int numChannels, int numSamples, AmpStageBlock& ampBlock) { processAmpStage(neuralNetwork, channels, numChannels, numSamples, ampBlock); } };
+    PipelineStage<AmpStageBlock> ampStage2 { "NeuralPi amp 2 stage", 2, [this] (float* const* channels, int numChannels, int numSamples, AmpStageBlock& ampBlock) { processAmpStage(neuralNetwork2, channels, numChannels, numSamples, ampBlock); } };
+
+    // In stereo both inputs go through the amps, in lock-step, and the rest of the chain;
+    // otherwise the right input is line-in
+    std::atomic<bool> stereoEnabled { false };
+    int numAmpChannelsActive = 1;
+
+    // The second amp's copy of the input, the blend between the amps, and the
+    // delays that line up amps with different latencies (NativeRate at different rates)
+    AudioBuffer<float> dualAmpBuffer;
+    SmoothedValue<float> ampBlendSmoothed;
+    static constexpr int maxAlignmentDelay = 4096;
+    dsp::DelayLine<float, dsp::DelayLineInterpolationTypes::None> alignmentDelay[2];
+
+    Eq4Band eq4band[2]; // Amp EQ, the second one for the right channel in stereo
+
+    dsp::ProcessorDuplicator<dsp::IIR::Filter<float>, dsp::IIR::Coefficients<float>> dcBlocker;
+
+    // Skips the amp and effects while nothing is played
+    std::atomic<bool> idleSkipEnabled { false };
+    IdleDetector idleDetector;
+
+    // IR processing. The first 1024 samples of an IR are convolved on the audio thread,
+    // the rest of a long one on a worker thread (see CabSim::NonUniform).
     std::atomic<int> currentIR;
-    CabSim cabSimIR1;
-    CabSim cabSimIR2;
+    CabSim cabSimIR1 { CabSim::NonUniform { 1024, true } };
+    CabSim cabSimIR2 { CabSim::NonUniform { 1024, true } };
+    CabSim::IRProcessing irProcessing; // set by IrMinPhase, IrEnergy and IrLength
 
     AmpOSCReceiver oscReceiver;
 
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <RTNeural/RTNeural.h>
+
+#include "Activations.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/** IEEE 754 half precision storage. The arithmetic is done in float. */
+struct Float16
+{
+    static Float16 fromFloat (float x) noexcept
+    {
+        // Weights never need to be infinite, so clamp to the largest half instead
+        x = std::clamp (x, -65504.0f, 65504.0f);
+
+        uint32_t f;
+        std::memcpy (&f, &x, sizeof (f));
+
+        const auto sign = (uint16_t) ((f >> 16) & 0x8000u);
+        f &= 0x7fffffffu;
+
+        if (f < 0x38800000u)
+        {
+            // Subnormal half: the unit in the last place is 2^-24
+            float magnitude;
+            std::memcpy (&magnitude, &f, sizeof (magnitude));
+            return { (uint16_t) (sign | (uint16_t) std::lrint (magnitude * 16777216.0f)) };
+        }
+
+        // Rebias the exponent and round the mantissa to nearest even
+        const auto mantissaOdd = (f >> 13) & 1u;
+        f = f - ((uint32_t) (127 - 15) << 23) + 0xfffu + mantissaOdd;
+        return { (uint16_t) (sign | (f >> 13)) };
+    }
+
+    // Branch free, so loops over Float16 arrays vectorise
+    inline float toFloat() const noexcept
+    {
+        const uint32_t f = (uint32_t) (bits & 0x7fffu) << 13;
+        float magnitude;
+        std::memcpy (&magnitude, &f, sizeof (magnitude));
+        magnitude *= 0x1.0p112f;
+        return (bits & 0x8000u) != 0 ? -magnitude : magnitude;
+    }
+
+    uint16_t bits = 0;
+};
+
+/**
+    Single layer LSTM followed by a Dense(hidden_size -> 1) output layer and
+    an optional skip connection, with the recurrent matrix U stored in reduced
+    precision.
+
+    U is by far the largest tensor (4 * hidden_size^2 values) and is read once
+    per sample, so storing it in 16 or 8 bits halves or quarters the memory
+    traffic of the recurrence:
+
+      - WeightType = Float16: IEEE half precision, widened to float as it is read.
+      - WeightType = int8_t: symmetric quantisation with one scale per gate
+        unit, applied once to the accumulated U*h product.
+
+    Only the weights are quantised. The hidden state stays in float, so the
+    int8 weights are widened to float and U*h is accumulated in float rather
+    than in int32: an integer dot product would need the hidden state rounded
+    to 8 bits as well, which adds a second quantisation error on every step of
+    the recurrence. What's saved is the memory traffic, not the multiplies.
+    The input weights, biases and output layer are small and stay in float
+    too. The setters take the contiguous RTNeural layout, like BlockLSTM.
+*/
+template <int input_size, int hidden_size, typename WeightType, typename Activation = Activations::Exact>
+class QuantisedLSTM
+{
+    using v_type = xsimd::simd_type<float>;
+    static constexpr int v_size = (int) v_type::size;
+    static constexpr int padded_hidden = (hidden_size + v_size - 1) / v_size * v_size;
+
+    // Gate order is the same as PyTorch and RTNeural: input, forget, cell, output
+    static constexpr int numGates = 4;
+
+    static constexpr bool isInt8 = std::is_same_v<WeightType, int8_t>;
+    static_assert (isInt8 || std::is_same_v<WeightType, Float16>, "QuantisedLSTM supports int8_t and Float16 weights");
+
+public:
+    QuantisedLSTM()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        std::fill (std::begin (h), std::end (h), 0.0f);
+        std::fill (std::begin (c), std::end (c), 0.0f);
+    }
+
+    static constexpr size_t getStateSize() noexcept
+    {
+        return 2 * sizeof (float[padded_hidden]);
+    }
+
+    void saveState (void* dest) const noexcept
+    {
+        auto* bytes = static_cast<char*> (dest);
+        std::memcpy (bytes, h, sizeof (h));
+        std::memcpy (bytes + sizeof (h), c, sizeof (c));
+    }
+
+    void restoreState (const void* source) noexcept
+    {
+        const auto* bytes = static_cast<const char*> (source);
+        std::memcpy (h, bytes, sizeof (h));
+        std::memcpy (c, bytes + sizeof (h), sizeof (c));
+    }
+
+    /** wVals has the shape [input_size][4 * hidden_size], rows stored contiguously */
+    void setWVals (const float* wVals)
+    {
+        for (int i = 0; i < input_size; ++i)
+            for (int g = 0; g < numGates; ++g)
+                std::copy (wVals + (i * numGates + g) * hidden_size, wVals + (i * numGates + g + 1) * hidden_size, W[i][g]);
+    }
+
+    /** uVals has the shape [hidden_size][4 * hidden_size], rows stored contiguously */
+    void setUVals (const float* uVals)
+    {
+        const auto u = [uVals] (int j, int g, int k) { return uVals[(j * numGates + g) * hidden_size + k]; };
+
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < hidden_size; ++k)
+            {
+                if constexpr (isInt8)
+                {
+                    float maxValue = 0.0f;
+
+                    for (int j = 0; j < hidden_size; ++j)
+                        maxValue = std::max (maxValue, std::abs (u (j, g, k)));
+
+                    const auto scale = maxValue > 0.0f ? maxValue / 127.0f : 1.0f;
+                    uScale[g][k] = scale;
+
+                    for (int j = 0; j < hidden_size; ++j)
+                        U[j][g][k] = (int8_t) std::clamp (std::lrint (u (j, g, k) / scale), -127L, 127L);
+                }
+                else
+                {
+                    for (int j = 0; j < hidden_size; ++j)
+                        U[j][g][k] = Float16::fromFloat (u (j, g, k));
+                }
+            }
+        }
+    }
+
+    /** bVals has the shape [4 * hidden_size], with the input and hidden biases already summed */
+    void setBVals (const float* bVals)
+    {
+        for (int g = 0; g < numGates; ++g)
+            std::copy (bVals + g * hidden_size, bVals + (g + 1) * hidden_size, b[g]);
+    }
+
+    void setDenseWeights (const float* weights)
+    {
+        std::copy (weights, weights + hidden_size, denseW);
+    }
+
+    void setDenseBias (const float* bias)
+    {
+        denseB = bias[0];
+    }
+
+    /** Adds the input sample to the output (enabled by default) */
+    void setSkipConnection (bool shouldAddInput)
+    {
+        skipGain = shouldAddInput ? 1.0f : 0.0f;
+    }
+
+    /** Processes a block of samples while the conditioning parameters move
+        linearly from paramsStart to paramsEnd, reaching paramsEnd on the last
+        sample of the block. input and output may point to the same buffer.
+    */
+    void process (const float* input, const float* paramsStart, const float* paramsEnd, float* output, int numSamples) noexcept
+    {
+        if (numSamples <= 0)
+            return;
+
+        float params[input_size] {};
+        float paramsStep[input_size] {};
+
+        for (int i = 1; i < input_size; ++i)
+        {
+            paramsStep[i] = (paramsEnd[i - 1] - paramsStart[i - 1]) / (float) numSamples;
+            params[i] = paramsEnd[i - 1] - paramsStep[i] * (float) (numSamples - 1);
+        }
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            const auto x = input[n];
+            params[0] = x;
+
+            output[n] = recurrentStep (params) + skipGain * x;
+
+            for (int i = 1; i < input_size; ++i)
+                params[i] += paramsStep[i];
+        }
+    }
+
+private:
+    static inline float toFloat (int8_t x) noexcept { return (float) x; }
+    static inline float toFloat (Float16 x) noexcept { return x.toFloat(); }
+
+    inline float recurrentStep (const float (&inputs)[input_size]) noexcept
+    {
+        alignas (v_type) float gates[numGates][padded_hidden];
+
+        for (int g = 0; g < numGates; ++g)
+        {
+            for (int k = 0; k < padded_hidden; ++k)
+            {
+                auto sum = b[g][k];
+
+                for (int i = 0; i < input_size; ++i)
+                    sum += W[i][g][k] * inputs[i];
+
+                gates[g][k] = sum;
+            }
+        }
+
+        alignas (v_type) float recurrent[numGates][padded_hidden] {};
+
+        for (int j = 0; j < hidden_size; ++j)
+        {
+            const auto hj = h[j];
+
+            for (int g = 0; g < numGates; ++g)
+                for (int k = 0; k < padded_hidden; ++k)
+                    recurrent[g][k] += toFloat (U[j][g][k]) * hj;
+        }
+
+        for (int g = 0; g < numGates; ++g)
+            for (int k = 0; k < padded_hidden; ++k)
+                gates[g][k] += isInt8 ? recurrent[g][k] * uScale[g][k] : recurrent[g][k];
+
+        // Padded lanes have zero weights and biases, so their state stays exactly zero
+        for (int k = 0; k < padded_hidden; k += v_size)
+        {
+            const auto it = Activation::sigmoid (xsimd::load_aligned (gates[0] + k));
+            const auto ft = Activation::sigmoid (xsimd::load_aligned (gates[1] + k));
+            const auto ct = Activation::tanh (xsimd::load_aligned (gates[2] + k));
+            const auto ot = Activation::sigmoid (xsimd::load_aligned (gates[3] + k));
+
+            const auto cNew = xsimd::fma (ft, xsimd::load_aligned (c + k), it * ct);
+            const auto hNew = ot * Activation::tanh (cNew);
+
+            cNew.store_aligned (c + k);
+            hNew.store_aligned (h + k);
+        }
+
+        float y = denseB;
+
+        for (int k = 0; k < hidden_size; ++k)
+            y += denseW[k] * h[k];
+
+        return y;
+    }
+
+    // Same layout as BlockLSTM, so the loop over k vectorises
+    WeightType U[hidden_size][numGates][padded_hidden] {};
+    float uScale[numGates][padded_hidden] {}; // int8 only
+
+    float W[input_size][numGates][padded_hidden] {};
+    float b[numGates][padded_hidden] {};
+    float denseW[padded_hidden] {};
+    float denseB = 0.0f;
+    float skipGain = 1.0f;
+
+    alignas (v_type) float h[padded_hidden];
+    alignas (v_type) float c[padded_hidden];
+};
@@ -0,0 +1,315 @@
+#include "WaveNet.h"
+
+#include "Activations.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    int padToRegisters (int size, int registerSize)
+    {
+        return (size + registerSize - 1) / registerSize * registerSize;
+    }
+
+    size_t nextPowerOfTwo (size_t x)
+    {
+        size_t result = 1;
+
+        while (result < x)
+            result <<= 1;
+
+        return result;
+    }
+
+    template <typename Vector>
+    void setPadded (Vector& dest, const std::vector<float>& source, int paddedSize)
+    {
+        dest.assign ((size_t) paddedSize, 0.0f);
+        std::copy (source.begin(), source.end(), dest.begin());
+    }
+}
+
+//==============================================================================
+void WaveNetModel::PaddedMatrix::set (const WeightMatrix& matrix, int paddedOutputs)
+{
+    numInputs = matrix.numRows;
+    numOutputs = paddedOutputs;
+    values.assign ((size_t) (numInputs * numOutputs), 0.0f);
+
+    for (int i = 0; i < numInputs; ++i)
+        std::copy (matrix.row (i), matrix.row (i) + matrix.numColumns, values.data() + i * numOutputs);
+}
+
+void WaveNetModel::PaddedMatrix::setGated (const WeightMatrix& matrix, int channels, int paddedChannels)
+{
+    numInputs = matrix.numRows;
+    numOutputs = 2 * paddedChannels;
+    values.assign ((size_t) (numInputs * numOutputs), 0.0f);
+
+    for (int i = 0; i < numInputs; ++i)
+    {
+        auto* row = values.data() + i * numOutputs;
+        std::copy (matrix.row (i), matrix.row (i) + channels, row);
+        std::copy (matrix.row (i) + channels, matrix.row (i) + 2 * channels, row + paddedChannels);
+    }
+}
+
+//==============================================================================
+void WaveNetModel::setWeights (const WaveNetWeights& weights)
+{
+    layerArrays.clear();
+    headScale = weights.headScale;
+    scratchStride = v_size;
+
+    for (const auto& source : weights.layerArrays)
+    {
+        LayerArray layerArray;
+        layerArray.channels = source.channels;
+        layerArray.paddedChannels = padToRegisters (source.channels, v_size);
+        layerArray.paddedHead = padToRegisters (source.headSize, v_size);
+        layerArray.kernelSize = source.kernelSize;
+        layerArray.gated = source.gated;
+        layerArray.activation = source.activation;
+
+        const auto paddedChannels = layerArray.paddedChannels;
+        const auto paddedConvOutputs = source.gated ? 2 * paddedChannels : paddedChannels;
+
+        const auto setConvMatrix = [&] (PaddedMatrix& dest, const WeightMatrix& matrix)
+        {
+            if (source.gated)
+                dest.setGated (matrix, source.channels, paddedChannels);
+            else
+                dest.set (matrix, paddedChannels);
+        };
+
+        layerArray.rechannel.set (source.rechannel, paddedChannels);
+
+        for (const auto& sourceLayer : source.layers)
+        {
+            Layer layer;
+            layer.dilation = sourceLayer.dilation;
+
+            layer.conv.resize (sourceLayer.conv.size());
+            for (size_t k = 0; k < sourceLayer.conv.size(); ++k)
+                setConvMatrix (layer.conv[k], sourceLayer.conv[k]);
+
+            // The bias is a [1][convOutputs] matrix as far as the padding is concerned
+            PaddedMatrix convBias;
+            WeightMatrix biasRow (1, source.convOutputs());
+            std::copy (sourceLayer.convBias.begin(), sourceLayer.convBias.end(), biasRow.row (0));
+            setConvMatrix (convBias, biasRow);
+            layer.convBias = std::move (convBias.values);
+
+            setConvMatrix (layer.inputMixin, sourceLayer.inputMixin);
+            layer.oneByOne.set (sourceLayer.oneByOne, paddedChannels);
+            setPadded (layer.oneByOneBias, sourceLayer.oneByOneBias, paddedChannels);
+
+            // Room for the oldest tap of the convolution plus a whole chunk
+            const auto historySize = nextPowerOfTwo ((size_t) (layer.dilation * (source.kernelSize - 1) + maxChunkSize));
+            layer.history.assign (historySize * (size_t) paddedChannels, 0.0f);
+            layer.historyMask = historySize - 1;
+
+            layerArray.layers.push_back (std::move (layer));
+        }
+
+        layerArray.headRechannel.set (source.headRechannel, layerArray.paddedHead);
+        setPadded (layerArray.headBias, source.headBias, layerArray.paddedHead);
+
+        scratchStride = std::max ({ scratchStride, paddedConvOutputs, layerArray.paddedHead });
+        layerArrays.push_back (std::move (layerArray));
+    }
+
+    const auto scratchSize = (size_t) (maxChunkSize * scratchStride);
+    z.assign ((size_t) scratchStride, 0.0f);
+    head.assign (scratchSize, 0.0f);
+    nextHead.assign (scratchSize, 0.0f);
+    arrayInput.assign (scratchSize, 0.0f);
+    arrayOutput.assign (scratchSize, 0.0f);
+
+    reset();
+}
+
+void WaveNetModel::reset()
+{
+    for (auto& layerArray : layerArrays)
+        for (auto& layer : layerArray.layers)
+            std::fill (layer.history.begin(), layer.history.end(), 0.0f);
+
+    position = 0;
+}
+
+size_t WaveNetModel::getStateSize() const noexcept
+{
+    size_t size = sizeof (position);
+
+    for (const auto& layerArray : layerArrays)
+        for (const auto& layer : layerArray.layers)
+            size += layer.history.size() * sizeof (float);
+
+    return size;
+}
+
+void WaveNetModel::saveState (void* dest) const noexcept
+{
+    auto* bytes = static_cast<char*> (dest);
+    std::memcpy (bytes, &position, sizeof (position));
+    bytes += sizeof (position);
+
+    for (const auto& layerArray : layerArrays)
+    {
+        for (const auto& layer : layerArray.layers)
+        {
+            std::memcpy (bytes, layer.history.data(), layer.history.size() * sizeof (float));
+            bytes += layer.history.size() * sizeof (float);
+        }
+    }
+}
+
+void WaveNetModel::restoreState (const void* source) noexcept
+{
+    const auto* bytes = static_cast<const char*> (source);
+    std::memcpy (&position, bytes, sizeof (position));
+    bytes += sizeof (position);
+
+    for (auto& layerArray : layerArrays)
+    {
+        for (auto& layer : layerArray.layers)
+        {
+            std::memcpy (layer.history.data(), bytes, layer.history.size() * sizeof (float));
+            bytes += layer.history.size() * sizeof (float);
+        }
+    }
+}
+
+//==============================================================================
+void WaveNetModel::process (const float* input, const float* /*paramsStart*/, const float* /*paramsEnd*/, float* output, int numSamples) noexcept
+{
+    for (int start = 0; start < numSamples; start += maxChunkSize)
+        processChunk (input + start, output + start, std::min (maxChunkSize, numSamples - start));
+}
+
+void WaveNetModel::processChunk (const float* input, float* output, int numSamples) noexcept
+{
+    const auto stride = (size_t) scratchStride;
+
+    for (int n = 0; n < numSamples; ++n)
+    {
+        arrayInput[(size_t) n * stride] = input[n];
+        std::fill_n (head.data() + (size_t) n * stride, stride, 0.0f);
+    }
+
+    for (size_t a = 0; a < layerArrays.size(); ++a)
+    {
+        auto& layerArray = layerArrays[a];
+        const auto paddedChannels = layerArray.paddedChannels;
+        auto& layers = layerArray.layers;
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            auto* dest = frame (layers.front(), paddedChannels, position + (size_t) n);
+            std::fill_n (dest, paddedChannels, 0.0f);
+            multiplyAccumulate (arrayInput.data() + (size_t) n * stride, layerArray.rechannel, dest);
+        }
+
+        // The residual output of the last array isn't used by anything
+        const bool isLastArray = a + 1 == layerArrays.size();
+
+        for (size_t l = 0; l < layers.size(); ++l)
+        {
+            const bool isLastLayer = l + 1 == layers.size();
+
+            processLayer (layerArray,
+                          layers[l],
+                          isLastLayer ? nullptr : &layers[l + 1],
+                          isLastLayer && ! isLastArray ? arrayOutput.data() : nullptr,
+                          input,
+                          numSamples);
+        }
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            auto* dest = nextHead.data() + (size_t) n * stride;
+            std::copy (layerArray.headBias.begin(), layerArray.headBias.end(), dest);
+            multiplyAccumulate (head.data() + (size_t) n * stride, layerArray.headRechannel, dest);
+        }
+
+        std::swap (head, nextHead);
+        std::swap (arrayInput, arrayOutput);
+    }
+
+    for (int n = 0; n < numSamples; ++n)
+        output[n] = headScale * head[(size_t) n * stride];
+
+    position += (size_t) numSamples;
+}
+
+// The residual output goes to the history of the next layer, or to the array
+// output in the scratch buffer after the last layer. If neither is given
+// it isn't needed. The condition is the model input.
+void WaveNetModel::processLayer (const LayerArray& layerArray, Layer& layer, Layer* nextLayer, float* output, const float* condition, int numSamples) noexcept
+{
+    const auto paddedChannels = layerArray.paddedChannels;
+    const auto stride = (size_t) scratchStride;
+    const auto kernelSize = layerArray.kernelSize;
+
+    for (int n = 0; n < numSamples; ++n)
+    {
+        const auto time = position + (size_t) n;
+
+        std::copy (layer.convBias.begin(), layer.convBias.end(), z.begin());
+
+        // Causal dilated convolution, the last tap is the current sample. The
+        // indices wrap around below zero at the start, which the mask handles.
+        for (int k = 0; k < kernelSize; ++k)
+            multiplyAccumulate (frame (layer, paddedChannels, time - (size_t) (layer.dilation * (kernelSize - 1 - k))), layer.conv[(size_t) k], z.data());
+
+        multiplyAccumulate (condition + n, layer.inputMixin, z.data());
+
+        applyActivation (layerArray.activation, z.data(), paddedChannels);
+
+        if (layerArray.gated)
+        {
+            for (int c = 0; c < paddedChannels; c += v_size)
+            {
+                const auto gate = Activations::Exact::sigmoid (xsimd::load_aligned (z.data() + paddedChannels + c));
+                (xsimd::load_aligned (z.data() + c) * gate).store_aligned (z.data() + c);
+            }
+        }
+
+        auto* headFrame = head.data() + (size_t) n * stride;
+
+        for (int c = 0; c < paddedChannels; c += v_size)
+            (xsimd::load_aligned (headFrame + c) + xsimd::load_aligned (z.data() + c)).store_aligned (headFrame + c);
+
+        if (nextLayer == nullptr && output == nullptr)
+            continue;
+
+        auto* dest = nextLayer != nullptr ? frame (*nextLayer, paddedChannels, time) : output + (size_t) n * stride;
+        const auto* current = frame (layer, paddedChannels, time);
+
+        for (int c = 0; c < paddedChannels; c += v_size)
+            (xsimd::load_aligned (current + c) + xsimd::load_aligned (layer.oneByOneBias.data() + c)).store_aligned (dest + c);
+
+        multiplyAccumulate (z.data(), layer.oneByOne, dest);
+    }
+}
+
+void WaveNetModel::applyActivation (WaveNetActivation activation, float* x, int size) noexcept
+{
+    const auto apply = [x, size] (auto&& function)
+    {
+        for (int i = 0; i < size; i += v_size)
+            function (xsimd::load_aligned (x + i)).store_aligned (x + i);
+    };
+
+    switch (activation)
+    {
+        case WaveNetActivation::Tanh:     apply ([] (v_type v) { return Activations::Exact::tanh (v); }); break;
+        // NAM's fast tanh is an approximation as well, this one is more accurate
+        case WaveNetActivation::FastTanh: apply ([] (v_type v) { return Activations::Rational::tanh (v); }); break;
+        case WaveNetActivation::HardTanh: apply ([] (v_type v) { return xsimd::min (xsimd::max (v, v_type (-1.0f)), v_type (1.0f)); }); break;
+        case WaveNetActivation::ReLU:     apply ([] (v_type v) { return xsimd::max (v, v_type (0.0f)); }); break;
+        case WaveNetActivation::Sigmoid:  apply ([] (v_type v) { return Activations::Exact::sigmoid (v); }); break;
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <RTNeural/RTNeural.h>
+
+#include "ModelWeights.h"
+
+#include <cstddef>
+#include <vector>
+
+/**
+    Inference for Neural Amp Modeler WaveNets (see WaveNetWeights).
+
+    The sizes are only known at run time, so instead of compile-time
+    specialisation the channel dimension is padded to whole SIMD registers
+    and every matrix-vector product runs across the output channels: each
+    input channel scales one contiguous, aligned row of weights. The padded
+    channels have zero weights and biases, so they stay exactly zero.
+
+    Each layer keeps the history its dilated convolution needs in its own
+    ring buffer of frames (one padded vector of channels per sample), sized
+    to a power of two so wrapping is a mask. Blocks are processed in chunks
+    of up to maxChunkSize samples, one layer at a time, so a layer's weights
+    stay in cache for the whole chunk.
+
+    The whole state is the ring buffers, so it can be snapshotted like the
+    LSTMs' state.
+*/
+class WaveNetModel
+{
+    using v_type = xsimd::simd_type<float>;
+    static constexpr int v_size = (int) v_type::size;
+
+    template <typename T>
+    using AlignedVector = std::vector<T, xsimd::aligned_allocator<T>>;
+
+public:
+    static constexpr int maxChunkSize = 64;
+
+    /** Allocates all the buffers, so call this off the audio thread */
+    void setWeights (const WaveNetWeights& weights);
+
+    void reset();
+
+    /** WaveNets aren't conditioned on any parameters, so they are ignored */
+    void process (const float* input, const float* paramsStart, const float* paramsEnd, float* output, int numSamples) noexcept;
+
+    size_t getStateSize() const noexcept;
+    void saveState (void* dest) const noexcept;
+    void restoreState (const void* source) noexcept;
+
+private:
+    /** A matrix with its outputs padded to whole SIMD registers */
+    struct PaddedMatrix
+    {
+        void set (const WeightMatrix& matrix, int paddedOutputs);
+
+        // Splits gated convolutions into two padded halves, so the activation
+        // and the gate both start on a register boundary
+        void setGated (const WeightMatrix& matrix, int channels, int paddedChannels);
+
+        int numInputs = 0;
+        int numOutputs = 0;
+        AlignedVector<float> values;
+    };
+
+    struct Layer
+    {
+        int dilation = 1;
+        std::vector<PaddedMatrix> conv;
+        AlignedVector<float> convBias;
+        PaddedMatrix inputMixin;
+        PaddedMatrix oneByOne;
+        AlignedVector<float> oneByOneBias;
+
+        // Input frames of this layer
+        AlignedVector<float> history;
+        size_t historyMask = 0;
+    };
+
+    struct LayerArray
+    {
+        int channels = 1;
+        int paddedChannels = 0;
+        int paddedHead = 0;
+        int kernelSize = 1;
+        bool gated = false;
+        WaveNetActivation activation = WaveNetActivation::Tanh;
+
+        PaddedMatrix rechannel;
+        std::vector<Layer> layers;
+        PaddedMatrix headRechannel;
+        AlignedVector<float> headBias;
+    };
+
+    void processChunk (const float* input, float* output, int numSamples) noexcept;
+    void processLayer (const LayerArray& layerArray, Layer& layer, Layer* nextLayer, float* output, const float* condition, int numSamples) noexcept;
+
+    static void applyActivation (WaveNetActivation activation, float* x, int size) noexcept;
+
+    /** y += x * matrix, across the padded outputs */
+    static inline void multiplyAccumulate (const float* x, const PaddedMatrix& matrix, float* y) noexcept
+    {
+        const auto* w = matrix.values.data();
+
+        for (int o = 0; o < matrix.numOutputs; o += v_size)
+        {
+            auto sum = xsimd::load_aligned (y + o);
+
+            for (int i = 0; i < matrix.numInputs; ++i)
+                sum = xsimd::fma (xsimd::load_aligned (w + i * matrix.numOutputs + o), v_type (x[i]), sum);
+
+            sum.store_aligned (y + o);
+        }
+    }
+
+    static inline float* frame (Layer& layer, int paddedChannels, size_t position) noexcept
+    {
+        return layer.history.data() + (position & layer.historyMask) * (size_t) paddedChannels;
+    }
+
+    std::vector<LayerArray> layerArrays;
+    float headScale = 1.0f;
+
+    // Absolute time of the next sample, the ring buffers are indexed with it
+    size_t position = 0;
+
+    // [maxChunkSize][padded size] scratch buffers. The head and the residual
+    // output of one array are the inputs of the next.
+    AlignedVector<float> z, head, nextHead, arrayOutput, arrayInput;
+    int scratchStride = 0;
+};
@@ -0,0 +1,169 @@
+/*
+    Turns NeuralPi/Proteus .json models into a C++ header of constexpr weight
+    tables, which the plugin loads without reading or parsing any file (see
+    EmbeddedModel.h). Run by the build for the default tones.
+
+    Usage: NeuralPiEmbedModels <output header> <model.json>...
+*/
+
+#include "EmbeddedModel.h"
+
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// TS9.json -> TS9, HT40 Overdrive.json -> HT40_Overdrive
+static std::string makeIdentifier(const fs::path& path)
+{
+    std::string identifier = path.stem().string();
+
+    for (auto& c : identifier)
+        if(! std::isalnum((unsigned char) c))
+            c = '_';
+
+    if(identifier.empty() || std::isdigit((unsigned char) identifier.front()))
+        identifier = "_" + identifier;
+
+    return identifier;
+}
+
+// Exponent notation always has a decimal point, so every value is a valid float literal
+static std::string formatFloat(float value)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9ef", (double) value);
+    return text;
+}
+
+static void writeTable(std::ostream& out, const std::string& name, const std::vector<float>& values)
+{
+    out << "    alignas(64) constexpr float " << name << "[] = {";
+
+    for (size_t i = 0; i < values.size(); ++i)
+        out << (i % 8 == 0 ? "\n        " : " ") << formatFloat(values[i]) << (i + 1 < values.size() ? "," : "");
+
+    out << "\n    };\n\n";
+}
+
+static void writeModel(std::ostream& out, const fs::path& path, const std::string& identifier)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(! in)
+        throw std::runtime_error("unable to open file");
+
+    const std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const auto weights = ModelWeights::fromJson(nlohmann::json::parse(source));
+    const auto& architecture = weights.architecture;
+
+    out << "namespace " << identifier << "_data\n{\n";
+
+    for (size_t l = 0; l < weights.layers.size(); ++l)
+    {
+        const auto& layer = weights.layers[l];
+        const auto prefix = "layer" + std::to_string(l) + "_";
+
+        writeTable(out, prefix + "W", layer.W.values);
+        writeTable(out, prefix + "U", layer.U.values);
+        writeTable(out, prefix + "bias", layer.bias);
+
+        if(! layer.hiddenBias.empty())
+            writeTable(out, prefix + "hiddenBias", layer.hiddenBias);
+    }
+
+    writeTable(out, "dense", weights.denseWeights);
+
+    out << "    constexpr EmbeddedModel::Layer layers[] = {\n";
+
+    for (size_t l = 0; l < weights.layers.size(); ++l)
+    {
+        const auto& layer = weights.layers[l];
+        const auto prefix = "layer" + std::to_string(l) + "_";
+
+        out << "        { " << prefix << "W, " << layer.W.numRows << ", " << layer.W.numColumns << ", "
+            << prefix << "U, " << layer.U.numRows << ", " << layer.U.numColumns << ", "
+            << prefix << "bias, " << layer.bias.size() << ", "
+            << (layer.hiddenBias.empty() ? std::string("nullptr") : prefix + "hiddenBias") << ", " << layer.hiddenBias.size() << " },\n";
+    }
+
+    out << "    };\n}\n\n";
+
+    out << "constexpr EmbeddedModel " << identifier << " {\n"
+        << "    \"" << path.filename().string() << "\", " << source.size() << ", "
+        << EmbeddedModel::hash(source.data(), source.size()) << "ull,\n"
+        << "    { " << (architecture.unitType == RecurrentUnit::LSTM ? "RecurrentUnit::LSTM" : "RecurrentUnit::GRU") << ", "
+        << architecture.inputSize << ", " << architecture.hiddenSize << ", " << architecture.numLayers << ", "
+        << (architecture.skip ? "true" : "false") << " },\n"
+        << "    " << formatFloat(weights.sampleRate) << ", " << identifier << "_data::layers, "
+        << identifier << "_data::dense, " << formatFloat(weights.denseBias) << "\n};\n\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <output header> <model.json>..." << std::endl;
+        return 1;
+    }
+
+    std::ostringstream out;
+    std::vector<std::string> identifiers;
+
+    out << "// Generated by NeuralPiEmbedModels from the default tones. Do not edit.\n\n"
+        << "#pragma once\n\n"
+        << "#include \"EmbeddedModel.h\"\n\n"
+        << "namespace EmbeddedModels\n{\n\n";
+
+    for (int i = 2; i < argc; ++i)
+    {
+        const fs::path path(argv[i]);
+
+        try
+        {
+            identifiers.push_back(makeIdentifier(path));
+            writeModel(out, path, identifiers.back());
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << path.string() << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    out << "constexpr const EmbeddedModel* all[] = {";
+
+    for (const auto& identifier : identifiers)
+        out << " &" << identifier << ",";
+
+    out << " };\n\n}\n";
+
+    // Only touch the header when it changes, so the plugin isn't rebuilt for nothing
+    const auto header = out.str();
+    const fs::path outputPath(argv[1]);
+
+    {
+        std::ifstream existing(outputPath, std::ios::binary);
+        const std::string previous((std::istreambuf_iterator<char>(existing)), std::istreambuf_iterator<char>());
+
+        if(previous == header)
+            return 0;
+    }
+
+    std::ofstream file(outputPath, std::ios::binary);
+    file << header;
+
+    if(! file)
+    {
+        std::cerr << "Unable to write " << outputPath.string() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+/*
+    Measures how fast the model kernels run on this machine, as a real-time
+    factor: the time it takes to process a signal divided by its duration.
+    Below 1 a model runs in real time on one core; 1 / RTF is roughly how
+    many instances of it would fit. Build it natively on each target (x86,
+    or ARM on the Raspberry Pi), the SIMD instruction set it was compiled
+    for is printed first.
+
+    Usage: NeuralPiModelBenchmark <model.json | model.npb | model.nam | directory>...
+                                  [-b <block size>] [-t <seconds>] [-s <sample rate>] [-c <streams>] [-r]
+
+    Models run at their own sample rate unless -s is given, on blocks of 128
+    samples and 10 seconds of audio by default, with the default ModelOptions.
+    With -c the model processes 2, 4 or 8 streams at once (ModelOptions::numStreams),
+    and the RTF is given for all of them and per stream.
+    With -r single layer LSTMs also run on RTNeural's LSTMLayerT and DenseT,
+    the layers BlockLSTM replaces, and both are given in ns per sample.
+*/
+
+#include "ModelRegistry.h"
+
+#include <RTNeural/RTNeural.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static ModelWeights loadWeights(const fs::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(! in)
+        throw std::runtime_error("unable to open file");
+
+    if(path.extension() == ModelBinaryFormat::fileExtension)
+    {
+        const std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return ModelWeights::fromBinary(data.data(), data.size());
+    }
+
+    nlohmann::json weights_json;
+    in >> weights_json;
+
+    if(path.extension() == ".nam")
+        return ModelWeights::fromNam(weights_json);
+
+    return ModelWeights::fromJson(weights_json);
+}
+
+static bool isModelFile(const fs::path& path)
+{
+    return path.extension() == ".json" || path.extension() == ".nam" || path.extension() == ModelBinaryFormat::fileExtension;
+}
+
+static std::string describe(const ModelWeights& weights)
+{
+    if(weights.waveNet.has_value())
+    {
+        std::string channels;
+        size_t numLayers = 0;
+
+        for (const auto& layerArray : weights.waveNet->layerArrays)
+        {
+            channels += (channels.empty() ? "" : "/") + std::to_string(layerArray.channels);
+            numLayers += layerArray.layers.size();
+        }
+
+        return "WaveNet, " + std::to_string(numLayers) + " layers, channels " + channels
+             + ", receptive field " + std::to_string(weights.waveNet->getReceptiveField());
+    }
+
+    const auto& architecture = weights.architecture;
+
+    return std::string(architecture.unitType == RecurrentUnit::LSTM ? "LSTM" : "GRU")
+         + ", hidden " + std::to_string(architecture.hiddenSize) + ", " + std::to_string(architecture.numLayers) + " layer(s)"
+         + (ModelRegistry::isSpecialised(architecture) ? "" : ", dynamic");
+}
+
+// Distorted sines with a little noise, so nothing settles into a trivial state
+static std::vector<float> makeTestSignal(double sampleRate, double seconds)
+{
+    std::vector<float> signal((size_t) (sampleRate * seconds));
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+
+    for (size_t n = 0; n < signal.size(); ++n)
+    {
+        const auto t = (float) ((double) n / sampleRate);
+        signal[n] = 0.5f * std::tanh(2.0f * std::sin(2.0f * 3.14159265f * 110.0f * t)) * (0.5f + 0.5f * std::sin(3.0f * t)) + noise(rng);
+    }
+
+    return signal;
+}
+
+// Every stream gets the same signal
+static double process(NeuralModel& model, const std::vector<float>& input, std::vector<std::vector<float>>& outputs, int blockSize)
+{
+    const float params[] = { 0.5f, 0.5f };
+    const auto numStreams = outputs.size();
+    std::vector<const float*> inputPointers(numStreams);
+    std::vector<float*> outputPointers(numStreams);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t offset = 0; offset < input.size(); offset += (size_t) blockSize)
+    {
+        const auto numSamples = (int) std::min((size_t) blockSize, input.size() - offset);
+
+        for (size_t s = 0; s < numStreams; ++s)
+        {
+            inputPointers[s] = input.data() + offset;
+            outputPointers[s] = outputs[s].data() + offset;
+        }
+
+        model.processStreams(inputPointers.data(), params, params, outputPointers.data(), numSamples);
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Single layer LSTM on RTNeural's layers, loaded like ModelRegistry loads RTNeural::ModelT
+template <int input_size, int hidden_size>
+class ReferenceLSTM : public NeuralModel
+{
+    using v_type = xsimd::simd_type<float>;
+
+public:
+    explicit ReferenceLSTM(const ModelWeights& weights)
+        : skipGain(weights.architecture.skip ? 1.0f : 0.0f)
+    {
+        auto& lstm = model.template get<0>();
+        lstm.setWVals(weights.layers[0].W.toVec2d());
+        lstm.setUVals(weights.layers[0].U.toVec2d());
+        lstm.setBVals(weights.layers[0].bias);
+
+        auto& dense = model.template get<1>();
+        dense.setWeights(Vec2d { weights.denseWeights });
+        dense.setBias(&weights.denseBias);
+    }
+
+    void reset() override
+    {
+        model.reset();
+    }
+
+    // Constant parameters are enough here, the benchmark doesn't ramp them
+    void process(const float* inData, const float* paramsStart, const float*, float* outData, int numSamples) override
+    {
+        for (int p = 1; p < input_size; ++p)
+            input[p] = paramsStart[p - 1];
+
+        for (int n = 0; n < numSamples; ++n)
+        {
+            const auto x = inData[n];
+            input[0] = x;
+            outData[n] = model.forward(input) + skipGain * x;
+        }
+    }
+
+private:
+    RTNeural::ModelT<float, input_size, 1, RTNeural::LSTMLayerT<float, input_size, hidden_size>, RTNeural::DenseT<float, hidden_size, 1>> model;
+    const float skipGain;
+    alignas(v_type) float input[((input_size + v_type::size - 1) / v_type::size) * v_type::size] {};
+};
+
+template <int input_size, int... hidden_sizes>
+static std::unique_ptr<NeuralModel> createReference(const ModelWeights& weights, std::integer_sequence<int, hidden_sizes...>)
+{
+    std::unique_ptr<NeuralModel> reference;
+
+    ((weights.architecture.hiddenSize == hidden_sizes
+          && (reference = std::make_unique<ReferenceLSTM<input_size, hidden_sizes>>(weights), true)) || ...);
+
+    return reference;
+}
+
+// nullptr for anything but a specialised single layer LSTM
+static std::unique_ptr<NeuralModel> createReference(const ModelWeights& weights)
+{
+    const auto& architecture = weights.architecture;
+
+    if(weights.waveNet.has_value() || architecture.unitType != RecurrentUnit::LSTM || architecture.numLayers != 1
+        || ! ModelRegistry::isSpecialised(architecture))
+        return nullptr;
+
+    // The hidden sizes ModelRegistry specialises
+    using HiddenSizes = std::integer_sequence<int, 8, 12, 16, 20, 24, 32, 40, 48, 64>;
+
+    switch (architecture.inputSize)
+    {
+        case 1: return createReference<1>(weights, HiddenSizes());
+        case 2: return createReference<2>(weights, HiddenSizes());
+        default: return createReference<3>(weights, HiddenSizes());
+    }
+}
+
+static bool benchmarkModel(const fs::path& path, int blockSize, double seconds, double sampleRateOverride, int numStreams, bool compareReference)
+{
+    try
+    {
+        const auto weights = loadWeights(path);
+        const auto sampleRate = sampleRateOverride > 0.0 ? sampleRateOverride : (double) weights.sampleRate;
+        ModelOptions options;
+        options.numStreams = numStreams;
+        const auto model = ModelRegistry::createModel(weights, options);
+
+        const auto input = makeTestSignal(sampleRate, seconds);
+        std::vector<std::vector<float>> outputs((size_t) numStreams, std::vector<float>(input.size()));
+
+        // The first pass warms up the caches and the branch predictors
+        process(*model, input, outputs, blockSize);
+        model->reset();
+        const auto elapsed = process(*model, input, outputs, blockSize);
+        const auto realTimeFactor = elapsed / seconds;
+
+        std::cout << path.filename().string() << " (" << describe(weights) << ")" << std::endl;
+        std::printf("    %.0f Hz   RTF %.4f   %.1fx real time\n", sampleRate, realTimeFactor, 1.0 / realTimeFactor);
+
+        if(numStreams > 1)
+            std::printf("    %d streams   RTF %.4f per stream\n", numStreams, realTimeFactor / numStreams);
+
+        if(compareReference && numStreams == 1)
+        {
+            if(auto reference = createReference(weights))
+            {
+                process(*reference, input, outputs, blockSize);
+                reference->reset();
+                const auto referenceElapsed = process(*reference, input, outputs, blockSize);
+                const auto numSamples = (double) input.size();
+
+                // Negative when NeuralPi's kernel takes less time than RTNeural
+                std::printf("    %.1f ns/sample   RTNeural %.1f ns/sample   %+.1f%%\n",
+                            elapsed * 1.0e9 / numSamples, referenceElapsed * 1.0e9 / numSamples,
+                            (elapsed / referenceElapsed - 1.0) * 100.0);
+            }
+        }
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << path.string() << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<fs::path> inputs;
+    int blockSize = 128;
+    double seconds = 10.0;
+    double sampleRate = 0.0;
+    int numStreams = 1;
+    bool compareReference = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+
+        if(arg == "-b" && i + 1 < argc)
+            blockSize = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "-t" && i + 1 < argc)
+            seconds = std::stod(argv[++i]);
+        else if(arg == "-s" && i + 1 < argc)
+            sampleRate = std::stod(argv[++i]);
+        else if(arg == "-c" && i + 1 < argc)
+            numStreams = std::stoi(argv[++i]);
+        else if(arg == "-r")
+            compareReference = true;
+        else
+            inputs.emplace_back(arg);
+    }
+
+    if(inputs.empty() || ! (seconds > 0.0))
+    {
+        std::cerr << "Usage: " << argv[0] << " <model.json | model.npb | model.nam | directory>... [-b <block size>] [-t <seconds>] [-s <sample rate>] [-c <streams>] [-r]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "SIMD: " << xsimd::default_arch::name() << ", block size " << blockSize << std::endl;
+    int numFailed = 0;
+
+    for (const auto& path : inputs)
+    {
+        if(fs::is_directory(path))
+        {
+            std::vector<fs::path> models;
+
+            for (const auto& entry : fs::directory_iterator(path))
+                if(entry.is_regular_file() && isModelFile(entry.path()))
+                    models.push_back(entry.path());
+
+            std::sort(models.begin(), models.end());
+
+            for (const auto& model : models)
+                numFailed += benchmarkModel(model, blockSize, seconds, sampleRate, numStreams, compareReference) ? 0 : 1;
+        }
+        else
+        {
+            numFailed += benchmarkModel(path, blockSize, seconds, sampleRate, numStreams, compareReference) ? 0 : 1;
+        }
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
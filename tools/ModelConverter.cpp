@@ -0,0 +1,94 @@
+/*
+    Converts NeuralPi/Proteus .json models to the NeuralPi binary model format (.npb),
+    which the plugin loads without any parsing.
+
+    Usage: NeuralPiModelConverter <model.json | directory>... [-o <output directory>]
+
+    Directories are searched (non-recursively) for .json files. Each model is
+    written next to its source, or to the output directory, with the .npb extension.
+*/
+
+#include "ModelWeights.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static bool convertModel(const fs::path& input, const fs::path& outputDirectory)
+{
+    try
+    {
+        std::ifstream in(input);
+        if(! in)
+            throw std::runtime_error("unable to open file");
+
+        nlohmann::json weights_json;
+        in >> weights_json;
+
+        const auto binary = ModelWeights::fromJson(weights_json).toBinary();
+
+        auto output = (outputDirectory.empty() ? input.parent_path() : outputDirectory) / input.filename();
+        output.replace_extension(ModelBinaryFormat::fileExtension);
+
+        std::ofstream out(output, std::ios::binary);
+        out.write(binary.data(), (std::streamsize) binary.size());
+
+        if(! out)
+            throw std::runtime_error("unable to write " + output.string());
+
+        std::cout << input.string() << " -> " << output.string() << " (" << binary.size() << " bytes)" << std::endl;
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << input.string() << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<fs::path> inputs;
+    fs::path outputDirectory;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+
+        if(arg == "-o" && i + 1 < argc)
+            outputDirectory = argv[++i];
+        else
+            inputs.emplace_back(arg);
+    }
+
+    if(inputs.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " <model.json | directory>... [-o <output directory>]" << std::endl;
+        return 1;
+    }
+
+    if(! outputDirectory.empty())
+        fs::create_directories(outputDirectory);
+
+    int numFailed = 0;
+
+    for (const auto& input : inputs)
+    {
+        if(fs::is_directory(input))
+        {
+            for (const auto& entry : fs::directory_iterator(input))
+                if(entry.is_regular_file() && entry.path().extension() == ".json")
+                    numFailed += convertModel(entry.path(), outputDirectory) ? 0 : 1;
+        }
+        else
+        {
+            numFailed += convertModel(input, outputDirectory) ? 0 : 1;
+        }
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+/*
+    Measures how much accuracy the reduced precision model kernels and the
+    approximated activations lose compared to float32 with exact activations,
+    on a synthetic guitar-like test signal.
+
+    Usage: NeuralPiQuantisationReport <model.json | model.npb | directory>... [-s <sample rate>] [-c <max ESR>]
+
+    For every model and combination of ModelOptions it prints the
+    error-to-signal ratio (ESR, the metric the models are trained with) and
+    the peak absolute difference from the reference output, plus the size of
+    the recurrent weights. Models without a specialised single layer LSTM
+    kernel always run in float32 with exact activations, and are only listed.
+
+    With -c, every model is also compressed within the given ESR (see
+    ModelCompressor) and the hidden size, rank and accuracy it ends up with
+    are listed.
+*/
+
+#include "ModelCompressor.h"
+#include "ModelRegistry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static ModelWeights loadWeights(const fs::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(! in)
+        throw std::runtime_error("unable to open file");
+
+    if(path.extension() == ModelBinaryFormat::fileExtension)
+    {
+        const std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        return ModelWeights::fromBinary(data.data(), data.size());
+    }
+
+    nlohmann::json weights_json;
+    in >> weights_json;
+    return ModelWeights::fromJson(weights_json);
+}
+
+// Decaying plucked notes at a few pitches and levels, plus a little noise
+static std::vector<float> makeTestSignal(double sampleRate)
+{
+    const int noteLength = (int) (sampleRate / 2);
+    const float frequencies[] = { 82.4f, 110.0f, 196.0f, 329.6f, 146.8f, 440.0f };
+    const float levels[] = { 0.8f, 0.3f, 0.5f, 0.1f, 1.0f, 0.05f };
+
+    std::vector<float> signal;
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.002f);
+
+    for (size_t note = 0; note < std::size(frequencies); ++note)
+    {
+        for (int n = 0; n < noteLength; ++n)
+        {
+            const auto t = (float) (n / sampleRate);
+            const auto phase = 2.0f * 3.14159265f * frequencies[note] * t;
+            const auto envelope = levels[note] * std::exp(-4.0f * t);
+
+            signal.push_back(envelope * (std::sin(phase) + 0.5f * std::sin(2.0f * phase) + 0.25f * std::sin(3.0f * phase)) / 1.75f
+                             + noise(rng));
+        }
+    }
+
+    return signal;
+}
+
+static std::vector<float> render(NeuralModel& model, const std::vector<float>& input)
+{
+    constexpr int blockSize = 128;
+    const float params[] = { 0.5f, 0.5f };
+
+    std::vector<float> output(input.size());
+    model.reset();
+
+    for (size_t start = 0; start < input.size(); start += blockSize)
+    {
+        const auto numSamples = (int) std::min((size_t) blockSize, input.size() - start);
+        model.process(input.data() + start, params, params, output.data() + start, numSamples);
+    }
+
+    return output;
+}
+
+static void reportCompression(const ModelWeights& weights, double maxESR)
+{
+    if(weights.waveNet.has_value() || weights.architecture.numLayers != 1)
+        return;
+
+    const auto result = ModelCompressor::compress(weights, maxESR);
+    const auto hiddenSize = (size_t) result.hiddenSize;
+    const auto numGates = (size_t) weights.architecture.numGates();
+    const auto numRecurrentWeights = result.rank > 0 ? hiddenSize * (size_t) result.rank * (1 + numGates)
+                                                     : numGates * hiddenSize * hiddenSize;
+
+    std::printf("    compressed to hidden %zu, rank %d   U %7zu bytes   ESR %.2e (max %.2e)\n",
+                hiddenSize,
+                result.rank,
+                numRecurrentWeights * sizeof(float),
+                result.esr,
+                maxESR);
+}
+
+static bool reportModel(const fs::path& path, const std::vector<float>& input, double maxCompressionESR)
+{
+    try
+    {
+        const auto weights = loadWeights(path);
+        const auto& architecture = weights.architecture;
+        const auto reference = render(*ModelRegistry::createModel(weights), input);
+
+        double signalEnergy = 0.0;
+        for (auto y : reference)
+            signalEnergy += (double) y * y;
+
+        const bool isQuantisable = architecture.unitType == RecurrentUnit::LSTM && architecture.numLayers == 1
+                                && ModelRegistry::isSpecialised(architecture);
+        const size_t numRecurrentWeights = (size_t) (architecture.numGates() * architecture.hiddenSize * architecture.hiddenSize);
+
+        std::cout << path.filename().string() << " (" << (architecture.unitType == RecurrentUnit::LSTM ? "LSTM" : "GRU")
+                  << ", hidden " << architecture.hiddenSize << ", " << architecture.numLayers << " layer(s))" << std::endl;
+
+        std::printf("    float32  exact     U %7zu bytes   (reference)\n", numRecurrentWeights * sizeof(float));
+
+        if(maxCompressionESR > 0.0)
+            reportCompression(weights, maxCompressionESR);
+
+        if(! isQuantisable)
+            return true;
+
+        struct Mode { const char* precisionName; const char* activationsName; ModelOptions options; size_t bytesPerWeight; };
+        const Mode modes[] = { { "float32", "rational", { ModelPrecision::Float32, ModelActivations::Rational }, 4 },
+                               { "float16", "exact",    { ModelPrecision::Float16, ModelActivations::Exact },    2 },
+                               { "int8",    "exact",    { ModelPrecision::Int8,    ModelActivations::Exact },    1 },
+                               { "int8",    "rational", { ModelPrecision::Int8,    ModelActivations::Rational }, 1 } };
+
+        for (const auto& mode : modes)
+        {
+            const auto output = render(*ModelRegistry::createModel(weights, mode.options), input);
+
+            double errorEnergy = 0.0, peakError = 0.0;
+
+            for (size_t n = 0; n < output.size(); ++n)
+            {
+                const auto error = (double) output[n] - reference[n];
+                errorEnergy += error * error;
+                peakError = std::max(peakError, std::abs(error));
+            }
+
+            const auto esr = signalEnergy > 0.0 ? errorEnergy / signalEnergy : 0.0;
+
+            std::printf("    %-8s %-9s U %7zu bytes   ESR %.2e   peak error %.2e\n",
+                        mode.precisionName,
+                        mode.activationsName,
+                        numRecurrentWeights * mode.bytesPerWeight,
+                        esr,
+                        peakError);
+        }
+
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << path.string() << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<fs::path> inputs;
+    double sampleRate = 44100.0;
+    double maxCompressionESR = 0.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+
+        if(arg == "-s" && i + 1 < argc)
+            sampleRate = std::stod(argv[++i]);
+        else if(arg == "-c" && i + 1 < argc)
+            maxCompressionESR = std::stod(argv[++i]);
+        else
+            inputs.emplace_back(arg);
+    }
+
+    if(inputs.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " <model.json | model.npb | directory>... [-s <sample rate>] [-c <max ESR>]" << std::endl;
+        return 1;
+    }
+
+    const auto input = makeTestSignal(sampleRate);
+    int numFailed = 0;
+
+    for (const auto& path : inputs)
+    {
+        if(fs::is_directory(path))
+        {
+            std::vector<fs::path> models;
+
+            for (const auto& entry : fs::directory_iterator(path))
+                if(entry.is_regular_file() && (entry.path().extension() == ".json" || entry.path().extension() == ModelBinaryFormat::fileExtension))
+                    models.push_back(entry.path());
+
+            std::sort(models.begin(), models.end());
+
+            for (const auto& model : models)
+                numFailed += reportModel(model, input, maxCompressionESR) ? 0 : 1;
+        }
+        else
+        {
+            numFailed += reportModel(path, input, maxCompressionESR) ? 0 : 1;
+        }
+    }
+
+    return numFailed == 0 ? 0 : 1;
+}